@@ -37,6 +37,7 @@
 #include "logging.h"
 #include "hardware.h"
 #include "domoticz.h"
+#include "rules.h"
 
 #ifndef NO_TESTS
   #define TEST_THS_FAIL  // test temperature & humidity sensor
@@ -58,6 +59,7 @@ void setRelay(int value) {
     events.send(RelayState.c_str(),"relaystate");        // updates all Web clients
     updateDomoticzSwitch(config.dmtzSwitchIdx, value);   // and Domoticz
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Relay state updated"));
+    rulesUpdate(rvRelay, 10*value, millis());
   }
 }
 
@@ -70,6 +72,7 @@ void initRelay(void) {
   addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Initializing relay I/O pin."));
   pinMode(RELAY_PIN, OUTPUT);
   setRelay(0);
+  rulesUpdate(rvRelay, 10*digitalRead(RELAY_PIN), millis());   // known even if unchanged
 }
 
 // Button
@@ -175,6 +178,8 @@ void readTemp(void) {
       Temperature = String(temperature, 1);
       addToLogPf(LOG_INFO, TAG_HARDWARE, PSTR("Humidity %s --> %.1f"), Humidity.c_str(), humidity);
       Humidity = String(humidity, 1);
+      rulesUpdate(rvTemp, lroundf(10*temperature), millis());
+      rulesUpdate(rvHumidity, lroundf(10*humidity), millis());
     }
     if (doUpdate) {
       events.send(Temperature.c_str(), "tempvalue");        // updates all Web clients
@@ -228,7 +233,7 @@ void readBrightness() {
     uint32_t mvolt = analogReadMilliVolts(LS_PIN);
     lsAvg = addlsValue(mvolt);
     #ifdef DEBUG_LS_FIFO
-    addToLogPf(LOG_DEBUG, TAG_HARDWARE, PSTR("Raw light value: %d, avg: %d"), mvolt, lsAvg);
+    addToLogPf(LOG_DEBUG, TAG_HARDWARE, PSTR("Raw light value: %u, avg: %u"), (unsigned) mvolt, (unsigned) lsAvg);
     #endif
     lightreadtime = millis();
   }
@@ -241,6 +246,7 @@ void readBrightness() {
     brightnesstime = millis();
     events.send(Brightness.c_str(),"brightvalue");             // updates all Web clients
     updateDomoticzBrightnessSensor(config.dmtzLSIdx, value);  // and Domoticz
+    rulesUpdate(rvBrightness, 10*value, millis());
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Average brightness data updated"));
   }
 }
@@ -257,6 +263,7 @@ void readBrightness() {
     brightnesstime = millis();
     events.send(Brightness.c_str(),"brightvalue");            // updates all Web clients
     updateDomoticzBrightnessSensor(config.dmtzLSIdx, value);  // and Domoticz
+    rulesUpdate(rvBrightness, 10*value, millis());
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Brightness data updated"));
   }
 }
@@ -264,15 +271,28 @@ void readBrightness() {
 #endif  // no FIFO
 
 
+// Rules (see rules.h)
+
+// Executes the action of a rule when it fires
+static void ruleAction(int rule, ruleAction_t action) {
+  addToLogPf(LOG_INFO, TAG_HARDWARE, PSTR("Rule %d fired"), rule + 1);
+  if (action == raRelayToggle)
+    toggleRelay();
+  else
+    setRelay(action == raRelayOn);
+}
+
 void checkHardware(void) {
   checkButton();
   readTemp();
   readBrightness();
+  rulesTick(millis());
 }
 
 Ticker ticker;
 
 void initHardware(void) {
+  rulesSetAction(ruleAction);
   initRelay();
   initSensor();
   initBrightness();
@@ -24,6 +24,7 @@
 #include "logging.h"
 #include "hardware.h"
 #include "domoticz.h"
+#include "rules.h"
 
 
 #ifndef NO_TESTS
@@ -45,6 +46,7 @@ void setRelay(int value) {
     events.send(RelayState.c_str(),"relaystate");        // updates all Web clients
     updateDomoticzSwitch(config.dmtzSwitchIdx, value);   // and Domoticz
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Relay state updated"));
+    rulesUpdate(rvRelay, 10*value, millis());
   }
 }
 
@@ -56,6 +58,7 @@ void initRelay(void) {
   addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Initializing relay I/O pin."));
   pinMode(RELAY_PIN, OUTPUT);
   setRelay(0);
+  rulesUpdate(rvRelay, 10*digitalRead(RELAY_PIN), millis());   // known even if unchanged
 }
 
 // Button
@@ -125,6 +128,8 @@ void readTemp(void) {
     events.send(Temperature.c_str(),"tempvalue");        // updates all Web clients
     events.send(Humidity.c_str(),"humdvalue");           // and Domoticz
     updateDomoticzTemperatureHumiditySensor(config.dmtzTHSIdx, temp, humid);
+    rulesUpdate(rvTemp, lroundf(10*temp), millis());
+    rulesUpdate(rvHumidity, lroundf(10*humid), millis());
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Temperature and humidity data updated"));
   }
 }
@@ -168,19 +173,33 @@ void readBrightness(void) {
     brightnesstime = millis();
     events.send(Brightness.c_str(),"brightvalue");                 // updates all Web clients
     updateDomoticzBrightnessSensor(config.dmtzLSIdx, BrightnessValue); // and Domoticz
+    rulesUpdate(rvBrightness, 10*BrightnessValue, millis());
     addToLogP(LOG_INFO, TAG_HARDWARE, PSTR("Brightness data updated"));
   }
 }
 
+// Rules (see rules.h)
+
+// Executes the action of a rule when it fires
+static void ruleAction(int rule, ruleAction_t action) {
+  addToLogPf(LOG_INFO, TAG_HARDWARE, PSTR("Rule %d fired"), rule + 1);
+  if (action == raRelayToggle)
+    toggleRelay();
+  else
+    setRelay(action == raRelayOn);
+}
+
 void checkHardware(void) {
   checkButton();
   readTemp();
   readBrightness();
+  rulesTick(millis());
 }
 
 Ticker ticker;
 
 void initHardware(void) {
+  rulesSetAction(ruleAction);
   initRelay();
   initSensor();
   initBrightness();
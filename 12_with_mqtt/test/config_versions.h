@@ -0,0 +1,184 @@
+// config_versions.h
+//
+// The config_t of older versions of the firmware, written out by hand as they were
+// declared, to check that config.cpp, which derives these layouts from its table of
+// fields, upgrades what the older firmware saved in NVS. See the history of
+// CONFIG_VERSION in config.h.
+
+#pragma once
+
+#include "../with_mqtt/config.h"
+
+  // version 1 (10_with_config), saved under the "config" key
+struct configV1_t {
+  uint16_t magic;
+  uint16_t version;
+  char hostname[HOSTNAME_SZ];
+  char devname[HOST_SZ];
+  char wifiSsid[HOST_SZ];
+  char wifiPswd[PSWD_SZ];
+  uint32_t staStaticIP;
+  uint32_t staGateway;
+  uint32_t staNetmask;
+  uint32_t syslogIP;
+  uint16_t syslogPort;
+  char dmtzHost[HOST_SZ];
+  uint16_t dmtzPort;
+  char dmtzUser[USER_SZ];
+  char dmtzPswd[PSWD_SZ];
+  uint16_t dmtzSwitchIdx;
+  uint16_t dmtzTHSIdx;
+  uint16_t dmtzLSIdx;
+  uint32_t dmtzReqTimeout;
+  char mqttHost[HOST_SZ];
+  uint16_t mqttPort;
+  char mqttUser[USER_SZ];
+  char mqttPswd[PSWD_SZ];
+  uint16_t mqttBufferSize;
+  uint16_t hdwPollTime;
+  uint32_t sensorUpdtTime;
+  uint8_t logLevelUart;
+  uint8_t logLevelSyslog;
+  uint8_t logLevelWebc;
+  uint8_t logLevelMqtt;
+  uint32_t checksum;              // weighted sum of the bytes
+};
+
+  // version 2 (11_with_wm), saved under the "config" key
+struct configV2_t {
+  uint16_t magic;
+  uint16_t version;
+  char hostname[HOSTNAME_SZ];
+  char devname[HOST_SZ];
+  char wifiSsid[HOST_SZ];
+  char wifiPswd[PSWD_SZ];
+  uint32_t staStaticIP;
+  uint32_t staGateway;
+  uint32_t staNetmask;
+  char apSuffix[AP_SUFFIX_SZ];
+  char apPswd[PSWD_SZ];
+  uint32_t apIP;
+  uint32_t apMask;
+  uint32_t syslogIP;
+  uint16_t syslogPort;
+  char dmtzHost[HOST_SZ];
+  uint16_t dmtzPort;
+  char dmtzUser[USER_SZ];
+  char dmtzPswd[PSWD_SZ];
+  uint16_t dmtzSwitchIdx;
+  uint16_t dmtzTHSIdx;
+  uint16_t dmtzLSIdx;
+  uint32_t dmtzReqTimeout;
+  char mqttHost[HOST_SZ];
+  uint16_t mqttPort;
+  char mqttUser[USER_SZ];
+  char mqttPswd[PSWD_SZ];
+  uint16_t mqttBufferSize;
+  uint16_t hdwPollTime;
+  uint32_t sensorUpdtTime;
+  uint32_t apDelayTime;
+  uint8_t logLevelUart;
+  uint8_t logLevelSyslog;
+  uint8_t logLevelWebc;
+  uint8_t logLevelMqtt;
+  uint32_t checksum;              // weighted sum of the bytes
+};
+
+  // versions 5 and 6, saved in the pages "cfg0", "cfg1", ... The checksum of version 6
+  // is a CRC-32.
+struct configV5_t {
+  uint16_t magic;
+  uint16_t version;
+  char hostname[HOSTNAME_SZ];
+  char devname[HOST_SZ];
+  char wifiSsid[HOST_SZ];
+  char wifiPswd[PSWD_SZ];
+  uint32_t staStaticIP;
+  uint32_t staGateway;
+  uint32_t staNetmask;
+  char apSuffix[AP_SUFFIX_SZ];
+  char apPswd[PSWD_SZ];
+  uint32_t apIP;
+  uint32_t apMask;
+  uint32_t syslogIP;
+  uint16_t syslogPort;
+  char dmtzHost[HOST_SZ];
+  uint16_t dmtzPort;
+  char dmtzUser[USER_SZ];
+  char dmtzPswd[PSWD_SZ];
+  uint16_t dmtzSwitchIdx;
+  uint16_t dmtzTHSIdx;
+  uint16_t dmtzLSIdx;
+  uint32_t dmtzReqTimeout;
+  char topicDmtzPub[MQTT_TOPIC_SZ];
+  char topicDmtzSub[MQTT_TOPIC_SZ];
+  char topicLog[MQTT_TOPIC_SZ];
+  char topicCmd[MQTT_TOPIC_SZ];
+  char mqttHost[HOST_SZ];
+  uint16_t mqttPort;
+  char mqttUser[USER_SZ];
+  char mqttPswd[PSWD_SZ];
+  uint16_t mqttBufferSize;
+  uint16_t hdwPollTime;
+  uint32_t sensorUpdtTime;
+  uint32_t apDelayTime;
+  uint32_t sendBudget;
+  uint8_t logLevelUart;
+  uint8_t logLevelSyslog;
+  uint8_t logLevelWebc;
+  uint8_t logLevelMqtt;
+  uint32_t logRepeatWindow;
+  uint16_t logRate[TAG_COUNT];
+  uint8_t logBurst[TAG_COUNT];
+  uint32_t checksum;
+};
+
+  // version 7, saved in the slots "cfgA0", "cfgA1", ... and "cfgB0", ... with a header
+  // "cfgA" or "cfgB" holding a sequence number and the checksum
+struct configV7_t {
+  uint16_t magic;
+  uint16_t version;
+  char hostname[HOSTNAME_SZ];
+  char devname[HOST_SZ];
+  char wifiSsid[HOST_SZ];
+  char wifiPswd[PSWD_SZ];
+  uint32_t staStaticIP;
+  uint32_t staGateway;
+  uint32_t staNetmask;
+  char apSuffix[AP_SUFFIX_SZ];
+  char apPswd[PSWD_SZ];
+  uint32_t apIP;
+  uint32_t apMask;
+  uint32_t syslogIP;
+  uint16_t syslogPort;
+  char dmtzHost[HOST_SZ];
+  uint16_t dmtzPort;
+  char dmtzUser[USER_SZ];
+  char dmtzPswd[PSWD_SZ];
+  uint16_t dmtzSwitchIdx;
+  uint16_t dmtzTHSIdx;
+  uint16_t dmtzLSIdx;
+  uint32_t dmtzReqTimeout;
+  char topicDmtzPub[MQTT_TOPIC_SZ];
+  char topicDmtzSub[MQTT_TOPIC_SZ];
+  char topicLog[MQTT_TOPIC_SZ];
+  char topicCmd[MQTT_TOPIC_SZ];
+  char mqttHost[HOST_SZ];
+  uint16_t mqttPort;
+  char mqttUser[USER_SZ];
+  char mqttPswd[PSWD_SZ];
+  uint16_t mqttBufferSize;
+  uint16_t hdwPollTime;
+  uint32_t sensorUpdtTime;
+  uint32_t apDelayTime;
+  uint32_t sendBudget;
+  uint8_t logLevelUart;
+  uint8_t logLevelSyslog;
+  uint8_t logLevelWebc;
+  uint8_t logLevelMqtt;
+  uint32_t logRepeatWindow;
+  uint16_t logRate[TAG_COUNT];
+  uint8_t logBurst[TAG_COUNT];
+  uint32_t saveDelay;
+  uint32_t checksum;
+};
@@ -0,0 +1,52 @@
+// Arduino.h
+//
+// Host stand-in for the parts of the Arduino core used by the modules under test.
+// Time is simulated: millis() returns hostMillis, which the tests advance.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+extern uint32_t hostMillis;
+
+inline unsigned long millis(void) { return hostMillis; }
+unsigned long micros(void);
+inline void delay(unsigned long ms) { hostMillis += ms; }
+inline void yield(void) {}
+
+// Writes to stdout only when hostSerialEcho is set
+class HardwareSerial {
+public:
+  void begin(unsigned long) {}
+  int availableForWrite(void);
+  size_t write(const uint8_t *buf, size_t len);
+  size_t write(const char *buf, size_t len) { return write((const uint8_t *) buf, len); }
+  void flush(void) {}
+};
+
+extern HardwareSerial Serial;
+extern bool hostSerialEcho;
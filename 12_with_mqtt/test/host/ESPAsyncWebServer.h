@@ -0,0 +1,18 @@
+// ESPAsyncWebServer.h
+//
+// Host stand-in for the parts of ESPAsyncWebServer used by the logging module,
+// the server sent events are discarded.
+
+#pragma once
+
+#include "Arduino.h"
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+class AsyncEventSource {
+public:
+  AsyncEventSource(const char *) {}
+  void send(const char *, const char * = NULL, uint32_t = 0, uint32_t = 0) {}
+  size_t count(void) const { return 0; }
+  size_t avgPacketsWaiting(void) const { return 0; }
+};
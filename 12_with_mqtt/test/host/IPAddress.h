@@ -0,0 +1,25 @@
+// IPAddress.h
+//
+// Host stand-in for the Arduino IPAddress class, an IPv4 address in network order.
+
+#pragma once
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+  IPAddress() : addr(0) {}
+  IPAddress(uint32_t a) : addr(a) {}
+  operator uint32_t() const { return addr; }
+  bool fromString(const char *s) {
+    unsigned b[4];
+    char end;
+    if ((sscanf(s, "%u.%u.%u.%u%c", &b[0], &b[1], &b[2], &b[3], &end) != 4)
+        || (b[0] > 255) || (b[1] > 255) || (b[2] > 255) || (b[3] > 255))
+      return false;
+    addr = b[0] | b[1] << 8 | b[2] << 16 | b[3] << 24;
+    return true;
+  }
+private:
+  uint32_t addr;
+};
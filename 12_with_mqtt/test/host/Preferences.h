@@ -0,0 +1,44 @@
+// Preferences.h
+//
+// Host stand-in for the ESP32 Preferences library, NVS is a map of keys to blobs.
+// hostNvsFailAfter makes putBytes() fail after that many writes (-1: never) to
+// simulate a full NVS or a power cut during a save.
+
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+#include <vector>
+
+extern std::map<std::string, std::vector<uint8_t>> hostNvs;
+extern int hostNvsFailAfter;
+extern size_t hostNvsWrites;
+
+class Preferences {
+public:
+  bool begin(const char *, bool) { return true; }
+  void end(void) {}
+  bool clear(void) { hostNvs.clear(); return true; }
+  bool remove(const char *key) { return hostNvs.erase(key) > 0; }
+  size_t getBytesLength(const char *key) {
+    auto it = hostNvs.find(key);
+    return (it == hostNvs.end()) ? 0 : it->second.size();
+  }
+  size_t getBytes(const char *key, void *buf, size_t len) {
+    auto it = hostNvs.find(key);
+    if ((it == hostNvs.end()) || (it->second.size() > len))
+      return 0;
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+  size_t putBytes(const char *key, const void *value, size_t len) {
+    if (!hostNvsFailAfter)
+      return 0;
+    if (hostNvsFailAfter > 0)
+      hostNvsFailAfter--;
+    hostNvsWrites++;
+    hostNvs[key].assign((const uint8_t *) value, (const uint8_t *) value + len);
+    return len;
+  }
+};
@@ -0,0 +1,51 @@
+// host.cpp
+//
+// Definitions of the host stand-ins and of the functions of the firmware modules
+// that are not under test (MQTT, Wi-Fi and web server).
+
+#include <time.h>
+#include "Arduino.h"
+#include "Preferences.h"
+#include "ESPAsyncWebServer.h"
+
+uint32_t hostMillis = 0;
+
+unsigned long micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long) (ts.tv_sec*1000000ull + ts.tv_nsec/1000);
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = (len < size - 1) ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return len;
+}
+
+HardwareSerial Serial;
+bool hostSerialEcho = false;
+
+int HardwareSerial::availableForWrite(void) {
+  return 128;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  if (hostSerialEcho)
+    fwrite(buf, 1, len, stdout);
+  return len;
+}
+
+std::map<std::string, std::vector<uint8_t>> hostNvs;
+int hostNvsFailAfter = -1;
+size_t hostNvsWrites = 0;
+
+AsyncEventSource events("/events");
+bool wifiConnected = false;
+
+bool mqttIsConnected(void) { return false; }
+bool mqttLog(const char *) { return false; }
+void mqttDisconnect(void) {}
@@ -0,0 +1,6 @@
+// user_config.h
+//
+// The tests use the default settings of the template when there is no
+// with_mqtt/user_config.h
+
+#include "../../with_mqtt/user_config.h.template"
@@ -0,0 +1,29 @@
+// test.h
+//
+// Minimal checks for the host tests. A test program runs its checks from main()
+// and returns testResult(), which prints the number of failures.
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond) \
+  do { testChecks++; if (!(cond)) { testFailures++; \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { testChecks++; long long _a = (long long) (a), _b = (long long) (b); if (_a != _b) { testFailures++; \
+    printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); } } while (0)
+
+#define CHECK_STR(a, b) \
+  do { testChecks++; const char *_a = (a), *_b = (b); if (strcmp(_a, _b)) { testFailures++; \
+    printf("%s:%d: CHECK_STR(%s, %s) failed: \"%s\" != \"%s\"\n", __FILE__, __LINE__, #a, #b, _a, _b); } } while (0)
+
+static inline int testResult(const char *name) {
+  printf("%s: %d checks, %d failures\n", name, testChecks, testFailures);
+  return (testFailures) ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+// test_config.cpp
+//
+// Checks that the config saved in NVS by each older version of the firmware is
+// upgraded with its settings kept, that a corrupted config is rejected, and the
+// write-behind save to the two alternating NVS slots.
+
+#include <algorithm>
+#include "test.h"
+#include "host/Preferences.h"
+#include "config_versions.h"
+#include "../with_mqtt/crc32.h"
+#include "user_config.h"
+
+template <typename T> uint32_t legacyHash(const T &c) {
+  const uint8_t *p = (const uint8_t *) &c;
+  uint32_t hash = 0;
+  for (size_t i = 0; i < offsetof(T, checksum); i++)
+    hash += p[i]*(i+1);
+  return hash;
+}
+
+template <typename T> uint32_t crc(const T &c) {
+  return crc32Update(0, &c, offsetof(T, checksum));
+}
+
+// Settings common to all the versions
+template <typename T> void fill(T &c, int version) {
+  memset(&c, 0, sizeof(c));
+  c.magic = CONFIG_MAGIC;
+  c.version = version;
+  snprintf(c.hostname, sizeof(c.hostname), "host%d", version);
+  strcpy(c.devname, "Porch light");
+  strcpy(c.wifiSsid, "ssid");
+  strcpy(c.wifiPswd, "password1");
+  c.staStaticIP = 0x0A01A8C0;
+  c.staGateway = 0x0101A8C0;
+  c.staNetmask = 0x00FFFFFF;
+  c.syslogIP = 0x0201A8C0;
+  c.syslogPort = 515;
+  strcpy(c.dmtzHost, "domoticz");
+  c.dmtzPort = 8081;
+  c.dmtzSwitchIdx = 0;    // not in Domoticz
+  c.dmtzTHSIdx = 12;
+  c.dmtzLSIdx = 13;
+  c.dmtzReqTimeout = 4000;
+  strcpy(c.mqttHost, "broker");
+  c.mqttPort = 1800 + version;
+  strcpy(c.mqttUser, "user");
+  c.mqttBufferSize = 512;
+  c.hdwPollTime = 33;
+  c.sensorUpdtTime = 60000;
+  c.logLevelUart = LOG_ERR;
+  c.logLevelSyslog = LOG_INFO;
+  c.logLevelWebc = LOG_INFO;
+  c.logLevelMqtt = LOG_ERR;
+}
+
+template <typename T> void storeKey(const T &c) {
+  hostNvs.clear();
+  hostNvs["config"].assign((const uint8_t *) &c, (const uint8_t *) &c + sizeof(c));
+}
+
+// Stores c in pages of 64 bytes under the keys prefix0, prefix1, ...
+template <typename T> void storePages(const T &c, const char *prefix) {
+  for (size_t ofs = 0; ofs < sizeof(c); ofs += 64) {
+    char key[16];
+    snprintf(key, sizeof(key), "%s%u", prefix, (unsigned) (ofs/64));
+    size_t n = std::min<size_t>(64, sizeof(c) - ofs);
+    hostNvs[key].assign((const uint8_t *) &c + ofs, (const uint8_t *) &c + ofs + n);
+  }
+}
+
+static void reload(void) {
+  memset(&config, 0, sizeof(config));
+  loadConfig();
+}
+
+// Checks the settings set by fill() after the upgrade to the current version, that
+// the upgraded config was saved in slot A and that it loads again without a write
+static void checkUpgraded(int version) {
+  char host[16];
+  snprintf(host, sizeof(host), "host%d", version);
+  CHECK_EQ(config.version, CONFIG_VERSION);
+  CHECK_STR(configString(csHostname), host);
+  CHECK_STR(configString(csDevname), "Porch light");
+  CHECK_STR(configString(csWifiPswd), "password1");
+  CHECK_STR(configString(csDmtzHost), "domoticz");
+  CHECK_STR(configString(csMqttUser), "user");
+  CHECK_STR(configString(csDmtzUser), "");
+  CHECK_EQ(config.staStaticIP, 0x0A01A8C0);
+  CHECK_EQ(config.staNetmask, 0x00FFFFFF);
+  CHECK_EQ(config.syslogPort, 515);
+  CHECK_EQ(config.dmtzSwitchIdx, 0);
+  CHECK_EQ(config.dmtzLSIdx, 13);
+  CHECK_EQ(config.dmtzReqTimeout, 4000);
+  CHECK_EQ(config.mqttPort, 1800 + version);
+  CHECK_EQ(config.mqttBufferSize, 512);
+  CHECK_EQ(config.hdwPollTime, 33);
+  CHECK_EQ(config.sensorUpdtTime, 60000);
+  CHECK_EQ(config.logLevelUart, LOG_ERR);
+  CHECK_EQ(config.logLevelSyslog, LOG_INFO);
+  CHECK_STR(configString(csTopicResult), MQTT_RESULT_TOPIC);   // added in version 9
+
+  CHECK_EQ(hostNvs.count("config"), 0);
+  CHECK_EQ(hostNvs.count("cfg0"), 0);
+  CHECK_EQ(hostNvs.count("cfgA"), 1);
+  config_t upgraded = config;
+  hostNvsWrites = 0;
+  reload();
+  CHECK(!memcmp(&upgraded, &config, sizeof(config)));
+  CHECK_EQ(hostNvsWrites, 0);
+}
+
+static void testUpgrades(void) {
+  {
+    configV1_t c;
+    fill(c, 1);
+    c.checksum = legacyHash(c);
+    storeKey(c);
+    reload();
+    checkUpgraded(1);
+    CHECK_STR(configString(csApPswd), AP_PSWD);           // added in version 2
+    CHECK_EQ(config.apDelayTime, AP_DELAY_TIME);
+    CHECK_STR(configString(csTopicLog), MQTT_LOG_TOPIC);  // added in version 3
+    CHECK_EQ(config.sendBudget, SEND_BUDGET);             // added in version 4
+    CHECK_EQ(config.logBurst[0], LOG_BURST);              // added in version 5
+  }
+  {
+    configV2_t c;
+    fill(c, 2);
+    strcpy(c.apSuffix, "setup");
+    strcpy(c.apPswd, "appassword");
+    c.apIP = 0x0104A8C0;
+    c.apDelayTime = 120000;
+    c.checksum = legacyHash(c);
+    storeKey(c);
+    reload();
+    checkUpgraded(2);
+    CHECK_STR(configString(csApSuffix), "setup");
+    CHECK_STR(configString(csApPswd), "appassword");
+    CHECK_EQ(config.apIP, 0x0104A8C0);
+    CHECK_EQ(config.apDelayTime, 120000);
+    CHECK_STR(configString(csTopicCmd), MQTT_CMD_TOPIC);
+  }
+  for (int version = 5; version <= 6; version++) {
+    configV5_t c;
+    fill(c, version);
+    strcpy(c.topicLog, "porch/log");
+    c.sendBudget = 3000;
+    c.logRepeatWindow = 2000;
+    for (int i = 0; i < TAG_COUNT; i++) {
+      c.logRate[i] = 10*i;
+      c.logBurst[i] = i + 1;
+    }
+    c.checksum = (version == 5) ? legacyHash(c) : crc(c);
+    hostNvs.clear();
+    storePages(c, "cfg");
+    reload();
+    checkUpgraded(version);
+    CHECK_STR(configString(csTopicLog), "porch/log");
+    CHECK_EQ(config.sendBudget, 3000);
+    CHECK_EQ(config.logRepeatWindow, 2000);
+    CHECK_EQ(config.logRate[2], 20);
+    CHECK_EQ(config.logBurst[TAG_COUNT - 1], TAG_COUNT);
+    CHECK_EQ(config.saveDelay, SAVE_DELAY);               // added in version 7
+  }
+  {
+    configV7_t c;
+    fill(c, 7);
+    strcpy(c.topicCmd, "porch/cmd");
+    c.saveDelay = 4000;
+    c.checksum = crc(c);
+    hostNvs.clear();
+    storePages(c, "cfgB");
+    uint32_t header[2] = {5, c.checksum};
+    hostNvs["cfgB"].assign((uint8_t *) header, (uint8_t *) header + sizeof(header));
+    reload();
+    CHECK_STR(configString(csTopicCmd), "porch/cmd");
+    CHECK_EQ(config.saveDelay, 4000);
+    // saved to slot A, the pages of the larger config of version 7 are removed from it
+    CHECK_EQ(hostNvs.count("cfgA"), 1);
+    size_t pages = 0;
+    for (const auto &key : hostNvs)
+      pages += (key.first.compare(0, 4, "cfgA") == 0) && (key.first.size() > 4);
+    CHECK_EQ(pages, (sizeof(config_t) + 63)/64);
+  }
+}
+
+static void testInvalid(void) {
+  {
+    configV2_t c;
+    fill(c, 2);
+    c.checksum = legacyHash(c) + 1;
+    storeKey(c);
+    reload();
+    CHECK_STR(configString(csHostname), HOSTNAME);
+  }
+  {
+    configV2_t c;
+    fill(c, 2);
+    c.version = CONFIG_VERSION + 1;
+    c.checksum = legacyHash(c);
+    storeKey(c);
+    reload();
+    CHECK_STR(configString(csHostname), HOSTNAME);
+  }
+  {
+    hostNvs.clear();
+    reload();
+    CHECK_EQ(config.version, CONFIG_VERSION);
+    CHECK_STR(configString(csHostname), HOSTNAME);
+    CHECK_STR(configString(csDevname), DEVICENAME);
+  }
+}
+
+static void testSave(void) {
+  const cfgField_t *poll = configFindField(cgTime, "poll");
+  CHECK(poll != NULL);
+  hostNvs.clear();
+  reload();
+  saveConfig(true);   // both slots are written once, later saves only write the changed pages
+  saveConfig(true);
+  CHECK_EQ(config.saveDelay, SAVE_DELAY);
+
+  // saved when nothing has changed for saveDelay ms
+  hostMillis = 1000;
+  hostNvsWrites = 0;
+  CHECK(configSet(*poll, "50"));
+  hostMillis += SAVE_DELAY - 1;
+  configLoop();
+  CHECK_EQ(hostNvsWrites, 0);
+  CHECK(configSet(*poll, "51"));
+  hostMillis += SAVE_DELAY - 1;
+  configLoop();
+  CHECK_EQ(hostNvsWrites, 0);
+  hostMillis += 1;
+  configLoop();
+  CHECK(hostNvsWrites > 0);
+  CHECK(hostNvsWrites <= 3);      // a changed page of a slot and its header
+  reload();
+  CHECK_EQ(config.hdwPollTime, 51);
+
+  // a save that fails is tried again after saveDelay
+  CHECK(configSet(*poll, "52"));
+  hostMillis += SAVE_DELAY;
+  hostNvsFailAfter = 0;
+  configLoop();
+  hostNvsFailAfter = -1;
+  hostNvsWrites = 0;
+  configLoop();
+  CHECK_EQ(hostNvsWrites, 0);
+  hostMillis += SAVE_DELAY;
+  configLoop();
+  CHECK(hostNvsWrites > 0);
+  reload();
+  CHECK_EQ(config.hdwPollTime, 52);
+
+  // power cut after the first page: the slot that was written is not valid, the
+  // config of the other slot is loaded
+  CHECK(configSet(*poll, "53"));
+  config.sensorUpdtTime = 1234;
+  hostNvsFailAfter = 1;
+  saveConfig(true);
+  hostNvsFailAfter = -1;
+  reload();
+  CHECK_EQ(config.hdwPollTime, 52);
+  CHECK(config.sensorUpdtTime != 1234);
+
+  // a corrupted page of the last slot
+  CHECK(configSet(*poll, "54"));
+  saveConfig();
+  reload();
+  CHECK_EQ(config.hdwPollTime, 54);
+  uint32_t seqA, seqB;
+  memcpy(&seqA, hostNvs["cfgA"].data(), sizeof(seqA));
+  memcpy(&seqB, hostNvs["cfgB"].data(), sizeof(seqB));
+  hostNvs[((int32_t) (seqA - seqB) > 0) ? "cfgA0" : "cfgB0"][10] ^= 1;
+  reload();
+  CHECK_EQ(config.hdwPollTime, 52);
+
+  // with saveDelay 0 the config is only saved by saveConfig()
+  CHECK(configSet(*configFindField(cgTime, "save"), "0"));
+  saveConfig();
+  hostNvsWrites = 0;
+  CHECK(configSet(*poll, "55"));
+  hostMillis += 100000;
+  configLoop();
+  CHECK_EQ(hostNvsWrites, 0);
+}
+
+int main() {
+  logInit();
+  testUpgrades();
+  testInvalid();
+  testSave();
+  return testResult("test_config");
+}
@@ -0,0 +1,49 @@
+// test_crc32.cpp
+//
+// Checks the slice-by-8 CRC-32 of the host build against the standard check value
+// and a bit at a time implementation, for all alignments and lengths and for CRCs
+// computed in parts.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "test.h"
+#include "../with_mqtt/crc32.h"
+
+static uint32_t crcBitwise(const uint8_t *p, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+int main() {
+  CHECK_EQ(crc32Update(0, "123456789", 9), 0xCBF43926);
+  CHECK_EQ(crc32Update(0, "", 0), 0);
+  CHECK_EQ(crc32Update(0, "a", 1), 0xE8B7BE43);
+
+  uint8_t data[300];
+  srand(1);
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = rand();
+
+  // every start alignment and every length up to 64, then a few long ones
+  for (size_t ofs = 0; ofs < 8; ofs++)
+    for (size_t len = 0; len + ofs <= sizeof(data); len += (len < 64) ? 1 : 37)
+      CHECK_EQ(crc32Update(0, data + ofs, len), crcBitwise(data + ofs, len));
+
+  // in two parts split anywhere
+  uint32_t whole = crc32Update(0, data, sizeof(data));
+  for (size_t cut = 0; cut <= sizeof(data); cut++)
+    CHECK_EQ(crc32Update(crc32Update(0, data, cut), data + cut, sizeof(data) - cut), whole);
+
+  // a single bit flip is detected
+  for (size_t bit = 0; bit < 8*64; bit++) {
+    data[bit/8] ^= 1 << (bit % 8);
+    CHECK(crc32Update(0, data, sizeof(data)) != whole);
+    data[bit/8] ^= 1 << (bit % 8);
+  }
+  return testResult("test_crc32");
+}
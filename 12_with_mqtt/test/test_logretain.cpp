@@ -0,0 +1,252 @@
+// test_logretain.cpp
+//
+// Tests of the log ring kept across warm resets (LOG_RETAIN build flag). A reset is
+// simulated by clearing the variables of logging.cpp that are initialized at boot,
+// keeping the arena and its header which are in no-init memory on the device, and
+// calling logInit() again. The records the devices get after the reset are then
+// compared with the messages added before it.
+//
+// logging.cpp is included, built with LOG_RETAIN, to reach the ring.
+
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../with_mqtt/logging.cpp"
+
+#define MARKER "---- Log retained from before the reset (reason 0) ends here ----"
+
+static void reset(void) {
+  logReserve = 0;
+  memset(cursor, 0, sizeof(cursor));
+  memset(tagStats, 0, sizeof(tagStats));
+  memset(sinkStats, 0, sizeof(sinkStats));
+  memset(filter, 0, sizeof(filter));
+  memset(logWriters, 0, sizeof(logWriters));
+  logTail = 0;
+  logTailBusy = 0;
+  logBlocked = 0;
+  renderedPos = 1;
+  uartPos = 1;
+  uartOffset = 0;
+  logInit();
+}
+
+// Messages a device gets from its cursor on, with the sequence number of the first one.
+// When the arena is full the marker overwrites the oldest retained messages, which
+// the device counts as dropped.
+static std::vector<std::string> replay(int sink, uint32_t &first) {
+  std::vector<std::string> texts;
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  char text[MSG_SIZE + 32];
+  uint32_t pos = cursor[sink].pos;
+  first = cursor[sink].seq;
+  while (logRead(pos, hdr, payload)) {
+    if (texts.empty())
+      first = hdr.seq;
+    if (hdr.seq != first + texts.size())
+      break;
+    logText(hdr, payload, text, sizeof(text));
+    texts.push_back(text);
+    pos += LOG_RECORD_SZ(hdr.len);
+  }
+  return texts;
+}
+
+static void addMessages(int from, int to) {
+  for (int i = from; i < to; i++) {
+    if (i & 1)
+      addToLogPf(LOG_INFO, TAG_SYSTEM, PSTR("deferred %d"), i);
+    else
+      addToLogf(LOG_INFO, TAG_SYSTEM, "text %d", i);
+  }
+}
+
+static std::string message(int i) {
+  char text[32];
+  snprintf(text, sizeof(text), (i & 1) ? "deferred %d" : "text %d", i);
+  return text;
+}
+
+// Checks that every device gets messages first to last, then the marker
+static void checkReplay(int first, int last) {
+  for (int sink = 0; sink < SINK_COUNT; sink++) {
+    uint32_t seq;
+    std::vector<std::string> texts = replay(sink, seq);
+    CHECK_EQ(seq, (uint32_t) first);
+    CHECK_EQ(texts.size(), (size_t) (last - first + 2));
+    if (texts.size() != (size_t) (last - first + 2))
+      continue;
+    for (int i = first; i <= last; i++) {
+      std::string expected = message(i);
+      CHECK_STR(texts[i - first].c_str(), expected.c_str());
+    }
+    CHECK_STR(texts.back().c_str(), MARKER);
+  }
+  CHECK_EQ((uint32_t) (logNext() >> 32), (uint32_t) (last + 2));
+}
+
+static void checkFresh(void) {
+  CHECK_EQ(logNext(), 0);
+  uint32_t seq;
+  for (int sink = 0; sink < SINK_COUNT; sink++)
+    CHECK_EQ(replay(sink, seq).size(), 0);
+  for (size_t i = 0; i < sizeof(logArena); i++)
+    if (logArena[i]) {
+      CHECK_EQ(logArena[i], 0);
+      break;
+    }
+}
+
+// Takes the ring back to the state of a fresh boot with messages 0 to n - 1
+static void start(int n) {
+  memset(&logRetain, 0, sizeof(logRetain));
+  reset();
+  addMessages(0, n);
+}
+
+static void testRetain(void) {
+  // first boot, nothing retained
+  memset(logArena, 0x5A, sizeof(logArena));
+  memset(&logRetain, 0, sizeof(logRetain));
+  reset();
+  checkFresh();
+
+  // empty arena
+  reset();
+  checkFresh();
+
+  // a few messages
+  start(20);
+  reset();
+  checkReplay(0, 19);
+
+  // the marker and the messages added after a reset are retained at the next one
+  addMessages(20, 30);
+  reset();
+  for (int sink = 0; sink < SINK_COUNT; sink++) {
+    uint32_t seq;
+    std::vector<std::string> texts = replay(sink, seq);
+    CHECK_EQ(texts.size(), 32);
+    if (texts.size() == 32) {
+      std::string expected = message(29);
+      CHECK_STR(texts[20].c_str(), MARKER);
+      CHECK_STR(texts[30].c_str(), expected.c_str());
+      CHECK_STR(texts[31].c_str(), MARKER);
+    }
+  }
+
+  // the arena has wrapped around, the newest messages that fit are replayed
+  start(2000);
+  reset();
+  uint32_t seq;
+  std::vector<std::string> texts = replay(SINK_UART, seq);
+  CHECK(texts.size() > 100);
+  CHECK(seq + texts.size() == 2001);
+  checkReplay(2000 + 1 - texts.size(), 1999);
+}
+
+static void testDiscarded(void) {
+  // bad magic number
+  start(20);
+  logRetain.magic ^= 1;
+  reset();
+  checkFresh();
+
+  // bad CRC
+  start(20);
+  logRetain.crc ^= 0x80000000;
+  reset();
+  checkFresh();
+
+  // other firmware
+  start(20);
+  logRetain.firmware++;
+  logRetain.crc = retainCrc(logRetain);
+  reset();
+  checkFresh();
+
+  // other arena size
+  start(20);
+  logRetain.arenaSize *= 2;
+  logRetain.crc = retainCrc(logRetain);
+  reset();
+  checkFresh();
+
+  // no complete record
+  start(20);
+  memset(logArena, 0x5A, sizeof(logArena));
+  reset();
+  checkFresh();
+}
+
+// Returns true if the record at pos is the marker
+static bool markerAt(uint32_t pos) {
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  char text[MSG_SIZE + 32];
+  if (!logRead(pos, hdr, payload))
+    return false;
+  logText(hdr, payload, text, sizeof(text));
+  return !strcmp(text, MARKER);
+}
+
+// Records that were being written at the reset: the commit word is the position of the
+// record until it is complete
+static void uncommit(uint32_t pos) {
+  memcpy(&logArena[pos & (LOG_ARENA_SZ - 1)], &pos, sizeof(pos));
+}
+
+static void testTorn(void) {
+  // newest record not committed
+  start(20);
+  uint32_t pos = logHead();
+  addMessages(20, 21);
+  uncommit(pos);
+  reset();
+  checkReplay(0, 19);
+  CHECK(markerAt(pos));
+
+  // newest record with a torn header
+  start(20);
+  pos = logHead();
+  addMessages(20, 21);
+  memset(&logArena[pos & (LOG_ARENA_SZ - 1)], 0xFF, sizeof(logHeader_t));
+  reset();
+  checkReplay(0, 19);
+  CHECK(markerAt(pos));
+
+  // a record not committed followed by complete ones added by other tasks, the
+  // devices must not wait for it. The records after it are cleared so that they are
+  // not taken for new records at the same place.
+  start(20);
+  pos = logHead();
+  addMessages(20, 23);
+  uint32_t end = logHead();
+  uncommit(pos);
+  reset();
+  checkReplay(0, 19);
+  CHECK(markerAt(pos));
+  for (uint32_t q = logHead(); (int32_t) (end - q) > 0; q += 4)
+    CHECK(commitWord(q) != ~q);
+
+  // the same after the arena has wrapped around
+  start(1000);
+  pos = logHead();
+  addMessages(1000, 1005);
+  uncommit(pos);
+  reset();
+  uint32_t seq;
+  std::vector<std::string> texts = replay(SINK_UART, seq);
+  CHECK(texts.size() > 100);
+  checkReplay(seq, 999);
+}
+
+int main() {
+  loadConfig();
+  config.logRepeatWindow = 0;
+  testRetain();
+  testDiscarded();
+  testTorn();
+  return testResult("test_logretain");
+}
@@ -0,0 +1,148 @@
+// test_logring.cpp
+//
+// Stress test of the lock-free log ring: several threads add messages, text and
+// deferred, while a reader follows the ring like a log device and sendLog() runs in
+// another thread. The reader checks that each record it gets is intact, that the
+// messages of each producer come in order and that the messages it did not get are
+// exactly the ones counted as lost by the sequence numbers or blocked by writeRecord().
+//
+// logging.cpp is included to reach the ring and its reader.
+
+#include <pthread.h>
+#include <sched.h>
+#include "test.h"
+#include "../with_mqtt/logging.cpp"
+
+#define PRODUCERS  4
+
+static int finished = 0;      // number of producers done
+static bool sending = true;
+static int messages;          // per producer
+static int pause;             // busy loop between two messages of a producer
+
+static uint32_t check(int p, int i) {
+  return (uint32_t) p*1000003u ^ (uint32_t) i*2654435761u;
+}
+
+static void *producer(void *arg) {
+  int p = (int) (intptr_t) arg;
+  Log_tag tag = (Log_tag) (TAG_SYSTEM + p % 3);   // two producers share a tag filter
+  char pattern[65];
+  memset(pattern, 'a' + p, 64);
+  pattern[64] = 0;
+  for (int i = 0; i < messages; i++) {
+    if (i & 1)
+      addToLogPf(LOG_INFO, tag, PSTR("p%d n%d x%u"), p, i, (unsigned) check(p, i));
+    else
+      addToLogf(LOG_INFO, tag, "p%d n%d %.*s", p, i, i % 65, pattern);
+    for (volatile int k = 0; k < pause; k++) ;
+    if (!(i % 1000))
+      sched_yield();
+  }
+  __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void *sender(void *) {
+  while (__atomic_load_n(&sending, __ATOMIC_RELAXED))
+    sendLog();
+  return NULL;
+}
+
+struct readerStats_t {
+  uint32_t received;
+  uint32_t lost;
+  uint32_t torn;
+  uint32_t disorder;
+};
+
+// Checks the text of a message added by producer()
+static bool intact(const char *text, int &p, int &i) {
+  int n = 0;
+  if ((sscanf(text, "p%d n%d %n", &p, &i, &n) != 2) || (p < 0) || (p >= PRODUCERS) || (i < 0) || (i >= messages))
+    return false;
+  const char *rest = text + n;
+  if (i & 1) {
+    unsigned x;
+    return (sscanf(rest, "x%u", &x) == 1) && (x == check(p, i));
+  }
+  size_t len = strlen(rest);
+  if (len != (size_t) (i % 65))
+    return false;
+  for (size_t k = 0; k < len; k++)
+    if (rest[k] != 'a' + p)
+      return false;
+  return true;
+}
+
+static void read(uint32_t &pos, uint32_t &seq, readerStats_t &stats, int *last) {
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  char text[MSG_SIZE + 32];
+  while (logRead(pos, hdr, payload)) {
+    if (hdr.seq != seq)
+      stats.lost += hdr.seq - seq;
+    seq = hdr.seq + 1;
+    pos += LOG_RECORD_SZ(hdr.len);
+    logText(hdr, payload, text, sizeof(text));
+    int p, i;
+    if (!intact(text, p, i)) {
+      if (stats.torn < 5)
+        printf("  torn record %u: \"%s\"\n", (unsigned) hdr.seq, text);
+      stats.torn++;
+      continue;
+    }
+    if (i <= last[p])
+      stats.disorder++;
+    last[p] = i;
+    stats.received++;
+  }
+}
+
+// Runs the producers, each one adding count messages with the given pause between
+// them, and follows the ring
+static void run(int count, int producerPause) {
+  uint32_t pos = logHead();
+  uint32_t seq = logNext() >> 32;
+  uint32_t blocked = logBlocked;
+  readerStats_t stats = {};
+  int last[PRODUCERS];
+  for (int p = 0; p < PRODUCERS; p++)
+    last[p] = -1;
+
+  messages = count;
+  pause = producerPause;
+  finished = 0;
+  sending = true;
+  pthread_t threads[PRODUCERS];
+  pthread_t send;
+  pthread_create(&send, NULL, sender, NULL);
+  for (int p = 0; p < PRODUCERS; p++)
+    pthread_create(&threads[p], NULL, producer, (void *) (intptr_t) p);
+  while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < PRODUCERS)
+    read(pos, seq, stats, last);
+  for (int p = 0; p < PRODUCERS; p++)
+    pthread_join(threads[p], NULL);
+  read(pos, seq, stats, last);
+  __atomic_store_n(&sending, false, __ATOMIC_RELAXED);
+  pthread_join(send, NULL);
+
+  blocked = logBlocked - blocked;
+  printf("  pause %d: %u received, %u lost, %u blocked, %u torn, %u out of order\n", producerPause,
+    (unsigned) stats.received, (unsigned) stats.lost, (unsigned) blocked, (unsigned) stats.torn, (unsigned) stats.disorder);
+  CHECK_EQ(stats.torn, 0);
+  CHECK_EQ(stats.disorder, 0);
+  CHECK_EQ(stats.received + stats.lost + blocked, PRODUCERS*count);
+  CHECK(stats.received > 0);
+  CHECK_EQ(pos, logHead());
+}
+
+int main() {
+  logInit();
+  loadConfig();
+  config.logRepeatWindow = 0;
+  while (sendLog()) ;
+  run(100000, 0);      // the reader falls behind and is resynchronized over and over
+  run(10000, 20000);   // the reader keeps up and meets records being written
+  return testResult("test_logring");
+}
@@ -0,0 +1,263 @@
+// test_rules.cpp
+//
+// Checks the compiler and the interpreter of the rules: the text of the rules, the
+// errors, the firing on edges and after a duration, the actions that update a value
+// and the validation of the code read from NVS.
+
+#include <stdlib.h>
+#include "test.h"
+#include "../with_mqtt/rules.h"
+
+static int fired[64];
+static int firedCount = 0;
+static int relay = 0;
+
+// Switches the relay like setRelay() does, which updates the relay value of the rules
+static void action(int rule, ruleAction_t act) {
+  if (firedCount < 64)
+    fired[firedCount] = rule;
+  firedCount++;
+  int value = (act == raRelayToggle) ? !relay : (act == raRelayOn);
+  if (value != relay) {
+    relay = value;
+    rulesUpdate(rvRelay, relay*10, 0);
+  }
+}
+
+static bool add(const char *text) {
+  const char *error = NULL;
+  bool ok = rulesAdd(text, &error);
+  if (!ok)
+    printf("  rule \"%s\" not added: %s\n", text, error);
+  return ok;
+}
+
+static void checkPrint(int rule, const char *expected) {
+  char buf[RULE_TEXT_SZ];
+  CHECK(rulePrint(rule, buf, sizeof(buf)));
+  CHECK_STR(buf, expected);
+}
+
+static void checkError(const char *text, const char *expected) {
+  const char *error = NULL;
+  int count = rulesCount();
+  CHECK(!rulesAdd(text, &error));
+  CHECK(error != NULL);
+  if (error)
+    CHECK_STR(error, expected);
+  CHECK_EQ(rulesCount(), count);
+}
+
+static void testCompile(void) {
+  rulesClear();
+  CHECK(add("on brightness<20 and relay==0 do relay on"));
+  CHECK(add("ON Brightness > 40 for 60 do relay 0"));
+  CHECK(add("on temp>=21.5 or humidity!=-3.5 do relay toggle"));
+  CHECK(add("on  relay = 1\tdo relay off"));
+  CHECK_EQ(rulesCount(), 4);
+  checkPrint(0, "on brightness<20 and relay==0 do relay on");
+  checkPrint(1, "on brightness>40 for 60 do relay off");
+  checkPrint(2, "on temp>=21.5 or humidity!=-3.5 do relay toggle");
+  checkPrint(3, "on relay==1 do relay off");
+  char buf[RULE_TEXT_SZ];
+  CHECK(!rulePrint(4, buf, sizeof(buf)));
+
+  const char *value = "value expected (brightness, temp, humidity or relay)";
+  const char *action = "relay on, off or toggle expected";
+  checkError("brightness<20 do relay on", "\"on\" expected");
+  checkError("on bright<20 do relay on", value);
+  checkError("on brightness 20 do relay on", "operator expected");
+  checkError("on brightness<2x do relay on", "invalid number");
+  checkError("on brightness<4000 do relay on", "invalid number");
+  checkError("on brightness<20.25 do relay 1", "invalid number");
+  checkError("on brightness<20 for 1.5 do relay on", "duration in seconds expected");
+  checkError("on brightness<20 and do relay on", value);
+  checkError("on brightness<20 do relay", action);
+  checkError("on brightness<20 do relay on now", action);
+
+  // the code of the rules is limited to RULES_CODE_SZ bytes and RULES_MAX rules
+  rulesClear();
+  const char *error;
+  int n = 0;
+  while (rulesAdd("on temp<-10.5 and humidity>90 or brightness<=5 for 3600 do relay toggle", &error))
+    n++;
+  CHECK(n > 0);
+  CHECK(n <= RULES_MAX);
+  size_t len;
+  rulesCode(len);
+  CHECK(len <= RULES_CODE_SZ);
+  rulesClear();
+  n = 0;
+  while (rulesAdd("on relay==0 do relay on", &error))
+    n++;
+  CHECK_EQ(n, RULES_MAX);
+  CHECK_STR(error, "too many rules");
+  CHECK(rulesRemove(0));
+  CHECK(!rulesRemove(RULES_MAX - 1));
+  CHECK_EQ(rulesCount(), RULES_MAX - 1);
+}
+
+// The dusk rules of lua/dusk.lua: on below 20 lux, off above 40 lux for a minute
+static void testDusk(void) {
+  rulesClear();
+  CHECK(add("on brightness<20 and relay==0 do relay on"));
+  CHECK(add("on brightness>40 for 60 do relay off"));
+  firedCount = 0;
+  relay = 0;
+  rulesUpdate(rvRelay, 0, 0);
+  rulesUpdate(rvBrightness, 300, 1000);
+  CHECK_EQ(firedCount, 0);
+  rulesUpdate(rvBrightness, 150, 2000);
+  CHECK_EQ(firedCount, 1);
+  CHECK_EQ(fired[0], 0);
+  CHECK_EQ(relay, 1);
+  rulesUpdate(rvBrightness, 100, 3000);   // only fires when the condition becomes true
+  CHECK_EQ(firedCount, 1);
+  rulesUpdate(rvBrightness, 300, 4000);   // between the two thresholds
+  CHECK_EQ(firedCount, 1);
+  rulesUpdate(rvBrightness, 500, 5000);   // above 40 for 60 s from now
+  CHECK_EQ(firedCount, 1);
+  rulesTick(64999);
+  CHECK_EQ(firedCount, 1);
+  rulesTick(65000);
+  CHECK_EQ(firedCount, 2);
+  CHECK_EQ(fired[1], 1);
+  CHECK_EQ(relay, 0);
+  rulesTick(200000);
+  rulesUpdate(rvBrightness, 500, 201000);
+  CHECK_EQ(firedCount, 2);
+
+  // the timer restarts when the condition is false in between
+  rulesUpdate(rvBrightness, 100, 202000);
+  CHECK_EQ(relay, 1);
+  rulesUpdate(rvBrightness, 500, 203000);
+  rulesUpdate(rvBrightness, 300, 230000);
+  rulesUpdate(rvBrightness, 500, 240000);
+  rulesTick(263000);
+  CHECK_EQ(relay, 1);
+  rulesTick(300000);
+  CHECK_EQ(relay, 0);
+}
+
+static void testUnknownValues(void) {
+  // a rule on a value that was never updated does not fire
+  rulesClear();
+  CHECK(add("on temp<100 do relay on"));
+  firedCount = 0;
+  rulesUpdate(rvBrightness, 10, 0);
+  rulesTick(1000);
+  CHECK_EQ(firedCount, 0);
+  rulesUpdate(rvTemp, 50, 2000);
+  CHECK_EQ(firedCount, 1);
+}
+
+static void testToggle(void) {
+  // left to right without precedence: (temp>=21.5 or humidity!=-3.5) and relay==0
+  rulesClear();
+  CHECK(add("on temp>=21.5 or humidity!=-3.5 and relay==0 do relay toggle"));
+  firedCount = 0;
+  relay = 0;
+  rulesUpdate(rvRelay, 0, 0);
+  rulesUpdate(rvHumidity, -35, 0);
+  rulesUpdate(rvTemp, 214, 0);
+  CHECK_EQ(firedCount, 0);
+  rulesUpdate(rvTemp, 215, 0);
+  CHECK_EQ(firedCount, 1);
+  CHECK_EQ(relay, 1);
+  rulesUpdate(rvTemp, 300, 0);
+  CHECK_EQ(firedCount, 1);
+}
+
+// Adding or removing a rule keeps the state of the others: a rule whose condition is
+// still true does not fire again after the relay was switched by hand
+static void testChanges(void) {
+  rulesClear();
+  CHECK(add("on humidity>900 do relay toggle"));
+  CHECK(add("on brightness<20 do relay on"));
+  firedCount = 0;
+  relay = 0;
+  rulesUpdate(rvRelay, 0, 0);
+  rulesUpdate(rvHumidity, 0, 0);
+  rulesUpdate(rvBrightness, 10, 1000);
+  CHECK_EQ(firedCount, 1);
+  CHECK_EQ(relay, 1);
+  relay = 0;                              // switched off by hand
+  rulesUpdate(rvRelay, 0, 2000);
+  CHECK(add("on temp>300 do relay off"));
+  rulesUpdate(rvBrightness, 10, 3000);
+  CHECK_EQ(firedCount, 1);
+  CHECK_EQ(relay, 0);
+  CHECK(rulesRemove(0));                  // the brightness rule becomes rule 0
+  rulesUpdate(rvBrightness, 10, 4000);
+  CHECK_EQ(firedCount, 1);
+  CHECK_EQ(relay, 0);
+
+  // an added rule starts inactive, so it fires if its condition is true
+  CHECK(add("on brightness<20 do relay toggle"));
+  rulesUpdate(rvBrightness, 10, 5000);
+  CHECK_EQ(firedCount, 2);
+  CHECK_EQ(fired[1], 2);
+  CHECK_EQ(relay, 1);
+
+  // the brightness rule fires again once its condition was false
+  rulesUpdate(rvBrightness, 500, 6000);
+  relay = 0;
+  rulesUpdate(rvRelay, 0, 7000);
+  rulesUpdate(rvBrightness, 10, 8000);
+  CHECK_EQ(firedCount, 4);
+  CHECK_EQ(fired[2], 0);
+}
+
+static void testCode(void) {
+  rulesClear();
+  CHECK(add("on brightness<20 and relay==0 do relay on"));
+  CHECK(add("on brightness>40 for 60 do relay off"));
+  CHECK(add("on temp>=21.5 or humidity!=-3.5 do relay toggle"));
+  size_t len;
+  const uint8_t *code = rulesCode(len);
+  uint8_t saved[RULES_CODE_SZ];
+  memcpy(saved, code, len);
+
+  rulesClear();
+  CHECK(rulesSetCode(saved, len));
+  CHECK_EQ(rulesCount(), 3);
+  checkPrint(1, "on brightness>40 for 60 do relay off");
+  CHECK(!rulesSetCode(saved, len - 1));
+  CHECK_EQ(rulesCount(), 0);
+  CHECK(rulesSetCode(saved, 0));
+  CHECK_EQ(rulesCount(), 0);
+
+  // corrupted code is rejected or gives rules that can be printed and run
+  srand(1);
+  uint8_t junk[RULES_CODE_SZ];
+  char buf[RULE_TEXT_SZ];
+  for (int t = 0; t < 20000; t++) {
+    size_t n = len;
+    memcpy(junk, saved, len);
+    if (t < 10000)
+      junk[rand() % len] ^= 1 << (rand() % 8);
+    else {
+      for (auto &b : junk)
+        b = rand();
+      junk[0] = 0x70;
+      n = 1 + rand() % RULES_CODE_SZ;
+    }
+    if (rulesSetCode(junk, n)) {
+      for (int i = 0; i < rulesCount(); i++)
+        CHECK(rulePrint(i, buf, sizeof(buf)));
+      rulesUpdate((ruleVar_t) (t % RULE_VAR_COUNT), t, t);
+      rulesTick(t);
+    }
+  }
+}
+
+int main() {
+  rulesSetAction(action);
+  testCompile();
+  testDusk();
+  testUnknownValues();
+  testToggle();
+  testChanges();
+  testCode();
+  return testResult("test_rules");
+}
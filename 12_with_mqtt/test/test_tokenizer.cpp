@@ -0,0 +1,74 @@
+// test_tokenizer.cpp
+//
+// Checks the splitting of command lines into commands and tokens.
+
+#include <string>
+#include "test.h"
+#include "../with_mqtt/tokenizer.h"
+
+#define MAX_TOKENS 8
+
+// Splits line as commandLoop() does and returns the tokens in brackets, the commands
+// separated by " / ", or "error" if a closing quote is missing
+static std::string split(const char *line, int max = MAX_TOKENS) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", line);
+  std::string out;
+  token_t tokens[MAX_TOKENS];
+  char *p = buf;
+  for (;;) {
+    char *end = commandEnd(p);
+    bool last = !*end;
+    *end = 0;
+    int count = tokenize(p, tokens, max);
+    if (count < 0)
+      return "error";
+    if (!out.empty())
+      out += " / ";
+    for (int i = 0; i < count; i++) {
+      CHECK_EQ(strlen(tokens[i].str), tokens[i].len);
+      out += "[" + std::string(tokens[i].str) + "]";
+    }
+    if (last)
+      return out;
+    p = end + 1;
+  }
+}
+
+static std::string join(const char *line, int first) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", line);
+  token_t tokens[MAX_TOKENS];
+  int count = tokenize(buf, tokens, MAX_TOKENS);
+  std::string out = tokenJoin(tokens, first, count);
+  CHECK_EQ(out.size(), tokens[first].len);
+  return out;
+}
+
+#define CHECK_SPLIT(args, expected) \
+  do { std::string _s = split args; CHECK_STR(_s.c_str(), expected); } while (0)
+
+#define CHECK_JOIN(args, expected) \
+  do { std::string _s = join args; CHECK_STR(_s.c_str(), expected); } while (0)
+
+int main() {
+  CHECK_SPLIT((""), "");
+  CHECK_SPLIT(("   \t "), "");
+  CHECK_SPLIT(("status"), "[status]");
+  CHECK_SPLIT(("  log   uart\tdbg  "), "[log][uart][dbg]");
+  CHECK_SPLIT(("name device \"Kitchen light\"; name"), "[name][device][Kitchen light] / [name]");
+  CHECK_SPLIT(("topic log \"\""), "[topic][log][]");
+  CHECK_SPLIT(("a;b;;c"), "[a] / [b] /  / [c]");
+  CHECK_SPLIT(("a;"), "[a] / ");
+  CHECK_SPLIT(("wifi pswd \"x;y z\"; status"), "[wifi][pswd][x;y z] / [status]");
+  CHECK_SPLIT(("say a\"b c\""), "[say][a\"b][c\"]");          // a quote inside a token is ordinary
+  CHECK_SPLIT(("\"ab\"cd"), "[ab][cd]");
+  CHECK_SPLIT(("name \"unclosed"), "error");
+  CHECK_SPLIT(("status; name \"unclosed; x"), "error");
+  CHECK_SPLIT(("a b c d e", 3), "[a][b][c]");                // tokens after max are ignored
+
+  CHECK_JOIN(("rule add on  lux<20   do relay on", 2), "on lux<20 do relay on");
+  CHECK_JOIN(("rule add \"on\" x", 2), "on x");
+  CHECK_JOIN(("a b", 1), "b");
+  return testResult("test_tokenizer");
+}
@@ -0,0 +1,174 @@
+// bench_commands.cpp
+//
+// Host benchmark of the lookup of a command name as the command table grows toward
+// the size of the Tasmota one: the binary search of findCommand() in commands.cpp,
+// with unique prefix abbreviations, against the linear scan of the former
+// commandId() which lower-cased the token and compared it with each name. The
+// tables are made of the names of this firmware, Tasmota-like names and numbered
+// variants of them. The tokens are names of the table in random case, or their
+// shortest unique prefix for the abbreviations.
+//
+// findCommand() is copied here because commands.cpp needs the whole firmware,
+// keep the two in step.
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -o bench_commands tools/bench_commands.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define CMD_EXACT 0x01
+
+struct command_t {
+  const char *name;
+  int flags;
+};
+
+static const char *names[] = {
+  // this firmware
+  "ap", "apip", "config", "dmtz", "help", "idx", "log", "mqtt", "name", "restart", "rule", "script",
+  "staip", "status", "syslog", "time", "topic", "wifi",
+  // Tasmota-like
+  "backlog", "baudrate", "blinkcount", "blinktime", "buttondebounce", "buttontopic", "channel", "color",
+  "colortemperature", "counter", "counterdebounce", "countertype", "delay", "devicename", "dimmer",
+  "dimmerrange", "event", "fade", "friendlyname", "fullTopic", "gpio", "gpios", "grouptopic", "hostname",
+  "interlock", "ipaddress", "latitude", "ledmask", "ledpower", "ledstate", "longitude", "modules",
+  "mqttclient", "mqtthost", "mqttpassword", "mqttport", "mqttretry", "mqttuser", "ntpserver", "otaurl",
+  "power", "poweronstate", "pulsetime", "reset", "rfcode", "rfsend", "ruletimer", "savedata", "scheme",
+  "sensorretain", "serialsend", "setoption", "sleep", "speed", "ssid", "state", "sunrise", "switchdebounce",
+  "switchmode", "switchtopic", "teleperiod", "template", "timer", "timers", "timezone", "upgrade",
+  "upload", "var", "webbutton", "webcolor", "weblog", "webpassword", "webserver", "wificonfig", "wakeup"
+};
+
+#define NAME_COUNT (int)(sizeof(names)/sizeof(names[0]))
+
+static std::vector<std::string> tableNames;
+static std::vector<command_t> table;
+
+// Makes a sorted table of count names, names[] followed by numbered variants
+static void makeTable(int count) {
+  tableNames.clear();
+  for (int i = 0; (int) tableNames.size() < count; i++) {
+    std::string name = names[i % NAME_COUNT];
+    if (i >= NAME_COUNT)
+      name += std::to_string(i / NAME_COUNT);
+    for (char &c : name)
+      c = tolower(c);
+    tableNames.push_back(name);
+  }
+  std::sort(tableNames.begin(), tableNames.end());
+  table.clear();
+  for (const std::string &name : tableNames)
+    table.push_back({name.c_str(), (name == "restart") ? CMD_EXACT : 0});
+}
+
+// Lookup in commands.cpp
+static int findCommand(const char *name, size_t len) {
+  int lo = 0;
+  int hi = table.size();
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    if (strcasecmp(table[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ((lo >= (int) table.size()) || (strncasecmp(table[lo].name, name, len)))
+    return -1;
+  if (!table[lo].name[len])
+    return lo;
+  if ((table[lo].flags & CMD_EXACT) || ((lo + 1 < (int) table.size()) && (!strncasecmp(table[lo+1].name, name, len))))
+    return -1;   // abbreviation not allowed or ambiguous
+  return lo;
+}
+
+// Former commandId(): the token is lower-cased in place, then compared with each name
+static int commandIdLinear(char *token) {
+  for (char *p = token; *p; p++)
+    *p = tolower(*p);
+  for (int i = 0; i < (int) table.size(); i++) {
+    if (!strcmp(token, table[i].name))
+      return i;
+  }
+  return -1;
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+#define TOKENS 4096
+#define LOOKUPS 2000000
+
+static void bench(int count) {
+  makeTable(count);
+  static char tokens[TOKENS][24];
+  static char abbrevs[TOKENS][24];
+  static char work[TOKENS][24];
+  static size_t lens[TOKENS];
+  static size_t abbrevLens[TOKENS];
+  srand(count);
+  for (int i = 0; i < TOKENS; i++) {
+    int id = rand() % table.size();
+    const char *name = table[id].name;
+    size_t n = strlen(name);
+    for (size_t k = 0; k <= n; k++)
+      tokens[i][k] = (rand() & 1) ? toupper(name[k]) : name[k];
+    lens[i] = n;
+    // shortest unique prefix
+    for (size_t k = 1; k <= n; k++) {
+      memcpy(abbrevs[i], tokens[i], k);
+      abbrevs[i][k] = 0;
+      abbrevLens[i] = k;
+      if (findCommand(abbrevs[i], k) == id)
+        break;
+    }
+  }
+
+  int found = 0;
+  double start = nowNs();
+  for (int i = 0; i < LOOKUPS; i++) {
+    int t = i % TOKENS;
+    memcpy(work[t], tokens[t], lens[t] + 1);    // the token is modified
+    found += (commandIdLinear(work[t]) >= 0);
+  }
+  double linear = (nowNs() - start)/LOOKUPS;
+  start = nowNs();
+  for (int i = 0; i < LOOKUPS; i++) {
+    int t = i % TOKENS;
+    memcpy(work[t], tokens[t], lens[t] + 1);
+    found += (findCommand(work[t], lens[t]) >= 0);
+  }
+  double binary = (nowNs() - start)/LOOKUPS;
+  start = nowNs();
+  for (int i = 0; i < LOOKUPS; i++) {
+    int t = i % TOKENS;
+    memcpy(work[t], abbrevs[t], abbrevLens[t] + 1);
+    found += (findCommand(work[t], abbrevLens[t]) >= 0);
+  }
+  double abbrev = (nowNs() - start)/LOOKUPS;
+  if (found != 3*LOOKUPS)
+    printf("lookup failed\n");
+  printf("%8d %10.1f %10.1f %10.1f\n", count, linear, binary, abbrev);
+}
+
+int main() {
+  printf("%8s %10s %10s %10s\n", "commands", "linear", "binary", "binary");
+  printf("%8s %10s %10s %10s\n", "", "ns, name", "ns, name", "ns, abbr.");
+  bench(18);
+  bench(32);
+  bench(64);
+  bench(128);
+  bench(256);
+  return 0;
+}
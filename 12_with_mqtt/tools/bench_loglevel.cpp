@@ -0,0 +1,79 @@
+// bench_loglevel.cpp
+//
+// Host benchmark of the level gating of the addToLogxxx() macros: time taken by a
+// debug message when no log device wants debug messages, with the call made
+// unconditionally as before the gating, gated at run time by logMaxLevel and
+// removed at compile time by LOG_COMPILE_LEVEL. Each variant is a function with the
+// same eight messages, their code size can be compared with
+//   nm -S -C --size-sort bench_loglevel | grep calls
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -Iwith_mqtt -Itest/host -o bench_loglevel tools/bench_loglevel.cpp with_mqtt/logging.cpp
+//     with_mqtt/config.cpp with_mqtt/logformat.cpp with_mqtt/crc32.cpp test/host/host.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <time.h>
+#include "Arduino.h"
+#include "config.h"
+#include "logging.h"
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// Eight debug messages like those of hardware.cpp and mqtt.cpp, add is the function
+// or macro that adds them
+#define DEBUG_MESSAGES(add, i) \
+  add(LOG_DEBUG, TAG_HARDWARE, PSTR("Light sensor %d"), (i) & 1023); \
+  add(LOG_DEBUG, TAG_HARDWARE, PSTR("Temperature %.1f, humidity %.1f"), (i)*0.1, (i)*0.2); \
+  add(LOG_DEBUG, TAG_HARDWARE, PSTR("Button %d pressed for %d ms"), (i) & 1, (i) & 4095); \
+  add(LOG_DEBUG, TAG_HARDWARE, PSTR("Relay %s"), ((i) & 1) ? "on" : "off"); \
+  add(LOG_DEBUG, TAG_MQTT, PSTR("Published %d bytes to %s"), (i) & 255, "domoticz/in"); \
+  add(LOG_DEBUG, TAG_MQTT, PSTR("Received %s"), "domoticz/out"); \
+  add(LOG_DEBUG, TAG_COMMAND, PSTR("exec %s"), "status"); \
+  add(LOG_DEBUG, TAG_WIFI, PSTR("RSSI %d dBm"), -((i) & 63));
+
+// Before the gating, the messages were always added
+static void __attribute__((noinline)) callsUngated(int i) {
+  DEBUG_MESSAGES(logMessagePf, i)
+}
+
+static void __attribute__((noinline)) callsRunTime(int i) {
+  DEBUG_MESSAGES(addToLogPf, i)
+}
+
+#undef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_INFO
+
+static void __attribute__((noinline)) callsCompileTime(int i) {
+  DEBUG_MESSAGES(addToLogPf, i)
+}
+
+static void bench(const char *name, void (*calls)(int)) {
+  const int loops = 200000;
+  double start = nowNs();
+  for (int i = 0; i < loops; i++)
+    calls(i);
+  double elapsed = nowNs() - start;
+  printf("%-26s %8.2f ns per message\n", name, elapsed/loops/8);
+}
+
+int main() {
+  logInit();
+  loadConfig();
+  config.logRepeatWindow = 0;
+  config.logLevelUart = LOG_INFO;
+  config.logLevelSyslog = LOG_INFO;
+  config.logLevelWebc = LOG_INFO;
+  config.logLevelMqtt = LOG_INFO;
+  logLevelsChanged();
+
+  printf("debug messages, no log device at the debug level\n");
+  bench("not gated", callsUngated);
+  bench("gated at run time", callsRunTime);
+  bench("removed at compile time", callsCompileTime);
+  return 0;
+}
@@ -0,0 +1,223 @@
+// bench_logring.cpp
+//
+// Host benchmark of the log ring: time taken to add a message and to send it to
+// the UART, and heap used, by the byte arena of logging.cpp and by a model of the
+// String Log[64] ring it replaced, in which std::string stands in for the Arduino
+// String. The Arduino core is replaced by the stand-ins of the host tests.
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -Iwith_mqtt -Itest/host -o bench_logring tools/bench_logring.cpp with_mqtt/logging.cpp
+//     with_mqtt/config.cpp with_mqtt/logformat.cpp with_mqtt/crc32.cpp test/host/host.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <new>
+#include <string>
+#include "Arduino.h"
+#include "config.h"
+#include "logging.h"
+
+// Heap use, counted by the replaced operator new and delete
+static size_t allocations = 0;
+static size_t heapUsed = 0;
+static size_t heapPeak = 0;
+
+void *operator new(size_t size) {
+  size_t *p = (size_t *) malloc(size + sizeof(max_align_t));
+  if (!p)
+    throw std::bad_alloc();
+  *p = size;
+  allocations++;
+  heapUsed += size;
+  if (heapUsed > heapPeak)
+    heapPeak = heapUsed;
+  return (char *) p + sizeof(max_align_t);
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  size_t *p = (size_t *) ((char *) ptr - sizeof(max_align_t));
+  heapUsed -= *p;
+  free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  operator delete(ptr);
+}
+
+extern const char *logLevelString[LOG_LEVEL_COUNT];
+extern const char *tagString[TAG_COUNT];
+
+// The ring before the byte arena, with the String concatenations of its sendLog()
+namespace strings {
+
+#define LOG_SIZE 64
+#define MSG_SIZE 250
+
+static std::string Log[LOG_SIZE];
+static uint8_t LogLevel[LOG_SIZE];
+static uint8_t LogTag[LOG_SIZE];
+static unsigned long LogTime[LOG_SIZE];
+static uint8_t head = 0;
+static uint8_t tail = 0;
+static uint8_t count = 0;
+
+static void mstostr(unsigned long milli, char *sbuf, int sbufsize) {
+  unsigned sec = milli / 1000;
+  unsigned min = sec / 60;
+  unsigned hr = min / 60;
+  min = min % 60;
+  sec = sec % 60;
+  unsigned frac = (milli % 1000);
+  snprintf(sbuf, sbufsize - 1, "%02u:%02u:%02u.%03u", hr % 100, min, sec, frac);
+}
+
+static void add(Log_level level, Log_tag tag, const char *message) {
+  LogTime[head] = millis();
+  LogLevel[head] = level;
+  LogTag[head] = tag;
+  Log[head] = message;
+  head = (head + 1) % LOG_SIZE;
+  count++;
+  if (count > LOG_SIZE) {
+    tail = head;
+    count = LOG_SIZE;
+  }
+}
+
+static void addf(Log_level level, Log_tag tag, const char *format, ...) {
+  va_list args;
+  char msg[MSG_SIZE];
+  va_start(args, format);
+  vsnprintf(msg, MSG_SIZE, format, args);
+  va_end(args);
+  add(level, tag, msg);
+}
+
+static int send(void) {
+  if (count < 1)
+    return 0;
+  char mxtime[15];
+  mstostr(LogTime[tail], mxtime, sizeof(mxtime));
+  std::string message = " ";
+  message += tagString[LogTag[tail]];
+  message += "/";
+  message += logLevelString[LogLevel[tail]];
+  message += ": ";
+  message += Log[tail];
+  message = std::string(mxtime) + message;
+  message += "\n";
+  Serial.write(message.c_str(), message.length());
+  tail = (tail + 1) % LOG_SIZE;
+  count--;
+  return 1;
+}
+
+#undef LOG_SIZE
+#undef MSG_SIZE
+
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+#define MESSAGES 1000000
+
+// Adds the i-th of a mix of messages of the firmware, 20 to 90 characters long
+#define ADD_MESSAGE(addf, i) \
+  switch ((i) & 3) { \
+    case 0: addf(LOG_INFO, TAG_HARDWARE, "Brightness %d, relay %d", (i) & 1023, (i) & 1); break; \
+    case 1: addf(LOG_INFO, TAG_MQTT, "Published %d bytes to domoticz/in", 60 + ((i) & 63)); break; \
+    case 2: addf(LOG_INFO, TAG_WIFI, "Wi-Fi connected to %s, IP 192.168.1.%d, RSSI %d dBm", "home-network", (i) & 255, -((i) & 63)); break; \
+    default: addf(LOG_INFO, TAG_COMMAND, "Command \"%s\" from %s, %d ms since the previous one", "status", "mqtt", (i) & 4095); break; \
+  }
+
+struct result_t {
+  double add;        // ns per message added without sending
+  double addSend;    // ns per message added then sent
+  double allocs;     // heap allocations per message added then sent
+  size_t peak;       // peak heap (bytes)
+};
+
+static void print(const char *name, const result_t &r, size_t ring) {
+  printf("%-14s %8.1f %10.1f %12.2f %10u %8u\n", name, r.add, r.addSend, r.allocs, (unsigned) r.peak, (unsigned) ring);
+}
+
+static result_t benchStrings(void) {
+  result_t r;
+  size_t base = heapUsed;
+  heapPeak = heapUsed;
+  double start = nowNs();
+  for (int i = 0; i < MESSAGES; i++)
+    ADD_MESSAGE(strings::addf, i);
+  r.add = (nowNs() - start)/MESSAGES;
+  while (strings::send()) ;
+
+  size_t before = allocations;
+  start = nowNs();
+  for (int i = 0; i < MESSAGES; i++) {
+    hostMillis++;
+    ADD_MESSAGE(strings::addf, i);
+    strings::send();
+  }
+  r.addSend = (nowNs() - start)/MESSAGES;
+  r.allocs = (double) (allocations - before)/MESSAGES;
+  r.peak = heapPeak - base;
+  return r;
+}
+
+// pointer selects addToLogPf(), deferred formatting, instead of addToLogf()
+static result_t benchArena(bool pointer) {
+  result_t r;
+  size_t base = heapUsed;
+  heapPeak = heapUsed;
+  double start = nowNs();
+  for (int i = 0; i < MESSAGES; i++) {
+    if (pointer)
+      ADD_MESSAGE(addToLogPf, i)
+    else
+      ADD_MESSAGE(addToLogf, i)
+  }
+  r.add = (nowNs() - start)/MESSAGES;
+  while (sendLog()) ;
+
+  size_t before = allocations;
+  start = nowNs();
+  for (int i = 0; i < MESSAGES; i++) {
+    hostMillis++;
+    if (pointer)
+      ADD_MESSAGE(addToLogPf, i)
+    else
+      ADD_MESSAGE(addToLogf, i)
+    sendLog();
+  }
+  r.addSend = (nowNs() - start)/MESSAGES;
+  r.allocs = (double) (allocations - before)/MESSAGES;
+  r.peak = heapPeak - base;
+  return r;
+}
+
+int main() {
+  logInit();
+  loadConfig();
+  config.logLevelUart = LOG_INFO;
+  config.logLevelSyslog = LOG_ERR;
+  config.logLevelWebc = LOG_ERR;
+  config.logLevelMqtt = LOG_ERR;
+  config.logRepeatWindow = 0;
+  logLevelsChanged();
+  while (sendLog()) ;
+
+  printf("%u messages, sent to the UART\n", MESSAGES);
+  printf("ring             add ns  add+send ns  allocs/msg  peak heap  ring RAM\n");
+  print("String[64]", benchStrings(), sizeof(strings::Log));
+  print("arena text", benchArena(false), 8192);
+  print("arena deferred", benchArena(true), 8192);
+  return 0;
+}
@@ -0,0 +1,43 @@
+// bench_rules.cpp
+//
+// Host benchmark of the rules: time taken by rulesUpdate() to evaluate the rules
+// when a sensor value changes.
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -o bench_rules tools/bench_rules.cpp with_mqtt/rules.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <time.h>
+#include "../with_mqtt/rules.h"
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *name, const char *rule, int count) {
+  const int updates = 1000000;
+  const char *error;
+  rulesClear();
+  for (int i = 0; i < count; i++)
+    rulesAdd(rule, &error);
+  rulesUpdate(rvRelay, 0, 0);
+  double start = nowNs();
+  for (int i = 0; i < updates; i++)
+    rulesUpdate(rvBrightness, i & 511, i);
+  double elapsed = nowNs() - start;
+  size_t len;
+  rulesCode(len);
+  printf("%-8s %2d rules, %3u bytes of code: %6.1f ns per update\n", name, rulesCount(), (unsigned) len, elapsed/updates);
+}
+
+int main() {
+  bench("none", "", 0);
+  bench("dusk", "on brightness<20 and relay==0 do relay on", 1);
+  bench("dusk", "on brightness<20 and relay==0 do relay on", 8);
+  bench("long", "on temp<-10.5 and humidity>90 or brightness<=5 for 3600 do relay toggle", 10);
+  bench("small", "on relay==0 do relay on", RULES_MAX);
+  return 0;
+}
@@ -0,0 +1,92 @@
+// bench_timestamp.cpp
+//
+// Host benchmark of the timestamps of the log lines: mstostr() and the
+// "hh:mm:ss.mmm TAG/lev: " prefix written by formatLine(), against the snprintf()
+// and String concatenation they replaced, in which std::string stands in for the
+// Arduino String. Lines are 10 ms apart, so that most of them share the cached
+// "hh:mm:ss." of their second, or 1.1 s apart so that none does. The clock of the
+// host is set, so the lines are stamped with the time of day.
+//
+// logging.cpp is included to reach formatLine().
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -Iwith_mqtt -Itest/host -o bench_timestamp tools/bench_timestamp.cpp with_mqtt/config.cpp
+//     with_mqtt/logformat.cpp with_mqtt/crc32.cpp test/host/host.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include "../with_mqtt/logging.cpp"
+
+// mstostr() and the line of sendLog() before the digit table
+static void mstostrPrintf(unsigned long milli, char *sbuf, int sbufsize) {
+  unsigned sec = milli / 1000;
+  unsigned min = sec / 60;
+  unsigned hr = min / 60;
+  min = min % 60;
+  sec = sec % 60;
+  unsigned frac = (milli % 1000);
+  snprintf(sbuf, sbufsize - 1, "%02u:%02u:%02u.%03u", hr % 100, min, sec, frac);
+}
+
+static size_t lineString(char *buf, size_t bufsize, const logHeader_t &hdr, const char *text) {
+  char mxtime[15];
+  mstostrPrintf(hdr.time, mxtime, sizeof(mxtime));
+  std::string message = " ";
+  message += tagString[hdr.tag];
+  message += "/";
+  message += logLevelString[hdr.level];
+  message += ": ";
+  message += text;
+  message = std::string(mxtime) + message;
+  return strlcpy(buf, message.c_str(), bufsize);
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+#define LINES 1000000
+
+static size_t sink;   // keeps the results alive
+
+static void benchMstostr(const char *name, void (*format)(unsigned long, char *, int)) {
+  char buf[20];
+  double start = nowNs();
+  for (uint32_t i = 0; i < LINES; i++) {
+    format(3723004u + i*10, buf, sizeof(buf));
+    sink += buf[10];
+  }
+  printf("%-28s %7.1f ns\n", name, (nowNs() - start)/LINES);
+}
+
+// step is the time between two lines (ms), string selects the String version
+static void benchLine(const char *name, uint32_t step, bool string) {
+  const char *text = "Published 64 bytes to domoticz/in";
+  char buf[MSG_SIZE + 24];
+  timeCache_t cache = TIME_CACHE_INIT;
+  logHeader_t hdr = {};
+  hdr.level = LOG_INFO;
+  hdr.tag = TAG_MQTT;
+  double start = nowNs();
+  for (uint32_t i = 0; i < LINES; i++) {
+    hostMillis += step;
+    hdr.time = hostMillis;
+    sink += (string) ? lineString(buf, sizeof(buf), hdr, text) : formatLine(buf, sizeof(buf), hdr, text, cache);
+  }
+  printf("%-28s %7.1f ns\n", name, (nowNs() - start)/LINES);
+}
+
+int main() {
+  printf("per timestamp or line, %u of them\n", LINES);
+  benchMstostr("mstostr snprintf", mstostrPrintf);
+  benchMstostr("mstostr digit table", mstostr);
+  benchLine("line String, 10 ms", 10, true);
+  benchLine("line formatLine, 10 ms", 10, false);
+  benchLine("line String, 1.1 s", 1100, true);
+  benchLine("line formatLine, 1.1 s", 1100, false);
+  return sink == 0;
+}
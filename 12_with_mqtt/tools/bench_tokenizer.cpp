@@ -0,0 +1,159 @@
+// bench_tokenizer.cpp
+//
+// Host benchmark of the splitting of command lines: commandEnd() and tokenize()
+// on a copy of the line, as doCommand() does, against the substring() splitting of
+// the former doCommand() and parseString() into String token[], in which std::string
+// stands in for the Arduino String (parseString() debug messages left out). Heap
+// allocations are counted by the replaced operator new.
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -Iwith_mqtt -o bench_tokenizer tools/bench_tokenizer.cpp with_mqtt/tokenizer.cpp
+// or run make bench in the test directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <string>
+#include "../with_mqtt/tokenizer.h"
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  allocations++;
+  return p;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+#define COMMAND_SZ 256
+#define TOKENCOUNT 16
+
+static size_t sink;   // keeps the results alive
+
+// Splitting before the tokenizer
+namespace strings {
+
+#define OLD_TOKENCOUNT 7
+
+static std::string token[OLD_TOKENCOUNT];
+
+static void trim(std::string &s) {
+  size_t first = s.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) {
+    s.clear();
+    return;
+  }
+  s.erase(s.find_last_not_of(" \t\r\n") + 1);
+  s.erase(0, first);
+}
+
+static int parseString(std::string s) {
+  int ndx0 = 0;
+  int ndx1 = 0;
+  int n = 0;
+  std::string tok;
+  trim(s);
+  int lc = s.length() - 1;
+  while (ndx0 <= lc) {
+    ndx1 = s.find(' ', ndx0);
+    if (ndx1 < 0) {
+      tok = s.substr(ndx0);
+      ndx0 = s.length();
+    } else {
+      tok = s.substr(ndx0, ndx1 - ndx0);
+      ndx0 = ndx1 + 1;
+    }
+    trim(tok);
+    if ((tok.length() > 0) && (n < OLD_TOKENCOUNT)) {
+      token[n] = tok;
+      n++;
+    }
+  }
+  return n;
+}
+
+static void doCommand(std::string cmnd) {
+  int ndx0 = 0;
+  int ndx1 = 0;
+  int lc = cmnd.length() - 1;
+  while ((ndx0 <= lc) && (cmnd[ndx0] == ' ' || cmnd[ndx0] == ';'))
+    ndx0++;
+  std::string command;
+  while (ndx0 <= lc) {
+    ndx1 = cmnd.find(';', ndx0);
+    if (ndx1 < 0) {
+      command = cmnd.substr(ndx0);
+      ndx0 = cmnd.length();
+    } else {
+      command = cmnd.substr(ndx0, ndx1 - ndx0);
+      ndx0 = ndx1 + 1;
+    }
+    trim(command);
+    if (command.length() > 0)
+      sink += parseString(command);
+  }
+}
+
+}
+
+// Splitting with the tokenizer, the line is copied as it is when queued
+static void doCommand(const char *cmnd) {
+  char line[COMMAND_SZ];
+  token_t tokens[TOKENCOUNT];
+  memcpy(line, cmnd, strlen(cmnd) + 1);
+  char *p = line;
+  bool last = false;
+  while (!last) {
+    char *end = commandEnd(p);
+    last = !*end;
+    *end = 0;
+    sink += tokenize(p, tokens, TOKENCOUNT);
+    p = end + 1;
+  }
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *line) {
+  const int loops = 1000000;
+  std::string copy(line);
+  size_t before = allocations;
+  double start = nowNs();
+  for (int i = 0; i < loops; i++)
+    strings::doCommand(copy);
+  double old = (nowNs() - start)/loops;
+  double oldAllocs = (double) (allocations - before)/loops;
+  before = allocations;
+  start = nowNs();
+  for (int i = 0; i < loops; i++)
+    doCommand(line);
+  double now = (nowNs() - start)/loops;
+  double allocs = (double) (allocations - before)/loops;
+  printf("%-48s %6.1f %6.1f %8.1f %8.1f\n", line, old, now, oldAllocs, allocs);
+}
+
+int main() {
+  printf("%-48s %6s %6s %8s %8s\n", "line", "String", "spans", "allocs", "allocs");
+  printf("%-48s %6s %6s %8s %8s\n", "", "ns", "ns", "String", "spans");
+  bench("status");
+  bench("log uart dbg");
+  bench("mqtt 192.168.1.22 1883 -c mqttuser secretpswd");
+  bench("relay on; log uart dbg; status");
+  bench("name device \"Kitchen light\"");
+  return sink == 0;
+}
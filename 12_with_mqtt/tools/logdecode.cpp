@@ -0,0 +1,327 @@
+// logdecode.cpp
+//
+// Host program that converts the binary log export of the Wi-Fi switch
+// (GET /log.bin) back into the text of the log history (GET /log.txt).
+// The format is described in with_mqtt/logging.h.
+//
+// Build (from the 12_with_mqtt directory)
+//   g++ -O2 -o logdecode tools/logdecode.cpp with_mqtt/logformat.cpp
+//
+// Use
+//   curl -s http://<device>/log.bin > dump.bin
+//   ./logdecode dump.bin
+// or
+//   curl -s http://<device>/log.bin | ./logdecode
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../with_mqtt/logformat.h"
+
+#define LOG_BIN_VERSION  1
+#define LOG_BIN_DEF      1
+#define LOG_BIN_TEXT     2
+#define LOG_BIN_STRING   3
+#define LOG_BIN_FORMAT   4
+
+// Sizes of the C types on the device which wrote the stream
+struct sizes_t {
+  uint8_t intSz;
+  uint8_t longSz;
+  uint8_t longLongSz;
+  uint8_t sizeSz;
+  uint8_t doubleSz;
+  uint8_t pointerSz;
+};
+
+struct reader_t {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+  bool ok;
+};
+
+static uint8_t getByte(reader_t &r) {
+  if (r.pos >= r.size) {
+    r.ok = false;
+    return 0;
+  }
+  return r.data[r.pos++];
+}
+
+static uint32_t getVarint(reader_t &r) {
+  uint32_t value = 0;
+  for (int shift = 0; r.ok && shift < 35; shift += 7) {
+    uint8_t b = getByte(r);
+    value |= (uint32_t) (b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return value;
+  }
+  r.ok = false;
+  return value;
+}
+
+static std::string getString(reader_t &r) {
+  std::string s;
+  while (r.ok) {
+    uint8_t c = getByte(r);
+    if (!c)
+      break;
+    s += (char) c;
+  }
+  return s;
+}
+
+// Reads an integer of n bytes (little-endian) from args
+static uint64_t getInt(const uint8_t *args, size_t argslen, size_t &used, size_t n, bool &ok) {
+  uint64_t value = 0;
+  if ((n > 8) || (used + n > argslen)) {
+    ok = false;
+    return 0;
+  }
+  for (size_t i = 0; i < n; i++)
+    value |= (uint64_t) args[used + i] << (8*i);
+  used += n;
+  return value;
+}
+
+static int64_t signExtend(uint64_t value, size_t n) {
+  if (n >= 8)
+    return (int64_t) value;
+  uint64_t sign = (uint64_t) 1 << (8*n - 1);
+  return (int64_t) ((value ^ sign) - sign);
+}
+
+template <typename T>
+static int renderOne(char *out, size_t size, const char *spec, int stars, const int *star, T value) {
+  switch (stars) {
+    case 0:  return snprintf(out, size, spec, value);
+    case 1:  return snprintf(out, size, spec, star[0], value);
+    default: return snprintf(out, size, spec, star[0], star[1], value);
+  }
+}
+
+// Same as logRenderArgs() in logformat.cpp, except that the arguments were packed
+// with the sizes of the device types
+static std::string render(const char *format, const uint8_t *args, size_t argslen, const sizes_t &sz) {
+  std::string out;
+  char spec[32];
+  char buf[512];
+  size_t used = 0;
+  bool ok = true;
+  logSpec_t s;
+  for (const char *p = format; *p && ok; p++) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    }
+    logParseSpec(p, s);
+    if (s.type == atNone) {
+      out += '%';
+      p++;
+      continue;
+    }
+    if ((s.type == atInvalid) || (s.len >= sizeof(spec) - 2))
+      break;
+    // copy the specification without its length modifier
+    size_t n = s.len - 1;
+    while ((n > 1) && (strchr("hlz", p[n-1])))
+      n--;
+    memcpy(spec, p, n);
+    spec[n] = 0;
+    p += s.len - 1;
+
+    int star[2] = {0, 0};
+    for (int i = 0; i < s.stars; i++)
+      star[i] = (int) signExtend(getInt(args, argslen, used, sz.intSz, ok), sz.intSz);
+    if (!ok)
+      break;
+
+    int len = 0;
+    bool isSigned = (s.conversion == 'd') || (s.conversion == 'i');
+    switch (s.type) {
+      case atInt:
+      case atLong:
+      case atLongLong:
+      case atSize: {
+        size_t isz = (s.type == atInt) ? sz.intSz : (s.type == atLong) ? sz.longSz
+          : (s.type == atLongLong) ? sz.longLongSz : sz.sizeSz;
+        uint64_t v = getInt(args, argslen, used, isz, ok);
+        if (!ok)
+          break;
+        if (s.conversion == 'c') {
+          strcat(spec, "c");
+          len = renderOne(buf, sizeof(buf), spec, s.stars, star, (int) v);
+        } else {
+          strcat(spec, "ll");
+          strncat(spec, &s.conversion, 1);
+          if (isSigned)
+            len = renderOne(buf, sizeof(buf), spec, s.stars, star, (long long) signExtend(v, isz));
+          else
+            len = renderOne(buf, sizeof(buf), spec, s.stars, star, (unsigned long long) v);
+        }
+        break;
+      }
+      case atDouble: {
+        double d = 0;
+        if ((sz.doubleSz != sizeof(double)) || (used + sizeof(double) > argslen)) {
+          ok = false;
+          break;
+        }
+        memcpy(&d, args + used, sizeof(double));
+        used += sizeof(double);
+        strncat(spec, &s.conversion, 1);
+        len = renderOne(buf, sizeof(buf), spec, s.stars, star, d);
+        break;
+      }
+      case atPointer: {
+        uint64_t v = getInt(args, argslen, used, sz.pointerSz, ok);
+        if (!ok)
+          break;
+        strcat(spec, "p");
+        len = renderOne(buf, sizeof(buf), spec, s.stars, star, (void *) (uintptr_t) v);
+        break;
+      }
+      case atString: {
+        const char *str = (const char *) args + used;
+        size_t slen = strnlen(str, argslen - used);
+        if (used + slen >= argslen) {
+          ok = false;
+          break;
+        }
+        used += slen + 1;
+        strcat(spec, "s");
+        len = renderOne(buf, sizeof(buf), spec, s.stars, star, str);
+        break;
+      }
+      default:
+        break;
+    }
+    if (len > 0)
+      out.append(buf, ((size_t) len < sizeof(buf)) ? len : sizeof(buf) - 1);
+  }
+  return out;
+}
+
+// Same as mstostr() in logging.cpp
+static std::string timeString(uint32_t milli) {
+  char buf[32];
+  unsigned sec = milli / 1000;
+  unsigned min = sec / 60;
+  snprintf(buf, sizeof(buf), "%02u:%02u:%02u.%03u", min / 60, min % 60, sec % 60, milli % 1000);
+  return buf;
+}
+
+static bool decode(const std::vector<uint8_t> &data, FILE *out) {
+  reader_t r = {data.data(), data.size(), 0, true};
+  if ((data.size() < 5) || memcmp(data.data(), "LOGB", 4)) {
+    fprintf(stderr, "Not a binary log export\n");
+    return false;
+  }
+  r.pos = 4;
+  uint8_t version = getByte(r);
+  if (version != LOG_BIN_VERSION) {
+    fprintf(stderr, "Unsupported version %d\n", version);
+    return false;
+  }
+  sizes_t sz;
+  sz.intSz = getByte(r);
+  sz.longSz = getByte(r);
+  sz.longLongSz = getByte(r);
+  sz.sizeSz = getByte(r);
+  sz.doubleSz = getByte(r);
+  sz.pointerSz = getByte(r);
+  std::vector<std::string> tags;
+  for (int i = getByte(r); r.ok && i > 0; i--)
+    tags.push_back(getString(r));
+  std::vector<std::string> levels;
+  for (int i = getByte(r); r.ok && i > 0; i--)
+    levels.push_back(getString(r));
+
+  std::vector<std::string> strings;
+  uint32_t time = 0;
+  while (r.ok && r.pos < r.size) {
+    uint8_t type = getByte(r);
+    if (type == LOG_BIN_DEF) {
+      uint32_t id = getVarint(r);
+      std::string s = getString(r);
+      if (id >= strings.size())
+        strings.resize(id + 1);
+      strings[id] = s;
+      continue;
+    }
+    uint8_t tl = getByte(r);
+    uint32_t zz = getVarint(r);
+    time += (zz >> 1) ^ (0 - (zz & 1));
+    std::string text;
+    switch (type) {
+      case LOG_BIN_TEXT: {
+        uint32_t len = getVarint(r);
+        if (r.pos + len > r.size)
+          r.ok = false;
+        else {
+          text.assign((const char *) r.data + r.pos, len);
+          r.pos += len;
+        }
+        break;
+      }
+      case LOG_BIN_STRING: {
+        uint32_t id = getVarint(r);
+        if (id < strings.size())
+          text = strings[id];
+        break;
+      }
+      case LOG_BIN_FORMAT: {
+        uint32_t id = getVarint(r);
+        uint32_t len = getVarint(r);
+        if (r.pos + len > r.size)
+          r.ok = false;
+        else if (id < strings.size()) {
+          text = render(strings[id].c_str(), r.data + r.pos, len, sz);
+          r.pos += len;
+        }
+        break;
+      }
+      default:
+        r.ok = false;
+        break;
+    }
+    if (!r.ok)
+      break;
+    unsigned tag = tl & 0x3F;
+    unsigned level = tl >> 6;
+    fprintf(out, "%s %s/%s: %s\n", timeString(time).c_str(),
+      (tag < tags.size()) ? tags[tag].c_str() : "???",
+      (level < levels.size()) ? levels[level].c_str() : "???", text.c_str());
+  }
+  if (!r.ok) {
+    fprintf(stderr, "Truncated or corrupted stream at byte %zu\n", r.pos);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  FILE *in = stdin;
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [<file>]\n", argv[0]);
+    return 2;
+  }
+  if ((argc == 2) && (strcmp(argv[1], "-"))) {
+    in = fopen(argv[1], "rb");
+    if (!in) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  if (in != stdin)
+    fclose(in);
+  return (decode(data, stdout)) ? 0 : 1;
+}
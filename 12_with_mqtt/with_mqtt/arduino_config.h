@@ -2,6 +2,8 @@
 
 #if (!PLATFORMIO)
    #define NO_TESTS          // Undef all TEST_xxxx macros
+//   #define LOG_COMPILE_LEVEL LOG_INFO   // remove LOG_DEBUG messages from the firmware
+//   #define LOG_RETAIN                   // keep the log across warm resets
 // overrides for hdw_mock/hardware.cpp I/O pin assignments   
 //   #define RELAY_PIN  11      // RGB_RED_PIN
 //   #define BUTTON_PIN 37
@@ -4,196 +4,497 @@
 #include "config.h"
 #include "wifiutils.hpp"
 #include "mqtt.hpp"
+#include "domoticz.h"
 #include "commands.hpp"
+#include "tokenizer.h"
+#include "rules.h"
+#include "configjson.h"
 
-// BUG - it is possible that strlcpy could truncate !!!
-//   see: https://en.wikibooks.org/wiki/C_Programming/C_Reference/nonstandard/strlcpy#Criticism
-
-enum cmndError_t {etNone, etMissingParam, etUnknownCommand, etUnknownParam, etExtraParam, etInvalidValue};
+enum cmndError_t {etNone, etMissingParam, etUnknownCommand, etUnknownParam, etExtraParam, etInvalidValue, etMissingQuote};
 
 static const char *cmdsrc[] = {
 /* FROM_UART */  "uart",
 /* FROW_WEBC */  "webc",
-/* FROM_MQTT */  "mqtt"
+/* FROM_MQTT */  "mqtt",
+/* FROM_SCRIPT */ "script"
 };
 
-static const char* cmds[] = {
-  "ap",             // - manage access point
-  "apip",           // - access point IP
-  "config",         // - manage configuration
-  "dmtz",           // - domoticz host, port, user, pswd
-  "help",           // - help
-  "idx",            // - domoticz idx values
-  "log",            // - log level for serial, mqtt and web output
-  "mqtt",           // - mqtt host, port, user, pswd
-  "name",           // - hostname
-  "restart",        // - restart the device
-  "staip",          // - static station IP
-  "status",         // - system status
-  "syslog",         // - syslog url, port
-  "time",           // - configure time intervals
-  "topic",          // - mqtt topics
-  "wifi"            // - returns wifi status
-};
+typedef cmndError_t (*dofnct)(const int, int&);
 
+cmndError_t doConfig(int count, int &errIndex);
+cmndError_t doHelp(int count, int &errIndex);
+cmndError_t doLog(int count, int &errIndex);
+cmndError_t doRestart(int count, int &errIndex);
+cmndError_t doRule(int count, int &errIndex);
+cmndError_t doScript(int count, int &errIndex);
+cmndError_t doStatus(int count, int &errIndex);
+
+#define CMD_EXACT   0x01      // the command cannot be abbreviated
+#define CMD_LINE    0x02      // the command takes the rest of the line, unsplit, in token[1]
+#define CMD_NORETURN 0x04     // the command does not return, it cannot be in a boot script
+
+struct command_t {
+  const char *name;             // lower case
+  dofnct handler;               // NULL for the commands that manage a group of settings
+  const char *params;           // NULL for the commands that manage a group of settings
+  uint8_t flags;                // CMD_xxx
+};
 
-#define COMMAND_COUNT (int)(sizeof (cmds) / sizeof (const char *))
-
-static const char *params[COMMAND_COUNT] = {
-  /* ap      */ "[-d|-x] | [<suffix> [<pswd>]]",
-  /* apip    */ "[-d|-x] | [<ip> <mask>]",
-  /* config  */ "[load|default|save [force]]",
-  /* dmtz    */ "[-d] | [<host> [<port>]] ( [-x] | [-c <user> [<pswd>]] )",
-  /* help    */ "[<command>]",
-  /* idx     */ "[-d] | [(switch|temp|lux) [<id>]]",
-  /* log     */ "[-d] | [(uart|mqtt|syslog|webc) [ERR|inf|dbg|<level>]]",
-  /* mqtt    */ "[-d] | [[<host> [<port>]] ( [-x] | [-c <user> <pswd>]] )",
-  /* name    */ "[-d] | [-h [<hostname>]] | [-n [<device name>]]",
-  /* restart */ "[[0|1|...|7]",
-  /* staip   */ "[-d|-x] | [<ip> <gateway> <mask>]",
-  /* status  */  "",
-  /* syslog  */ "[-d] | [<hostIP> [<port>]]",
-  /* time    */ "[-d] | [(poll|update|http|ap) [<ms>]]",
-  /* topic   */ "[-d] | [(log|cmd|pub|sub) [<topic>]]",
-  /* wifi    */ "[-d] | [<ssid> [<pswd]]"
+// The commands in alphabetical order. The commands that manage a group of settings
+// (see config.h) are handled by doGroup(), their parameters are generated from the
+// config schema. A command can be abbreviated to any prefix that is not the prefix
+// of another command.
+constexpr command_t commands[] = {
+  {"ap",      NULL,      NULL, 0},          // manage access point
+  {"apip",    NULL,      NULL, 0},          // access point IP
+  {"config",  doConfig,  "[load|default|save [force]]", 0},
+  {"dmtz",    NULL,      NULL, 0},          // domoticz host, port, user, pswd
+  {"help",    doHelp,    "[<command>]", 0},
+  {"idx",     NULL,      NULL, 0},          // domoticz idx values
+  {"log",     doLog,     "[-d] | [(uart|syslog|webc|mqtt) [ERR|inf|dbg|<level>]] | [repeat [<ms>]] | [rate [<tag> [<per min> [<burst>]]]] | [stats [-r]]", 0},
+  {"mqtt",    NULL,      NULL, 0},          // mqtt host, port, user, pswd
+  {"name",    NULL,      NULL, 0},          // hostname and device name
+  {"restart", doRestart, "[[0|1|...|7]", CMD_EXACT | CMD_NORETURN},
+  {"rule",    doRule,    "[add on <condition> [for <s>] do relay (on|off|toggle)] | [del <n>] | [clear]", 0},
+  {"script",  doScript,  "[<n> [run | del | boot <commands> | every <n>[s|m|h|d] <commands>]]", CMD_LINE},
+  {"staip",   NULL,      NULL, 0},          // static station IP
+  {"status",  doStatus,  "", 0},
+  {"syslog",  NULL,      NULL, 0},          // syslog url, port
+  {"time",    NULL,      NULL, 0},          // time intervals
+  {"topic",   NULL,      NULL, 0},          // mqtt topics
+  {"wifi",    NULL,      NULL, 0}           // wifi ssid and password
 };
 
-#define TOKENCOUNT 7             // one more than the maximum number of tokens used
-String token[TOKENCOUNT];
+#define COMMAND_COUNT (int)(sizeof (commands) / sizeof (command_t))
 
-// Break up the string s into tokens
-int parseString(String s) {
-  addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("parse \"%s\""), s.c_str());
-  int ndx0 = 0;
-  int ndx1 = 0;
-  int n = 0;
-  int lc = s.length() - 1;
-  String tok;
-
-  // skip leading spaces;
-  s.trim();
-  while (ndx0 <= lc) {
-    ndx1 = s.indexOf(' ', ndx0);
-    if (ndx1 < 0) {
-      tok = s.substring(ndx0);
-      ndx0 = s.length();
-    } else {
-      tok = s.substring(ndx0, ndx1);
-      ndx0 = ndx1+1;
-    }
-    tok.trim();
-    if ((tok.length() > 0) && (n < TOKENCOUNT)) {
-      token[n] = tok;
-      addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("token %d = \"%s\""), n, token[n].c_str());
-      n++;
-    }
-  }
-  return n;
+// Compile time check that the names are in lower case and in alphabetical order,
+// which the binary search in commandId() depends on
+
+constexpr bool isLowerCase(const char *s) {
+  return (!*s) || (((*s < 'A') || (*s > 'Z')) && isLowerCase(s + 1));
 }
 
+constexpr int cstrcmp(const char *a, const char *b) {
+  return ((*a != *b) || (!*a)) ? (unsigned char) *a - (unsigned char) *b : cstrcmp(a + 1, b + 1);
+}
 
-// Returns the command index of token[0] or -1 if not a command
-int commandId(int idx = 0) {
-  token[idx].toLowerCase();
-  for (int i = 0; i<COMMAND_COUNT; i++) {
-    if (token[idx].equals(cmds[i])) {
-       return i;
-    }
+constexpr bool commandsSorted(int i = 0) {
+  return (i >= COMMAND_COUNT) || ((isLowerCase(commands[i].name))
+    && ((i == 0) || (cstrcmp(commands[i-1].name, commands[i].name) < 0)) && commandsSorted(i + 1));
+}
+
+static_assert(commandsSorted(), "commands[] is not in alphabetical order");
+
+#define TOKENCOUNT 16            // one more than the maximum number of tokens used
+static token_t token[TOKENCOUNT];
+
+// Returns the index in commands[] of the command named or abbreviated by name, of len
+// characters, -1 if there is none. The first name not before it is found with a binary
+// search, name names that command if it is equal to the command name or is a prefix of
+// it and not of the next name.
+static int findCommand(const char *name, size_t len) {
+  int lo = 0;
+  int hi = COMMAND_COUNT;
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    if (strcasecmp(commands[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-  return -1;
+  if ((lo >= COMMAND_COUNT) || (strncasecmp(commands[lo].name, name, len)))
+    return -1;
+  if (!commands[lo].name[len])
+    return lo;
+  if ((commands[lo].flags & CMD_EXACT) || ((lo + 1 < COMMAND_COUNT) && (!strncasecmp(commands[lo+1].name, name, len))))
+    return -1;   // abbreviation not allowed or ambiguous
+  return lo;
 }
 
-//================ doCommand ================
+// Returns the index in commands[] of the command named or abbreviated by token[idx]
+int commandId(int idx = 0) {
+  return findCommand(token[idx].str, token[idx].len);
+}
 
+//================ command results ================
 
+// The result of a line of commands is built in result[] while its commands are executed
+// and then sent back to the source of the line (see sendResult()). It is a JSON object
+// with an element of results per command:
 //
-//   1      2     3         2       3       4     +1  +2    +3        <<< count
-//   0      1     2         1       2       3     +1  +2    +3        <<< errIndex
-//  ap   [-d|-x] xtra1 | [<suffix> [pswd]]  extra
+//   {"id":"12","source":"mqtt","results":[
+//     {"cmd":"name","out":{"host":"kitchenlight","device":"Kitchen Light"},"status":"ok"},
+//     {"cmd":"idx","status":"invalid value","error":2,"token":"x"}]}
 //
-cmndError_t doAp(int count, int &errIndex) {
-  errIndex = 1;
-  if (count > 1) {
-    errIndex = 2;
-    if ( (token[1].equals("-d")) || (token[1].equals("-D")) )
-      defaultAp();
-    else if  ( (token[1].equals("-x")) || (token[1].equals("-X")) ) {
-      config.apSuffix[0] = '\0';
-      config.apPswd[0] = '\0';
-    } else {
-      strlcpy(config.apSuffix, token[1].c_str(), AP_SUFFIX_SZ);
-      if (count > 2) {
-        errIndex = 3;
-        strlcpy(config.apPswd, token[2].c_str(), PSWD_SZ);
-      } else
-        config.apPswd[0] = '\0';
+// The handlers add the key/value output with resultAdd(). A key/value or a command that
+// does not fit is left out and "truncated":true is added, so the result is always valid
+// JSON.
+
+#define RESULT_RESERVE  24      // room kept at the end of result[] to close it
+
+static char result[COMMAND_RESULT_SZ];
+static size_t resultLen = 0;
+static size_t resultStart = 0;          // start of the result of the command, with its comma
+static bool resultCmd = false;          // a command is open, resultAdd() adds to it
+static bool resultOut = false;          // the "out" object of the command is open
+static bool resultTruncated = false;    // a key/value or a command was left out
+static int resultCount = 0;             // commands in results
+
+static const char *statusString[] = {
+/* etNone */           "ok",
+/* etMissingParam */   "missing parameter",
+/* etUnknownCommand */ "unknown command",
+/* etUnknownParam */   "unknown parameter",
+/* etExtraParam */     "extra parameter",
+/* etInvalidValue */   "invalid value",
+/* etMissingQuote */   "missing closing quote"
+};
+
+// Appends s to result[], returns false, without appending anything, if it does not fit
+static bool resultPut(const char *s, size_t limit = COMMAND_RESULT_SZ - RESULT_RESERVE) {
+  size_t len = strlen(s);
+  if (resultLen + len >= limit)
+    return false;
+  memcpy(result + resultLen, s, len + 1);
+  resultLen += len;
+  return true;
+}
+
+// Appends s as a JSON string, returns false, possibly after appending a part of it,
+// if it does not fit
+static bool resultString(const char *s) {
+  char esc[8];
+  if (!resultPut("\""))
+    return false;
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if ((c == '"') || (c == '\\'))
+      snprintf(esc, sizeof(esc), "\\%c", c);
+    else if (c < 0x20)
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+    else {
+      esc[0] = c;
+      esc[1] = 0;
     }
+    if (!resultPut(esc))
+      return false;
   }
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("AP suffix: %s, password: %s"),
-    config.apSuffix,
-    (strlen(config.apPswd)) ? "********" : "<none>");
-  if (count > errIndex)
-    return etExtraParam;
-  return etNone;
+  return resultPut("\"");
+}
+
+static void resultBegin(cmndSource_t source, const char *id) {
+  resultLen = 0;
+  resultTruncated = false;
+  resultCount = 0;
+  resultPut("{\"id\":");
+  resultString(id);
+  resultPut(",\"source\":\"");
+  resultPut(cmdsrc[source]);
+  resultPut("\",\"results\":[");
+}
+
+// Opens the result of a command named name
+static void resultCommand(const char *name) {
+  resultStart = resultLen;
+  resultOut = false;
+  resultCmd = (resultPut((resultCount) ? ",{\"cmd\":" : "{\"cmd\":")) && (resultString(name));
+  if (!resultCmd) {
+    resultLen = resultStart;
+    result[resultLen] = 0;
+    resultTruncated = true;
+  }
+}
+
+// Adds a key/value to the output of the command, the value is a JSON string if quote
+// is true and a JSON number otherwise
+static void resultAdd(const char *key, const char *value, bool quote = true) {
+  if (!resultCmd)
+    return;
+  size_t mark = resultLen;
+  if ((resultPut((resultOut) ? "," : ",\"out\":{")) && (resultString(key)) && (resultPut(":"))
+      && ((quote) ? resultString(value) : resultPut(value)))
+    resultOut = true;
+  else {
+    resultLen = mark;
+    result[resultLen] = 0;
+    resultTruncated = true;
+  }
+}
+
+static void resultAdd(const char *key, uint32_t value) {
+  char buf[12];
+  snprintf(buf, sizeof(buf), "%u", (unsigned) value);
+  resultAdd(key, buf, false);
+}
+
+// Closes the result of the command with its status, errIndex is the index of the token
+// in error. A missing parameter or closing quote, or a negative errIndex, has no token.
+static void resultEnd(cmndError_t error, int errIndex) {
+  if (!resultCmd)
+    return;
+  char buf[12];
+  bool fits = ((!resultOut) || (resultPut("}"))) && (resultPut(",\"status\":\""))
+    && (resultPut(statusString[error])) && (resultPut("\""));
+  if ((fits) && (error != etNone) && (error != etMissingQuote) && (errIndex >= 0)) {
+    snprintf(buf, sizeof(buf), "%d", errIndex);
+    fits = (resultPut(",\"error\":")) && (resultPut(buf));
+  }
+  if ((fits) && (error != etNone) && (error != etMissingQuote) && (error != etMissingParam) && (errIndex >= 0))
+    fits = (resultPut(",\"token\":")) && (resultString(token[errIndex].str));
+  if ((fits) && (resultPut("}")))
+    resultCount++;
+  else {
+    // leave the command out with its output
+    resultLen = resultStart;
+    result[resultLen] = 0;
+    resultTruncated = true;
+  }
+  resultCmd = false;
+}
+
+static void resultClose(void) {
+  resultPut((resultTruncated) ? "],\"truncated\":true}" : "]}", COMMAND_RESULT_SZ);
 }
 
+//================ configuration groups ================
 
-//  1       2        3       2     3      4       <<< count
-//  0       1        2       1     2      3       <<< errIndex
-// apip [-d | -x ] xtra1 | [<ip> <mask>] xtra2
+// Commands that manage a group of settings all have the same syntax
 //
-cmndError_t doApip(int count, int &errIndex) {
-  cmndError_t errCode = etNone;
-  errIndex = 0;
-  if (count > 1) {
-    if (token[1].equals("-d")) {
-      defaultApip();
-      if (count > 2  ) {
-        errIndex = 2;
-        errCode = etExtraParam;
-      }
+//   1     2      3      2       3         <<< count
+//   0     1      2      1       2         <<< errIndex
+// group [-d|-x] xtra | [<value> [<value> ...]] xtra     positional group
+// group [-d|-x] xtra | [<name> [<value>]] xtra          named group
+//
+// -d sets the default values, -x clears the values that can be cleared. With -c the next
+// value is the first credential (user name) of the group. A CF_REST value is made of all
+// the remaining tokens.
+
+static bool canClear(cfgGroup_t group) {
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if ((configFields[i].group == group) && (configFields[i].flags & CF_CLEAR))
+      return true;
+  }
+  return false;
+}
 
-    } else if (token[1].equals("-x")) {
-      config.staStaticIP = 0;
-      config.staNetmask = 0;
-      config.staGateway = 0;
-      if (count > 2  ) {
-        errIndex = 2;
-        errCode = etExtraParam;
-      }
+// Returns the index of the first field of group at or after index i that is set by
+// the group command, or CONFIG_FIELD_COUNT
+static int nextField(cfgGroup_t group, int i) {
+  while ((i < CONFIG_FIELD_COUNT) && ((configFields[i].group != group) || (configFields[i].flags & CF_NOCMD)))
+    i++;
+  return i;
+}
 
-    } else if (count < 3) {
-      errCode = etMissingParam;
+static size_t append(char *buf, size_t size, size_t n, const char *s) {
+  if (n < size)
+    n += strlcpy(buf + n, s, size - n);
+  return (n < size) ? n : size - 1;
+}
+
+// Writes the parameters of the command of group into buf
+static void groupHelp(cfgGroup_t group, char *buf, size_t size) {
+  size_t n = append(buf, size, 0, (canClear(group)) ? "[-d|-x] | [" : "[-d] | [");
+  const char *options = configGroups[group].options;
+  if (options) {
+    // [-h [<host>]] | [-n [<device>]]
+    n = append(buf, size, 0, "[-d]");
+    for (int i = nextField(group, 0); (i < CONFIG_FIELD_COUNT) && (*options); i = nextField(group, i+1)) {
+      char opt[] = {'-', *options++, 0};
+      n = append(buf, size, n, " | [");
+      n = append(buf, size, n, opt);
+      n = append(buf, size, n, " [<");
+      n = append(buf, size, n, configFields[i].name);
+      n = append(buf, size, n, ">]]");
+    }
+    return;
+  }
+  if (configGroups[group].flags & GF_NAMED) {
+    n = append(buf, size, n, "(");
+    for (int i = nextField(group, 0); i < CONFIG_FIELD_COUNT; i = nextField(group, i+1)) {
+      if (buf[n-1] != '(')
+        n = append(buf, size, n, "|");
+      n = append(buf, size, n, configFields[i].name);
+    }
+    n = append(buf, size, n, ") [<value>]]");
+    return;
+  }
+  int open = 0;     // optional values opened with '['
+  for (int i = nextField(group, 0); i < CONFIG_FIELD_COUNT; i = nextField(group, i+1)) {
+    if (configFields[i].flags & CF_CRED) {
+      for (; open >= 0; open--)
+        n = append(buf, size, n, "]");
+      n = append(buf, size, n, " [-c ");
+      open = 0;
+    } else if (buf[n-1] != '[')
+      n = append(buf, size, n, (configGroups[group].flags & GF_ALL) ? " " : (open++, " ["));
+    n = append(buf, size, n, "<");
+    n = append(buf, size, n, configFields[i].name);
+    n = append(buf, size, n, ">");
+  }
+  for (; open >= 0; open--)
+    n = append(buf, size, n, "]");
+}
 
+// Logs the values of the fields of group, or only the value of field if not NULL, and
+// adds them to the result
+static void showGroup(cfgGroup_t group, const cfgField_t *field) {
+  char msg[256];
+  char value[HOST_SZ];
+  size_t n = append(msg, sizeof(msg), 0, configGroups[group].name);
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const cfgField_t &f = configFields[i];
+    if ((f.group != group) || (f.count > 1) || ((field) && (field != &f)))
+      continue;
+    n = append(msg, sizeof(msg), n, (n > strlen(configGroups[group].name)) ? ", " : " ");
+    n = append(msg, sizeof(msg), n, f.name);
+    n = append(msg, sizeof(msg), n, ": ");
+    configGet(f, value, sizeof(value));
+    if (f.flags & CF_SECRET) {
+      n = append(msg, sizeof(msg), n, (value[0]) ? "********" : "<none>");
+      resultAdd(f.name, (value[0]) ? "********" : "");
+    } else if (f.type == ctString) {
+      n = append(msg, sizeof(msg), n, "\"");
+      n = append(msg, sizeof(msg), n, value);
+      n = append(msg, sizeof(msg), n, "\"");
+      resultAdd(f.name, value);
     } else {
-      IPAddress ipa;
-      IPAddress mask;
-      if (!ipa.fromString(token[1]))
-        errIndex = 1;
-      else if (!mask.fromString(token[2]))
-        errIndex = 2;
-      if (errIndex)
-        errCode = etInvalidValue;
-      else {
-        // only update values if all two iP are valid
-        config.apIP = ipa;
-        config.apMask = mask;
-        if (count > 3) {
-          errCode = etExtraParam;
-          errIndex = 3;
-        }
+      n = append(msg, sizeof(msg), n, value);
+      resultAdd(f.name, value, (f.type == ctIP) || (f.type == ctLevel));
+    }
+  }
+  addToLog(LOG_INFO, TAG_COMMAND, msg);
+}
+
+// Returns the field of group set with the option opt (-h), NULL if there is none
+static const cfgField_t *findOption(cfgGroup_t group, const char *opt) {
+  const char *options = configGroups[group].options;
+  if ((!options) || (opt[0] != '-') || (!opt[1]) || (opt[2]))
+    return NULL;
+  for (int i = nextField(group, 0); (i < CONFIG_FIELD_COUNT) && (*options); i = nextField(group, i+1), options++) {
+    if (*options == opt[1])
+      return &configFields[i];
+  }
+  return NULL;
+}
+
+static cmndError_t setNamed(cfgGroup_t group, int count, int &errIndex, bool &changed, const cfgField_t *&field) {
+  field = findOption(group, token[1].str);
+  if (!field)
+    field = configFindField(group, token[1].str);
+  if ((!field) || (field->flags & CF_NOCMD)) {
+    field = NULL;
+    errIndex = 1;
+    return etUnknownParam;
+  }
+  if (count > 2) {
+    if (field->flags & CF_REST) {
+      tokenJoin(token, 2, count);
+      errIndex = count;
+    }
+    if (!configSet(*field, token[2].str)) {
+      errIndex = 2;
+      return etInvalidValue;
+    }
+    if (!(field->flags & CF_REST))
+      errIndex = 3;
+    changed = true;
+  }
+  return etNone;
+}
+
+static cmndError_t setPositional(cfgGroup_t group, int count, int &errIndex, bool &changed) {
+  const cfgGroupInfo_t &info = configGroups[group];
+  int fields[TOKENCOUNT];           // index of the field set by each token, -1 for -c
+  uint32_t values[TOKENCOUNT];      // values of GF_ALL groups
+  int next = 0;
+  int ti;
+  for (ti = 1; ti < count; ti++) {
+    if (!strcmp(token[ti].str, "-c")) {
+      while ((next < CONFIG_FIELD_COUNT) && ((configFields[next].group != group) || (!(configFields[next].flags & CF_CRED))))
+        next++;
+      if (next >= CONFIG_FIELD_COUNT) {
+        errIndex = ti;
+        return etUnknownParam;
       }
+      fields[ti] = -1;
+      continue;
+    }
+    next = nextField(group, next);
+    if (next >= CONFIG_FIELD_COUNT)
+      break;   // extra parameter
+    fields[ti] = next;
+    if (!configParse(configFields[next], token[ti].str, &values[ti-1])) {
+      errIndex = ti;
+      return etInvalidValue;
+    }
+    next++;
+  }
+  errIndex = ti;
+  if (info.flags & GF_ALL) {
+    if (nextField(group, next) < CONFIG_FIELD_COUNT)
+      return etMissingParam;
+    if ((info.check) && (!info.check(values))) {
+      errIndex = ti - 1;
+      return etInvalidValue;
     }
   }
-  // show current station static ip configuration
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Static access point IP %s, and netmask %s"),
-    (config.apIP) ? IPAddress(config.apIP).toString().c_str() : "192.168.4.1",
-    (config.apMask) ? IPAddress(config.apMask).toString().c_str() : "255.255.255.0");
-  return errCode;
+  // all the values are valid, check that the strings fit in the pool and set them
+  int delta = 0;
+  for (int i = 1; i < ti; i++) {
+    if (fields[i] >= 0)
+      delta += configPoolDelta(configFields[fields[i]], token[i].str);
+  }
+  if (info.flags & GF_RESET) {
+    for (int k = nextField(group, next); k < CONFIG_FIELD_COUNT; k = nextField(group, k+1))
+      delta += configPoolDelta(configFields[k], "");
+  }
+  if (!configPoolFits(delta)) {
+    errIndex = 1;
+    return etInvalidValue;
+  }
+  for (int i = 1; i < ti; i++) {
+    if (fields[i] >= 0)
+      configSet(configFields[fields[i]], token[i].str);
+  }
+  if (info.flags & GF_RESET) {
+    for (next = nextField(group, next); next < CONFIG_FIELD_COUNT; next = nextField(group, next+1))
+      configClear(configFields[next]);
+  }
+  changed = true;
+  return etNone;
 }
 
+cmndError_t doGroup(cfgGroup_t group, int count, int &errIndex) {
+  const cfgField_t *field = NULL;
+  cmndError_t error = etNone;
+  bool changed = false;
+  errIndex = 1;
+  if (count > 1) {
+    errIndex = 2;
+    if (!strcasecmp(token[1].str, "-d")) {
+      configDefault(group);
+      changed = true;
+    } else if ((!strcasecmp(token[1].str, "-x")) && (canClear(group))) {
+      for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if ((configFields[i].group == group) && (configFields[i].flags & CF_CLEAR))
+          configClear(configFields[i]);
+      }
+      changed = true;
+    } else if (configGroups[group].flags & GF_NAMED)
+      error = setNamed(group, count, errIndex, changed, field);
+    else
+      error = setPositional(group, count, errIndex, changed);
+  }
+  showGroup(group, field);
+  if ((changed) && (configGroups[group].changed))
+    configGroups[group].changed();
+  if ((error == etNone) && (count > errIndex))
+    error = etExtraParam;
+  return error;
+}
 
 
+//
 //  [ ] change syntax to config [-d] | [-r] | [-w | -f] | [-a (off | on)]
 //  but  wait until restart is better defined.
 ///  1        2    3       2      3       2     2      3     4          2        3       4     <<< count
@@ -206,16 +507,14 @@ cmndError_t doConfig(int count, int &errIndex) {
     errIndex = 1;
   else {
     errIndex = 2; // assume xtra1, extr2 or invalid param (off | on)
-    token[1].toLowerCase();
-    if (token[1].equals("load"))
+    if (!strcasecmp(token[1].str, "load"))
       loadConfig();
-    else if (token[1].equals("default"))
+    else if (!strcasecmp(token[1].str, "default"))
       useDefaultConfig();
-    else if (token[1].equals("save")) {
+    else if (!strcasecmp(token[1].str, "save")) {
       if (count > 2) {
         errIndex = 3;
-        token[2].toLowerCase();
-        if (!token[2].equals("force"))
+        if (strcasecmp(token[2].str, "force"))
           return etUnknownParam;
         force = true;
       }
@@ -225,7 +524,9 @@ cmndError_t doConfig(int count, int &errIndex) {
       return etUnknownCommand;
     }
   } // count > 1
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Config version: %d, size: %d"), config.version, sizeof(config_t));
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Config version: %d, size: %u"), config.version, (unsigned) sizeof(config_t));
+  resultAdd("version", config.version);
+  resultAdd("size", sizeof(config_t));
 
   if (count > errIndex)
     return etExtraParam;
@@ -233,86 +534,6 @@ cmndError_t doConfig(int count, int &errIndex) {
 }
 
 
-//                                                    c_index  +1     +2       +3
-//  1    2   3          2       3      4      n+1  n+2    n+1 n+2    n+3      n+4  <<< max count = 6
-//  0    1   2          1       2      3       n   n+1     n  n+1    n+2      n+3  <<< errIndex
-// dmtz [-d] xtr1 | [ [<host> [<port>] xtr2]  [-x] xtr3 | [-c <user> [<pswd>]] xtr4 ]
-//
-void showDmtz(void) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s:%d, user: %s passwd: %s"), config.dmtzHost, config.dmtzPort,
-    (strlen(config.dmtzUser)) ? config.dmtzUser : "<not defined>",
-    (strlen(config.dmtzPswd)) ? "********" : "<not defined>");
-}
-
-cmndError_t doDmtz(int count, int &errIndex) {
-  //bool restartAP = false;
-  int c_index = 0;
-  errIndex = 0;
-
-  if ((count > 1) && token[1].equals("-d")) {
-    defaultDmtz();
-    showDmtz();
-    if (count > 2) {
-      errIndex = 2;
-      return etExtraParam;
-    }
-    return etNone;
-  }
-
-  if (count > 1) {
-    for (int ti=1; ti<count; ti++) {
-      if (token[ti].equals("-c")) {
-        c_index = ti;
-        continue;
-      }
-      if (token[ti].equals("-x")) {
-        config.dmtzUser[0] = '\0';
-        config.dmtzPswd[0] = '\0';
-        showDmtz();
-        if (count > ti+1)  {
-          errIndex = ti+1;
-        } else if (ti > 3) {
-          errIndex = 3;
-        }
-        if (errIndex)
-          return etExtraParam;
-        return etNone;
-      }
-      if (ti==1+c_index) {
-        if (c_index == 0) {
-          strlcpy(config.dmtzHost, token[ti].c_str(), HOST_SZ);
-        } else {
-          strlcpy(config.dmtzUser, token[ti].c_str(), USER_SZ);
-        }
-      } else if (ti==2+c_index) {
-        if (c_index == 0) {
-          config.dmtzPort = token[ti].toInt();
-        } else {
-          if (strlen(token[ti].c_str()) < 8) {
-            addToLogP(LOG_ERR, TAG_COMMAND, PSTR("WiFi password must be at least 8 characters long"));
-            showDmtz();
-            errIndex = ti;
-            return etInvalidValue;
-          }
-          strlcpy(config.dmtzPswd, token[ti].c_str(), PSWD_SZ);
-        }
-      }
-    }
-  }
-
-  showDmtz();
-
-  if ((c_index > 3) || ((c_index == 0) && (count > 4)))
-    errIndex = 4;
-  else if ((c_index > 0) && (count > c_index + 3))
-    errIndex = c_index + 3;
-
-  if (errIndex)
-    return etExtraParam;
-
-  return etNone;
-}
-
 //      1       2   <<< counter
 //      0       1   <<< index
 //  "help   [<command>]"
@@ -327,13 +548,21 @@ cmndError_t doHelp(int count, int &errIndex) {
     strncpy(msg, "commands:", HELP_SZ);
     for (int i=0; i < COMMAND_COUNT; i++) {
       if (strlen(msg) < HELP_SZ) strncat(msg, &space, 1);
-      strncat(msg, cmds[i], HELP_SZ-strlen(msg));
+      strncat(msg, commands[i].name, HELP_SZ-strlen(msg));
     }
     addToLog(LOG_INFO, TAG_COMMAND, msg);
+    resultAdd("commands", msg + strlen("commands: "));
   } else {
     cid = commandId(1);
     if (cid < 0) return etUnknownParam;
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s %s"), cmds[cid], params[cid]);
+    if (commands[cid].params) {
+      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s %s"), commands[cid].name, commands[cid].params);
+      resultAdd(commands[cid].name, commands[cid].params);
+    } else {
+      groupHelp(configFindGroup(commands[cid].name), msg, sizeof(msg));
+      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s %s"), commands[cid].name, msg);
+      resultAdd(commands[cid].name, msg);
+    }
   }
 
   if (count > 2) {
@@ -344,170 +573,65 @@ cmndError_t doHelp(int count, int &errIndex) {
 }
 
 
-void showIdx(void) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Domoticz virtual Idx: switch = %d, light sensor = %d, temp + humid sensor = %d"),
-    config.dmtzSwitchIdx, config.dmtzLSIdx, config.dmtzTHSIdx);
-}
+extern const char *logLevelString[];
+extern const char *tagString[];
 
-//   1   2                  2            3       4  <<< count
-//   0   1                  1            2       3  <<< index
-// idx [-d] xtra1 | [(switch|temp|lux) [<id>]] xtra2
+//   1     2     3         4           5       6 <<< count
+//   0     1     2         3           4       5 <<< errIndex
+//  "log rate [<tag> [<per min> [<burst>]]] extr"
 //
-cmndError_t doIdx(int count, int &errIndex) {
-
-  if (count == 1) {
-    showIdx();
-    return etNone;
-  }
-
-  if ((count > 1) and token[1].equals("-d")) {
-    defaultIdx();
-    showIdx();
-    if (count > 2) {
-      errIndex = 2;
-      return etExtraParam;
-    }
+cmndError_t doLogRate(int count, int &errIndex) {
+  if (count < 3) {
+    logFilterStatus();
     return etNone;
   }
-
-  long anIdx = -1;
-  bool setvalue = (count > 2);
-
-  if (setvalue) {
-    anIdx = token[2].toInt();
-    if (anIdx <= 0) {
-      errIndex = 2;
-      return etInvalidValue;
+  int tag = -1;
+  for (int i = 0; i < TAG_COUNT; i++) {
+    if (!strcasecmp(token[2].str, tagString[i])) {
+      tag = i;
+      break;
     }
   }
-
-  token[1].toLowerCase();
-
-  if (token[1].equals("switch")) {
-    if (setvalue) config.dmtzSwitchIdx = anIdx;
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("switch idx: %d"), config.dmtzSwitchIdx);
-
-  } else if (token[1].equals("lux")) {
-    if (setvalue) config.dmtzLSIdx = anIdx;
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("light sensor idx: %d"), config.dmtzLSIdx);
-
-  } else if (token[1].equals("temp")) {
-    if (setvalue) config.dmtzTHSIdx = anIdx;
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("temp sensor idx: %d"), config.dmtzTHSIdx);
-
-  } else {
-    errIndex = 1;
+  if (tag < 0) {
+    errIndex = 2;
     return etUnknownParam;
   }
-
-  if (count > 3) {
+  const cfgField_t *rate = configFindField(cgLog, "rate");
+  const cfgField_t *burst = configFindField(cgLog, "burst");
+  if ((count > 3) && (!configParse(*rate, token[3].str))) {
     errIndex = 3;
+    return etInvalidValue;
+  }
+  if ((count > 4) && (!configParse(*burst, token[4].str))) {
+    errIndex = 4;
+    return etInvalidValue;
+  }
+  if (count > 3)
+    configSet(*rate, token[3].str, tag);
+  if (count > 4)
+    configSet(*burst, token[4].str, tag);
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log %s rate: %u messages per minute, burst of %u"), tagString[tag],
+    (unsigned) config.logRate[tag], (unsigned) config.logBurst[tag]);
+  resultAdd("tag", tagString[tag]);
+  resultAdd("rate", config.logRate[tag]);
+  resultAdd("burst", config.logBurst[tag]);
+  if (count > 5) {
+    errIndex = 5;
     return etExtraParam;
   }
   return etNone;
 }
 
-extern const char *logLevelString[];
-
-//    1           2                   3      4 <<< count
-//    0           1                   2      3 <<< errIndex
-//  "log (uart|mqtt|syslog|webc) [<level>] extr"
+//   1     2     3    4 <<< count
+//   0     1     2    3 <<< errIndex
+//  "log stats [-r] extr"
 //
-#define LOG_FACILITY_COUNT 4
-const char *logFacility[LOG_FACILITY_COUNT] = {
-  "uart",
-  "mqtt",
-  "syslog",
-  "webc"
-};
-
-cmndError_t doLog(int count, int &errIndex) {
-  if (count < 2) {
-    String st("Log levels ");
-    for (int i=0; i<LOG_FACILITY_COUNT; i++) {
-      st += logFacility[i];
-      st += ": ";
-      int level = -1;
-      switch (i) {
-        case 0: level = config.logLevelUart; break;
-        case 1: level = config.logLevelMqtt; break;
-        case 2: level = config.logLevelSyslog; break;
-        case 3: level = config.logLevelWebc; break;
-      }
-      if ((level < 0) || (level >= LOG_LEVEL_COUNT))
-        st += "unknown";
-      else
-        st += logLevelString[level];
-      if (i < LOG_FACILITY_COUNT-1)
-        st += ", ";
-    }
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log levels %s"), st.c_str());
-    return etNone;
-  }
-  int facility = - 1;
-  int level = -1;
-  token[1].toLowerCase();
-  facility = -1;
-  for (int i=0; i < LOG_FACILITY_COUNT; i++) {
-    if (token[1].equals(logFacility[i])) {
-      facility = i;
-      break;
-    }
-  }
-  if (facility < 0) {
-    errIndex = 1;
+cmndError_t doLogStats(int count, int &errIndex) {
+  if ((count > 2) && (strcmp(token[2].str, "-r"))) {
+    errIndex = 2;
     return etUnknownParam;
   }
-  errIndex = 2;
-  bool setvalue = (count > 2);
-  if (setvalue) {
-    // [ ] BUG: logLevelString[] are mixed case!
-    //token[2].toLowerCase();
-    for (int i = 0; i<LOG_LEVEL_COUNT; i++) {
-      if (token[2].equals(logLevelString[i])) {
-        level = i;
-        break;
-      }
-    }
-    // not a string, assume it is a number
-    if ((level < 0) && (token[2].length()==1)) {
-      level = (byte)token[2][0] - '0';
-    }
-    if ( (level < 0) || (level >= LOG_LEVEL_COUNT) ) {
-      return etInvalidValue;
-    }
-  }
-  switch (facility) {
-    case 0: {
-      if (setvalue)
-        config.logLevelUart = level;
-      else
-        level = config.logLevelUart;
-      break;
-    }
-    case 1: {
-      if (setvalue)
-        config.logLevelMqtt = level;
-      else
-        level = config.logLevelMqtt;
-      break;
-    }
-    case 2: {
-      if (setvalue)
-        config.logLevelSyslog = level;
-      else
-        level = config.logLevelSyslog;
-      break;
-    }
-    case 3: {
-      if (setvalue)
-        config.logLevelWebc = level;
-      else
-        level = config.logLevelWebc;
-      break;
-    }
-  }
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s log level: %s (%d)"), logFacility[facility], logLevelString[level], level);
+  logStatistics(count > 2);
   if (count > 3) {
     errIndex = 3;
     return etExtraParam;
@@ -515,154 +639,20 @@ cmndError_t doLog(int count, int &errIndex) {
   return etNone;
 }
 
-
-void showMqtt(void) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s:%d, user: %s passwd: %s"), config.mqttHost, config.mqttPort,
-    (strlen(config.mqttUser)) ? config.mqttUser : "<not defined>",
-    (strlen(config.mqttPswd)) ? "********" : "<not defined>");
-}
-
-//                                                    c_index  +1     +2       +3
-//  1    2   3          2       3      4      n+1  n+2    n+1 n+2    n+3      n+4  <<< max count = 6
-//  0    1   2          1       2      3       n   n+1     n  n+1    n+2      n+3  <<< errIndex
-// mqtt [-d] xtr1 | [ [<host> [<port>] xtr2]  [-x] xtr3 | [-c <user> [<pswd>]] xtr4 ]
+//   1     2                                   3                       4 <<< count
+//   0     1                                   2                       3 <<< errIndex
+//  log [-d] | [(uart|syslog|webc|mqtt|repeat) [<level>|<ms>]] | [rate ...] | [stats ...] extr
 //
-cmndError_t doMqtt(int count, int &errIndex) {
-  //bool restartAP = false;
-  int c_index = 0;
-  errIndex = 0;
-
-  if ((count > 1) && token[1].equals("-d")) {
-    defaultMqtt();
-    showMqtt();
-    if (count > 2) {
-      errIndex = 2;
-      return etExtraParam;
-    }
-    return etNone;
-  }
-
+cmndError_t doLog(int count, int &errIndex) {
   if (count > 1) {
-    for (int ti=1; ti<count; ti++) {
-      if (token[ti].equals("-c")) {
-        c_index = ti;
-        continue;
-      }
-      if (token[ti].equals("-x")) {
-        config.mqttUser[0] = '\0';
-        config.mqttPswd[0] = '\0';
-        showDmtz();
-        if (count > ti+1)  {
-          errIndex = ti+1;
-        } else if (ti > 3) {
-          errIndex = 3;
-        }
-        if (errIndex)
-          return etExtraParam;
-        return etNone;
-      }
-      if (ti==1+c_index) {
-        if (c_index == 0) {
-          strlcpy(config.mqttHost, token[ti].c_str(), HOST_SZ);
-        } else {
-          strlcpy(config.mqttUser, token[ti].c_str(), USER_SZ);
-        }
-      } else if (ti==2+c_index) {
-        if (c_index == 0) {
-          config.dmtzPort = token[ti].toInt();
-        } else {
-          /*
-          if (strlen(token[ti].c_str()) < 8) {
-            addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Password must be at least 8 characters long"));
-            showDmtz();
-            errIndex = ti;
-            return etInvalidValue;
-          } */
-          strlcpy(config.mqttPswd, token[ti].c_str(), PSWD_SZ);
-        }
-      }
-    }
+    if (!strcasecmp(token[1].str, "rate"))
+      return doLogRate(count, errIndex);
+    if (!strcasecmp(token[1].str, "stats"))
+      return doLogStats(count, errIndex);
   }
-
-  showMqtt();
-
-  if ((c_index > 3) || ((c_index == 0) && (count > 4)))
-    errIndex = 4;
-  else if ((c_index > 0) && (count > c_index + 3))
-    errIndex = c_index + 3;
-
-  if (errIndex)
-    return etExtraParam;
-
-  return etNone;
+  return doGroup(cgLog, count, errIndex);
 }
 
-
-
-bool isValidHostnameChar(char c) {
-  //Serial.printf("isValidHostChar(\"%c\")\n", c);
-  if (c == '-') return true;
-  if (c < '0')  return false;
-  if (c <= '9') return true;
-  if (c < 'A')  return false;
-  if (c <= 'Z') return true;
-  if (c < 'a')  return false;
-  if (c <= 'z') return true;
-  return false;
-}
-
-//   1     2    3       2    3         2    3      4  <<< count
-//   0     1    2       1    2         1    2      3 <<< errIndex
-// name  [-d] xtra1 | [-h [name>]] | [-n [name]] xtra2
-//
-cmndError_t doName(int count, int &errIndex) {
-  bool disconnect = false;
-  errIndex = 2; // assume presence of xtra1
-  if (count < 2)
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Host name: %s, device name: %s"), config.hostname, config.devname);
-  else {
-    if (token[1].equals("-d"))
-      defaultNames();
-    else if (token[1].equals("-h")) {
-      if (count > 2) {
-        // test for valid host name
-        int len = token[2].length();
-        for (int i=0; i < len; i++) {
-          if (!isValidHostnameChar(token[2].charAt(i))) {
-            return etInvalidValue;
-          }
-        }
-        if ( token[2].startsWith("-") || token[2].endsWith("-") )
-          return etInvalidValue;
-        // valid, continue
-        errIndex = 3; // assume presence of xtra2
-        disconnect = true;
-        strlcpy(config.hostname, token[2].c_str(), HOSTNAME_SZ);
-      }
-      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Host name: %s"), config.hostname);
-      if (disconnect)
-        addToLogP(LOG_INFO, TAG_COMMAND, PSTR("The change will take effect on the next connection to the network"));
-    } else if (token[1].equals("-n")) {
-       if (count > 2) {
-         errIndex = 3;
-         while (errIndex < count) {
-            token[2] += " " + token[errIndex];
-            errIndex++;
-         }
-         strlcpy(config.devname, token[2].c_str(), HOST_SZ);
-       }
-       addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Device name: %s"), config.devname);
-    } else {
-      errIndex = 1;
-      return etUnknownParam;
-    }
-  }
-  if (count > errIndex)
-    return etExtraParam;
-  return etNone;
-}
-
-
 extern void espRestart(int level = 0);
 
 //     1    2     3   <<< count
@@ -672,8 +662,8 @@ extern void espRestart(int level = 0);
 cmndError_t doRestart(int count, int &errIndex) {
   int n = 0;
   if (count > 1) {
-    n = (byte)token[1][0] - '0';
-    if ( (token[1].length()>1)  || (n < 0) ) {
+    n = (byte)token[1].str[0] - '0';
+    if ( (token[1].len>1)  || (n < 0) ) {
       errIndex = 1;
       return etInvalidValue;
     }
@@ -687,74 +677,57 @@ cmndError_t doRestart(int count, int &errIndex) {
 }
 
 
-//    1       2        3       2     3      4          5 <<< count
-//    0       1        2       1     2      3          4 <<< errIndex
-// statip [-d | -x ] xtra1 | [<ip> <gateway> <mask>] xtra2
+//     1    2     3     <<< count
+//     0    1     2     <<< errIndex
+// rule [add <rule...>] | [del <n> xtra3] | [clear xtra2]
 //
-cmndError_t doStaip(int count, int &errIndex) {
-  cmndError_t errCode = etNone;
-  errIndex = 0;
+cmndError_t doRule(int count, int &errIndex) {
+  char text[RULE_TEXT_SZ];
+  errIndex = 1;
   if (count > 1) {
-    if (token[1].equals("-d")) {
-      defaultStaticStaIp();
-      if (count > 2  ) {
-        errIndex = 2;
-        errCode = etExtraParam;
-      }
-
-    } else if (token[1].equals("-x")) {
-      config.staStaticIP = 0;
-      config.staNetmask = 0;
-      config.staGateway = 0;
-      if (count > 2  ) {
-        errIndex = 2;
-        errCode = etExtraParam;
+    errIndex = 2;
+    if (!strcasecmp(token[1].str, "add")) {
+      if (count < 3)
+        return etMissingParam;
+      const char *error;
+      if (!rulesAdd(tokenJoin(token, 2, count), &error)) {
+        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("Rule not added: %s"), error);
+        resultAdd("reason", error);
+        return etInvalidValue;
       }
-
-    } else if (count < 4) {
-      errCode = etMissingParam;
-
-    } else {
-      IPAddress ipa;
-      IPAddress gateway;
-      IPAddress mask;
-      if (!ipa.fromString(token[1])) {
-        errIndex = 1;
-      } else if (!gateway.fromString(token[2])) {
-        errIndex = 2;
-      } else if (!mask.fromString(token[3])) {
+    } else if (!strcasecmp(token[1].str, "del")) {
+      if (count < 3)
+        return etMissingParam;
+      if (count > 3) {
         errIndex = 3;
+        return etExtraParam;
       }
-      if ((ipa & mask) != (gateway & mask)) {
-        addToLogP(LOG_ERR, TAG_COMMAND, PSTR("The station IP and gateway are not on the same subnet"));
-        return etNone;
-      }
-      if (errIndex)
-        errCode = etInvalidValue;
-      else {
-        // only update values if all three iP are valid
-        config.staStaticIP = ipa;
-        config.staGateway = gateway;
-        config.staNetmask = mask;
-        if (count > 4) {
-          errCode = etExtraParam;
-          errIndex = 4;
-        }
-      }
+      char *end;
+      long n = strtol(token[2].str, &end, 10);
+      if ((*end) || (!rulesRemove(n - 1)))
+        return etInvalidValue;
+    } else if (!strcasecmp(token[1].str, "clear")) {
+      if (count > 2)
+        return etExtraParam;
+      rulesClear();
+    } else {
+      errIndex = 1;
+      return etUnknownParam;
     }
+    size_t len;
+    const uint8_t *code = rulesCode(len);
+    configSaveData(RULES_NVS_KEY, code, len);
   }
-  // show current station static ip configuration
-  if (config.staStaticIP)
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Static station IP %s, gateway %s and netmask %s"),
-      IPAddress(config.staStaticIP).toString().c_str(),
-      IPAddress(config.staGateway).toString().c_str(),
-      IPAddress(config.staNetmask).toString().c_str());
-  else
-    addToLogP(LOG_INFO, TAG_COMMAND, PSTR("Using DHCP obtained IP address"));
-  if (count > 1)
-    addToLogP(LOG_INFO, TAG_COMMAND, PSTR("Any change will take effect on the next connection to the network"));
-
-  return errCode;
+  for (int i = 0; i < rulesCount(); i++) {
+    char key[12];
+    rulePrint(i, text, sizeof(text));
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Rule %d: %s"), i + 1, text);
+    snprintf(key, sizeof(key), "%d", i + 1);
+    resultAdd(key, text);
+  }
+  if (!rulesCount())
+    addToLogP(LOG_INFO, TAG_COMMAND, PSTR("No rules"));
+  return etNone;
 }
 
 
@@ -766,8 +739,13 @@ cmndError_t doStaip(int count, int &errIndex) {
 //
 cmndError_t doStatus(int count, int &errIndex) {
   addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("%s version %s"), APP_NAME, FirmwareVersion().c_str());
+  resultAdd("version", FirmwareVersion().c_str());
+  resultAdd("uptime", millis()/1000);
   wifiLogStatus();
   mqttLogStatus();
+  domoticzLogStatus();
+  commandLogStatus();
+  logLogStatus();
   if (count > 1)  {
     errIndex = 1;
     return etExtraParam;
@@ -776,320 +754,689 @@ cmndError_t doStatus(int count, int &errIndex) {
 }
 
 
-void showSyslog(void) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Syslog host: %s, port: %d"),
-    IPAddress(config.syslogIP).toString().c_str(), config.syslogPort);
+// Executes the command of count tokens in token[], id is its index in commands[]
+static void execTokens(int id, int count) {
+  cmndError_t error = etNone;
+  int errIndex = 0;
+
+  if ( (id < 0) || (id >= COMMAND_COUNT) ) {
+    resultCommand(token[0].str);
+    error = etUnknownCommand;
+  } else {
+    resultCommand(commands[id].name);
+    if (commands[id].handler == nullptr)
+      error = doGroup(configFindGroup(commands[id].name), count, errIndex);
+    else
+      error = commands[id].handler(count, errIndex);
+  }
+  resultEnd(error, errIndex);
+
+  switch (error) {
+    case etMissingParam:   {
+        addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Missing parameter"));
+      } break;
+    case etUnknownCommand: {
+        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" unknown command"), token[errIndex].str);
+      } break;
+    case etUnknownParam:   {
+        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" unknown parameter"), token[errIndex].str);
+      } break;
+    case etExtraParam:     {
+        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" extra parameter"), token[errIndex].str);
+      } break;
+    case etInvalidValue:  {
+        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" invalid value"), token[errIndex].str);
+    }
+    default:               {
+      } break; // etNone
+  }
 }
 
-//    1     2    3       2      3       4   <<< count
-//    0     1    2       1      2       3   <<< errIndex (1, 2 = etInvalidValue, 3 = etExtraParam)
-// syslog [-d] xtra1 | [<ip> [<port>]] xtra2
-//
-cmndError_t doSyslog(int count, int &errIndex) {
-  errIndex = 0;
-  if (count > 1) {
-    if (token[1].equals("-d")) {
-      defaultSyslog();
-      if (count > 2)
-        errIndex = 2;
-    } else {
-      IPAddress ipa;
-      int aPort;
-      if (!ipa.fromString(token[1]))
-        errIndex = 1;
-      else
-        config.syslogIP = ipa;
-      if (count > 2) {
-        aPort = token[2].toInt();
-        if (aPort <= 0)
-          errIndex = 2;
-        else
-          config.syslogPort = aPort;
+// Executes the command that ends at end, the 0 that replaced its ';' or the end of the
+// line lineEnd. Returns false if it is empty. The first token is split off to find the
+// command, a CMD_LINE command gets the rest of the line, with the ';' put back, in
+// token[1] and end is moved to lineEnd.
+static bool exec(char *command, char *&end, char *lineEnd) {
+  addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("exec %s"), command);
+  int count = tokenize(command, token, 1);
+  int id = -1;
+  if (count > 0) {
+    char *rest = token[0].str + token[0].len;
+    if (rest < end)
+      rest++;     // after the 0 that ended the first token
+    id = commandId();
+    if ((id >= 0) && (commands[id].flags & CMD_LINE)) {
+      if (end < lineEnd)
+        *end = ';';
+      end = lineEnd;
+      while (isspace((unsigned char) *rest))
+        rest++;
+      if (*rest) {
+        token[1].str = rest;
+        token[1].len = end - rest;
+        count++;
       }
+    } else {
+      int more = tokenize(rest, token + 1, TOKENCOUNT - 1);
+      count = (more < 0) ? more : count + more;
     }
   }
-  showSyslog();
-
-  if ((count > 3) && (errIndex == 0))
-    errIndex = 3;
-
-  if (errIndex==1)
-    return etInvalidValue;
-  else if (errIndex)
-    return etExtraParam;
-
-  return etNone;
+  if (count < 0) {
+    addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Missing closing quote"));
+    resultCommand("");
+    resultEnd(etMissingQuote, 0);
+    return true;
+  }
+  if (count < 1) return false;
+  execTokens(id, count);
+  return true;
 }
 
-
-//   1    2                2                 3       4  <<< count
-//   0    1                1                 2       3 <<< errIndex
-// time [-d] | [(poll|update|http|ap) [<ms>]]  xtra
-//
-cmndError_t doTime(int count, int &errIndex) {
-
-  if (count < 2) {
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Times in ms: poll = %d, update = %d, http = %d, ap = %d"),
-      config.hdwPollTime, config.sensorUpdtTime, config.dmtzReqTimeout, config.apDelayTime);
-    return etNone;
+// Executes the commands of the line, which is split in place
+static void execLine(cmndSource_t source, char *cmnd) {
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Command from %s: %s"), cmdsrc[source], cmnd);
+  char *lineEnd = cmnd + strlen(cmnd);
+  int n = 0;
+  while (true) {
+    char *end = commandEnd(cmnd);
+    *end = 0;
+    while (isspace((unsigned char) *cmnd))
+      cmnd++;
+    if (exec(cmnd, end, lineEnd))
+      n++;
+    if (end >= lineEnd)
+      break;
+    cmnd = end + 1;
   }
+  if (!n) addToLogP(LOG_DEBUG, TAG_COMMAND, PSTR("no commands"));
+}
 
-  long aTime;
+//================ command queue ================
+
+// Command lines are copied into a queue of COMMAND_QUEUE_LEN slots by doCommand(),
+// which can be called from any task, and executed one after the other in loop() by
+// commandLoop(). A producer reserves a slot by incrementing cmdHead with a compare
+// and swap, copies the line and then marks the slot ready. commandLoop() executes the
+// ready slot at cmdTail, then frees it by incrementing cmdTail.
+
+struct cmdSlot_t {
+  bool ready;                 // the line is copied
+  uint8_t source;             // cmndSource_t
+  int reply;                  // reply box that receives the result, -1 if none
+  uint32_t time;              // millis() when queued
+  char id[COMMAND_ID_SZ];     // correlation id
+  char line[COMMAND_SZ];
+};
 
-  if ((count > 1) and token[1].equals("-d")) {
-    defaultTimes();
-    if (count > 2)  {
-      errIndex = 2;
-      return etExtraParam;
-    }
-    return etNone;
+static cmdSlot_t cmdQueue[COMMAND_QUEUE_LEN];
+static uint32_t cmdHead = 0;          // next slot to reserve
+static uint32_t cmdTail = 0;          // next slot to execute
+
+static uint32_t cmdQueued = 0;        // commands queued since boot
+static uint32_t cmdDropped = 0;       // commands dropped because the queue was full or they were too long
+static uint32_t cmdExecuted = 0;      // commands executed since boot
+static uint32_t cmdLatency = 0;       // sum of the time spent in the queue by the executed commands (ms)
+static uint32_t cmdMaxLatency = 0;    // longest time spent in the queue (ms)
+
+bool doCommand(cmndSource_t source, const char *cmnd, const char *id, int reply) {
+  size_t len = strlen(cmnd);
+  if (len >= COMMAND_SZ) {
+    __atomic_fetch_add(&cmdDropped, 1, __ATOMIC_RELAXED);
+    addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("Command from %s longer than %d characters ignored"), cmdsrc[source], COMMAND_SZ - 1);
+    return false;
   }
-
-  if (count < 2) return etMissingParam;
-
-  if (count > 2) {
-    aTime = token[2].toInt();
-    if (aTime <= 0) {
-      errIndex = 2;
-      return etInvalidValue;
+  uint32_t head = __atomic_load_n(&cmdHead, __ATOMIC_RELAXED);
+  do {
+    if (head - __atomic_load_n(&cmdTail, __ATOMIC_ACQUIRE) >= COMMAND_QUEUE_LEN) {
+      __atomic_fetch_add(&cmdDropped, 1, __ATOMIC_RELAXED);
+      addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("Command queue full, command from %s ignored"), cmdsrc[source]);
+      return false;
     }
-  }
+  } while (!__atomic_compare_exchange_n(&cmdHead, &head, head + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  cmdSlot_t &slot = cmdQueue[head % COMMAND_QUEUE_LEN];
+  memcpy(slot.line, cmnd, len + 1);
+  if (id)
+    strlcpy(slot.id, id, sizeof(slot.id));
+  else
+    snprintf(slot.id, sizeof(slot.id), "%u", (unsigned) head);
+  slot.source = source;
+  slot.reply = reply;
+  slot.time = millis();
+  __atomic_store_n(&slot.ready, true, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&cmdQueued, 1, __ATOMIC_RELAXED);
+  return true;
+}
 
-  token[1].toLowerCase();
+bool doCommand(cmndSource_t source, const String &cmnd, const char *id, int reply) {
+  return doCommand(source, cmnd.c_str(), id, reply);
+}
 
-  if (token[1].equals("poll")) {
-    if (count > 2) { config.hdwPollTime = aTime; }
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Hardware poll interval time: %li ms"), config.hdwPollTime);
+//================ web replies ================
 
+// The result of a command from the web server is kept in a reply box until the HTTP
+// response has sent it. The state of a box is in its tag along with a ticket that is
+// incremented each time the box is opened, so that the result of a command whose
+// request was closed is not given to the next request that opens the box.
 
-  } else if (token[1].equals("http")) {
-    if (count > 2) { config.dmtzReqTimeout = aTime; }
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("HTTP connect timeout: %d ms"), config.dmtzReqTimeout);
+enum replyState_t {rsFree, rsWaiting, rsFilling, rsReady};
 
-  } else if (token[1].equals("update")) {
-    if (count > 2) { config.sensorUpdtTime = aTime; }
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Sensor data update time: %d ms"), config.sensorUpdtTime);
+#define REPLY_TAG(ticket, state) (((ticket) << 2) | (state))
 
+struct cmdReply_t {
+  uint32_t tag;               // REPLY_TAG(ticket, state)
+  size_t len;
+  char json[COMMAND_RESULT_SZ];
+};
 
-  } else if (token[1].equals("ap")) {
-    if (count > 2) { config.apDelayTime = aTime; }
-    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Disconnect delay before starting the access point: %d ms"), config.apDelayTime);
+static cmdReply_t cmdReplies[COMMAND_REPLY_COUNT];
 
-  } else {
-      errIndex = 1;
-      return etUnknownParam;
+int commandReplyOpen(void) {
+  for (int i = 0; i < COMMAND_REPLY_COUNT; i++) {
+    uint32_t tag = __atomic_load_n(&cmdReplies[i].tag, __ATOMIC_ACQUIRE);
+    uint32_t ticket = ((tag >> 2) + 1) & 0xFFFFFF;
+    if (((tag & 3) == rsFree) && (__atomic_compare_exchange_n(&cmdReplies[i].tag, &tag,
+        REPLY_TAG(ticket, rsWaiting), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)))
+      return ticket*COMMAND_REPLY_COUNT + i;
   }
-
-  if (count > 3) {
-    errIndex = 3;
-    return etExtraParam;
-  }
-  return etNone;
+  return -1;
 }
 
-
-
-//   1    2    3               2            3         4 <<< count
-//   0    1    2               1            2         3 <<< errIndex
-// topic [-d] xtra1 | [(log|cmd|pub|sub) [<topic>]]  xtra2
-//
-void showTopics(void) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("MQTT topics: log = \"%s\", cmd = \"%s\", Domoticz pub = \"%s\" and sub = \"%s\""),
-  config.topicLog, config.topicCmd, config.topicDmtzPub, config.topicDmtzSub);
+bool commandReplyReady(int reply) {
+  uint32_t ticket = reply / COMMAND_REPLY_COUNT;
+  return __atomic_load_n(&cmdReplies[reply % COMMAND_REPLY_COUNT].tag, __ATOMIC_ACQUIRE) == REPLY_TAG(ticket, rsReady);
 }
 
-cmndError_t doTopic(int count, int &errIndex) {
-  if (count < 2) {
-    showTopics();
-    return etNone;
-  }
+size_t commandReplyRead(int reply, uint8_t *buf, size_t size, size_t index) {
+  cmdReply_t &box = cmdReplies[reply % COMMAND_REPLY_COUNT];
+  if (index >= box.len)
+    return 0;
+  size_t n = (box.len - index < size) ? box.len - index : size;
+  memcpy(buf, box.json + index, n);
+  return n;
+}
 
-  token[1].toLowerCase();
+void commandReplyClose(int reply) {
+  uint32_t ticket = reply / COMMAND_REPLY_COUNT;
+  __atomic_store_n(&cmdReplies[reply % COMMAND_REPLY_COUNT].tag, REPLY_TAG(ticket, rsFree), __ATOMIC_RELEASE);
+}
 
-  if (token[1].equals("-d")) {
-    defaultTopics();
-    showTopics();
-    if (count > 2) {
-      errIndex = 2;
-      return etExtraParam;
-    }
-    return etNone;
-  }
+// Copies result[] to the reply box if it is still waiting for it
+static void fillReply(int reply) {
+  cmdReply_t &box = cmdReplies[reply % COMMAND_REPLY_COUNT];
+  uint32_t ticket = reply / COMMAND_REPLY_COUNT;
+  uint32_t tag = REPLY_TAG(ticket, rsWaiting);
+  if (!__atomic_compare_exchange_n(&box.tag, &tag, REPLY_TAG(ticket, rsFilling), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    return;   // closed by the web server
+  memcpy(box.json, result, resultLen);
+  box.len = resultLen;
+  tag = REPLY_TAG(ticket, rsFilling);
+  __atomic_compare_exchange_n(&box.tag, &tag, REPLY_TAG(ticket, rsReady), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
 
-  errIndex = 1;
-  int branch = -1;
-  if (token[1].equals("log"))
-    branch = 0;
-  else if (token[1].equals("cmd"))
-    branch = 1;
-  else if (token[1].equals("pub"))
-    branch = 2;
-  else if (token[1].equals("sub"))
-    branch = 3;
-  else {
-    return etUnknownParam;
-  }
-  errIndex++;
-  switch (branch) {
-    case 0:
-     if (count > 2)
-        strlcpy(config.topicLog, token[2].c_str(), MQTT_TOPIC_SZ);
-      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log topic: \"%s\""), config.topicLog);
+// Sends result[] back to the source of the command line, reply is its reply box
+static void sendResult(cmndSource_t source, int reply) {
+  switch (source) {
+    case FROM_UART:
+      Serial.println(result);
       break;
-    case 1:
-     if (count > 2)
-        strlcpy(config.topicCmd, token[2].c_str(), MQTT_TOPIC_SZ);
-      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Cmd topic: \"%s\""), config.topicCmd);
+    case FROM_MQTT:
+      mqttPublishResult(result);
       break;
-    case 2:
-     if (count > 2)
-        strlcpy(config.topicDmtzPub, token[2].c_str(), MQTT_TOPIC_SZ);
-      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Pub topic: \"%s\""), config.topicDmtzPub);
+    case FROM_SCRIPT:
+      // the boot scripts run before MQTT is connected, their result is not lost
+      if (!mqttPublishResult(result))
+        addToLog(LOG_INFO, TAG_COMMAND, result);
       break;
-    case 3:
-      if (count > 2) {
-        strlcpy(config.topicDmtzSub, token[2].c_str(), MQTT_TOPIC_SZ);
-        mqttDisconnect();  // so that the new pub topic is used
-      }
-      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Pub topic: \"%s\""), config.topicDmtzPub);
+    case FROM_WEBC:
+      if (reply >= 0)
+        fillReply(reply);
       break;
-    default:
-      addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Parsing ERROR"));
   }
-  if (count > 2)
-    errIndex++;
-  if (count > errIndex)
-    return etExtraParam;
-  return etNone;
 }
 
+//================ settings import ================
 
-//   1     2     3        2      3         4      <<< count
-//   0     1     2        1      2         3      <<< index
-//  wifi  [-d] xtra1 | [<ssid> [<pswd>]]  xtra2
-//
-cmndError_t doWifi(int count, int &errIndex) {
-  errIndex = 2; // assume xtra1
+// A JSON import of the settings from the web server is copied by doImport() and applied
+// in loop() by commandLoop(), so that the config, and its string pool, is only changed
+// by the loop task. The config is then saved by configLoop() as after a command.
 
-  if (count > 1) {
-    if ((token[1].equals("-d")) || token[1].equals("-D"))
-      defaultWifiNetwork();
-    else {
-      if (count < 3)
-        token[2] = "";
-      else if (token[2].length() < 8)
-        return etInvalidValue;
-      errIndex = 3; // assume xtra2
-      strlcpy(config.wifiSsid, token[1].c_str(), HOST_SZ);
-      strlcpy(config.wifiPswd, token[2].c_str(), PSWD_SZ);
-    }
-  }
+enum importState_t {isFree, isCopying, isReady};
 
-  token[2] = config.wifiPswd;
-  if (token[2].length() < 1)
-    token[2] = "<none>";
-  else if (token[2].length() < 8)
-    token[2] = "<too short>";
-  else for (int i=0; i < token[2].length(); i++)
-    token[2].setCharAt(i, '*');
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Wi-Fi SSID: %s, password: %s"), config.wifiSsid, token[2].c_str());
+static char importJson[CONFIG_JSON_MAX];
+static size_t importLen;
+static int importReply;
+static uint8_t importState = isFree;
 
-  if (count > errIndex)
-    return etExtraParam;
-  return etNone;
+bool doImport(const char *json, size_t len, int reply) {
+  uint8_t state = isFree;
+  if (len > CONFIG_JSON_MAX)
+    return false;
+  if (!__atomic_compare_exchange_n(&importState, &state, (uint8_t) isCopying, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    addToLogP(LOG_ERR, TAG_COMMAND, PSTR("JSON settings ignored, an import is pending"));
+    return false;
+  }
+  memcpy(importJson, json, len);
+  importLen = len;
+  importReply = reply;
+  __atomic_store_n(&importState, (uint8_t) isReady, __ATOMIC_RELEASE);
+  return true;
 }
 
+// Applies the pending import, if any, and puts its result in its reply box
+static void importLoop(void) {
+  char error[80];
+  if (__atomic_load_n(&importState, __ATOMIC_ACQUIRE) != isReady)
+    return;
+  resultBegin(FROM_WEBC, "import");
+  resultCommand("import");
+  bool ok = configReadJson(importJson, importLen, error, sizeof(error));
+  if (!ok)
+    resultAdd("reason", error);
+  resultEnd((ok) ? etNone : etInvalidValue, -1);
+  resultClose();
+  if (importReply >= 0)
+    fillReply(importReply);
+  __atomic_store_n(&importState, (uint8_t) isFree, __ATOMIC_RELEASE);
+}
 
-// --------------------------------------------------
+int commandLoop(void) {
+  unsigned long start = micros();
+  int count = 0;
+  importLoop();
+  uint32_t tail = cmdTail;
+  while (tail != __atomic_load_n(&cmdHead, __ATOMIC_ACQUIRE)) {
+    cmdSlot_t &slot = cmdQueue[tail % COMMAND_QUEUE_LEN];
+    if (!__atomic_load_n(&slot.ready, __ATOMIC_ACQUIRE))
+      break;    // still being copied
+    uint32_t latency = millis() - slot.time;
+    cmdLatency += latency;
+    if (latency > cmdMaxLatency)
+      cmdMaxLatency = latency;
+    cmdExecuted++;
+    resultBegin((cmndSource_t) slot.source, slot.id);
+    execLine((cmndSource_t) slot.source, slot.line);
+    resultClose();
+    sendResult((cmndSource_t) slot.source, slot.reply);
+    slot.ready = false;
+    __atomic_store_n(&cmdTail, ++tail, __ATOMIC_RELEASE);
+    count++;
+    // execute more commands only if time remains in the budget of this pass
+    if (micros() - start >= config.sendBudget)
+      break;
+  }
+  return count;
+}
 
+void commandLogStatus(void) {
+  uint32_t pending = __atomic_load_n(&cmdHead, __ATOMIC_RELAXED) - cmdTail;
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Commands: %u queued, %u executed, %u dropped, %u in queue, latency %u ms average, %u ms max"),
+    (unsigned) cmdQueued, (unsigned) cmdExecuted, (unsigned) cmdDropped, (unsigned) pending,
+    (unsigned) ((cmdExecuted) ? cmdLatency/cmdExecuted : 0), (unsigned) cmdMaxLatency);
+  resultAdd("queued", cmdQueued);
+  resultAdd("executed", cmdExecuted);
+  resultAdd("dropped", cmdDropped);
+  resultAdd("latency", (cmdExecuted) ? cmdLatency/cmdExecuted : 0);
+  resultAdd("maxLatency", cmdMaxLatency);
+}
 
-typedef cmndError_t (*dofnct)(const int, int&);
+//================ scripts ================
 
-dofnct doFunctionList[COMMAND_COUNT] = {
-  doAp,
-  doApip,
-  doConfig,
-  doDmtz,
-  doHelp,
-  doIdx,
-  doLog,
-  doMqtt,
-  doName,
-  doRestart,
-  doStaip,
-  doStatus,
-  doSyslog,
-  doTime,
-  doTopic,
-  doWifi
+// A script is a line of commands kept in one of SCRIPT_COUNT slots, and in NVS under
+// "script<n>", that runs once at boot or every period. The line is split into tokens when
+// the script is set and kept pre-tokenized: each command is its number of tokens followed
+// by the tokens, each one its length, its characters and a 0:
+//
+//   name device "Kitchen light"; status  ->  3 4 name 0 6 device 0 13 Kitchen light 0 1 6 status 0
+//
+// so that running it only points token[] into a copy of the code. In NVS the code follows
+// the period. A command that does not return, restart, can only be the last command of a
+// periodic script: in a boot script it would restart the device over and over. The scripts
+// due to run are kept by due time in one timer list, scriptTimers[], so scriptLoop() only
+// checks the first one.
+
+#define SCRIPT_KEY          "script%d"
+#define SCRIPT_MAX_PERIOD   (7*24*3600)   // longest period (s), a week
+
+struct scriptData_t {
+  uint32_t period;            // seconds between runs, 0 for a boot script
+  char code[SCRIPT_SZ];       // pre-tokenized commands
 };
 
-void exec(String command) {
-  cmndError_t error = etNone;
-  int count = parseString(command);  // fill tokens
-  if (count < 1) return;
+struct script_t {
+  scriptData_t data;
+  size_t len;                 // length of data.code, 0 if the slot is empty
+  uint32_t due;               // millis() of the next run when scheduled
+};
 
-  addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("exec %s"), command.c_str());
+static script_t scripts[SCRIPT_COUNT];
+static int scriptTimers[SCRIPT_COUNT];    // slots scheduled to run, by due time
+static int scriptTimerCount = 0;
+static char scriptCode[SCRIPT_SZ];        // copy of the code being run, the handlers can change the tokens
 
-  int errIndex = 0;
-  int id = commandId();
+static void scriptUnschedule(int slot) {
+  int n = 0;
+  for (int i = 0; i < scriptTimerCount; i++)
+    if (scriptTimers[i] != slot)
+      scriptTimers[n++] = scriptTimers[i];
+  scriptTimerCount = n;
+}
 
-   if ( (id < 0) || (id >= COMMAND_COUNT) || (doFunctionList[id] == nullptr) )
-    error = etUnknownCommand;
-  else
-    error = doFunctionList[id](count, errIndex);
+// Schedules the script of slot to run at due, after the scripts due at the same time
+static void scriptSchedule(int slot, uint32_t due) {
+  scriptUnschedule(slot);
+  scripts[slot].due = due;
+  int i = scriptTimerCount++;
+  for (; (i > 0) && ((int32_t) (scripts[scriptTimers[i-1]].due - due) > 0); i--)
+    scriptTimers[i] = scriptTimers[i-1];
+  scriptTimers[i] = slot;
+}
 
-  switch (error) {
-    case etMissingParam:   {
-        addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Missing parameter"));
-      } break;
-    case etUnknownCommand: {
-        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" unknown command"), token[errIndex].c_str());
-      } break;
-    case etUnknownParam:   {
-        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" unknown parameter"), token[errIndex].c_str());
-      } break;
-    case etExtraParam:     {
-        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" extra parameter"), token[errIndex].c_str());
-      } break;
-    case etInvalidValue:  {
-        addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("\"%s\" invalid value"), token[errIndex].c_str());
+// Returns the reason why the command with id cannot be in a script, a boot script if
+// boot, NULL if it can
+static const char *scriptRefused(int id, bool boot) {
+  if (commands[id].flags & CMD_LINE)
+    return "command not allowed in a script";
+  if ((boot) && (commands[id].flags & CMD_NORETURN))
+    return "command not allowed in a boot script";
+  return NULL;
+}
+
+// Compiles the line of commands, which is split in place, into code, for a boot script
+// if boot. Returns the length of the code, 0 on error, in which case error is the reason.
+static size_t scriptCompile(char *line, char *code, bool boot, const char *&error) {
+  token_t tokens[TOKENCOUNT];
+  size_t len = 0;
+  bool last = false;
+  bool stopped = false;       // after a command that does not return
+  while (!last) {
+    char *end = commandEnd(line);
+    last = !*end;
+    *end = 0;
+    int count = tokenize(line, tokens, TOKENCOUNT);
+    line = end + 1;
+    if (count < 0) {
+      error = "missing closing quote";
+      return 0;
+    }
+    if (!count)
+      continue;
+    int id = findCommand(tokens[0].str, tokens[0].len);
+    if (id < 0) {
+      error = "unknown command";
+      return 0;
+    }
+    error = (stopped) ? "command after one that does not return" : scriptRefused(id, boot);
+    if (error)
+      return 0;
+    stopped = commands[id].flags & CMD_NORETURN;
+    if (len >= SCRIPT_SZ) {
+      error = "script too long";
+      return 0;
+    }
+    code[len++] = count;
+    for (int i = 0; i < count; i++) {
+      if (len + tokens[i].len + 2 > SCRIPT_SZ) {
+        error = "script too long";
+        return 0;
+      }
+      code[len++] = tokens[i].len;
+      memcpy(code + len, tokens[i].str, tokens[i].len + 1);
+      len += tokens[i].len + 1;
     }
-    default:               {
-        return;
-      } break; // etNone
   }
+  if (!len)
+    error = "no commands";
+  return len;
 }
 
-void doCommand(cmndSource_t source, String cmnd) {
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Command from %s: %s"), cmdsrc[source], cmnd.c_str());
-  int ndx0 = 0;
-  int ndx1 = 0;
-  int n = 0;
-  int lc = cmnd.length() - 1;
+// Returns true if the len bytes of code are valid commands, with tokens of the length given,
+// that can be in a script, a boot script if boot
+static bool scriptValid(const char *code, size_t len, bool boot) {
+  size_t i = 0;
+  bool stopped = false;
+  while (i < len) {
+    int count = (uint8_t) code[i++];
+    if ((!count) || (count > TOKENCOUNT) || (stopped))
+      return false;
+    for (int t = 0; t < count; t++) {
+      if (i >= len)
+        return false;
+      size_t n = (uint8_t) code[i++];
+      if ((i + n >= len) || (strnlen(code + i, len - i) != n))
+        return false;
+      if (!t) {
+        int id = findCommand(code + i, n);
+        if ((id < 0) || (scriptRefused(id, boot)))
+          return false;
+        stopped = commands[id].flags & CMD_NORETURN;
+      }
+      i += n + 1;
+    }
+  }
+  return true;
+}
+
+// Writes the script of slot into buf as it is given to the script command
+static void scriptPrint(int slot, char *buf, size_t size) {
+  const scriptData_t &data = scripts[slot].data;
+  size_t n = 0;
+  if (!data.period)
+    n = append(buf, size, n, "boot");
+  else {
+    static const uint32_t seconds[] = {24*3600, 3600, 60, 1};
+    static const char units[] = "dhms";
+    int u = 0;
+    while (data.period % seconds[u])
+      u++;
+    char every[20];
+    snprintf(every, sizeof(every), "every %u%c", (unsigned) (data.period / seconds[u]), units[u]);
+    n = append(buf, size, n, every);
+  }
+  for (size_t i = 0; i < scripts[slot].len; ) {
+    if (i)
+      n = append(buf, size, n, ";");
+    for (int count = (uint8_t) data.code[i++]; count; count--) {
+      const char *tok = data.code + i + 1;
+      i += (uint8_t) data.code[i] + 2;
+      bool quote = (!*tok) || (strpbrk(tok, " \t\n\v\f\r;"));
+      n = append(buf, size, n, (quote) ? " \"" : " ");
+      n = append(buf, size, n, tok);
+      if (quote)
+        n = append(buf, size, n, "\"");
+    }
+  }
+}
 
-  // skip leading spaces and ';'
-  while ((ndx0 <= lc) && (cmnd.charAt(ndx0) == ' ' || cmnd.charAt(ndx0) == ';') ) ndx0++;
+static void scriptShow(int slot) {
+  char text[COMMAND_SZ];
+  char key[12];
+  scriptPrint(slot, text, sizeof(text));
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Script %d: %s"), slot + 1, text);
+  snprintf(key, sizeof(key), "%d", slot + 1);
+  resultAdd(key, text);
+}
 
-  String command;
-  while (ndx0 <= lc) {
-    ndx1 = cmnd.indexOf(';', ndx0);
-    if (ndx1 < 0) {
-      command = cmnd.substring(ndx0);
-      ndx0 = cmnd.length();
-    } else {
-      command = cmnd.substring(ndx0, ndx1);
-      ndx0 = ndx1+1;
+// Runs the script of slot, its result is published like the result of an MQTT command,
+// or logged when it cannot be published
+static void runScript(int slot) {
+  char id[COMMAND_ID_SZ];
+  snprintf(id, sizeof(id), SCRIPT_KEY, slot + 1);
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Running script %d"), slot + 1);
+  size_t len = scripts[slot].len;
+  memcpy(scriptCode, scripts[slot].data.code, len);
+  resultBegin(FROM_SCRIPT, id);
+  for (size_t i = 0; i < len; ) {
+    int count = (uint8_t) scriptCode[i++];
+    for (int t = 0; t < count; t++) {
+      token[t].len = (uint8_t) scriptCode[i++];
+      token[t].str = scriptCode + i;
+      i += token[t].len + 1;
     }
-    command.trim();
-    if (command.length() > 0) {
-      n++;
-      exec(command);
+    execTokens(commandId(), count);
+  }
+  resultClose();
+  sendResult(FROM_SCRIPT, -1);
+}
+
+void loadScripts(void) {
+  scriptData_t data;
+  char key[12];
+  int loaded = 0;
+  for (int slot = 0; slot < SCRIPT_COUNT; slot++) {
+    snprintf(key, sizeof(key), SCRIPT_KEY, slot + 1);
+    size_t len = configLoadData(key, &data, sizeof(data));
+    if (!len)
+      continue;
+    len -= sizeof(data.period);
+    if ((len > SCRIPT_SZ) || (!len) || (data.period > SCRIPT_MAX_PERIOD) || (!scriptValid(data.code, len, !data.period))) {
+      addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("Invalid script %d in NVS ignored"), slot + 1);
+      continue;
     }
+    memcpy(&scripts[slot].data, &data, sizeof(data.period) + len);
+    scripts[slot].len = len;
+    if (data.period)
+      scriptSchedule(slot, millis() + 1000*data.period);
+    loaded++;
   }
-  if (!n) addToLogP(LOG_DEBUG, TAG_COMMAND, PSTR("no commands"));
+  if (loaded)
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Loaded %d scripts"), loaded);
+  for (int slot = 0; slot < SCRIPT_COUNT; slot++)
+    if ((scripts[slot].len) && (!scripts[slot].data.period))
+      runScript(slot);
+}
+
+void scriptLoop(void) {
+  if (!scriptTimerCount)
+    return;
+  int slot = scriptTimers[0];
+  uint32_t now = millis();
+  if ((int32_t) (now - scripts[slot].due) < 0)
+    return;
+  uint32_t period = 1000*scripts[slot].data.period;
+  if (!period)
+    scriptUnschedule(slot);   // a boot script run by the script command
+  else if ((int32_t) (now - (scripts[slot].due + period)) < 0)
+    scriptSchedule(slot, scripts[slot].due + period);
+  else
+    scriptSchedule(slot, now + period);   // late by more than a period, skip the missed runs
+  runScript(slot);
+}
+
+// Splits the first token off text, which ends at end, into token[count] and increments
+// count if there is one. Returns the text after the token, NULL if its closing quote is
+// missing.
+static char *splitToken(char *text, char *end, int &count) {
+  int n = tokenize(text, token + count, 1);
+  if (n < 0)
+    return NULL;
+  if (!n)
+    return end;
+  char *rest = token[count].str + token[count].len;
+  count++;
+  return (rest < end) ? rest + 1 : rest;
 }
 
-void doCommand(cmndSource_t source, const char *cmnd) {
-  doCommand(source, String(cmnd));
+//      1     2   3      4          5        <<< count
+//      0     1   2      3          4        <<< errIndex
+// "script [<n> [run|del xtra3] | [boot <commands>] | [every <n>[s|m|h|d] <commands>]]"
+//
+// The command takes the rest of the line in token[1], which is split here as needed.
+cmndError_t doScript(int count, int &errIndex) {
+  if (count < 2) {
+    for (int slot = 0; slot < SCRIPT_COUNT; slot++)
+      if (scripts[slot].len)
+        scriptShow(slot);
+    return etNone;
+  }
+  char *end = token[1].str + token[1].len;
+  count = 1;
+  char *rest = splitToken(token[1].str, end, count);
+  if (rest)
+    rest = splitToken(rest, end, count);
+  if (!rest) {
+    addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Missing closing quote"));
+    return etMissingQuote;
+  }
+  errIndex = 1;
+  char *stop;
+  long n = strtol(token[1].str, &stop, 10);
+  if ((*stop) || (n < 1) || (n > SCRIPT_COUNT))
+    return etInvalidValue;
+  int slot = n - 1;
+  if (count < 3) {
+    if (scripts[slot].len)
+      scriptShow(slot);
+    else
+      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Script %d is empty"), slot + 1);
+    return etNone;
+  }
+
+  errIndex = 2;
+  char key[12];
+  snprintf(key, sizeof(key), SCRIPT_KEY, slot + 1);
+  if ((!strcasecmp(token[2].str, "run")) || (!strcasecmp(token[2].str, "del"))) {
+    rest = splitToken(rest, end, count);
+    if ((!rest) || (count > 3)) {
+      errIndex = 3;
+      return (rest) ? etExtraParam : etMissingQuote;
+    }
+    if (!scripts[slot].len) {
+      errIndex = 1;
+      return etInvalidValue;
+    }
+    if (!strcasecmp(token[2].str, "run")) {
+      scriptSchedule(slot, millis());
+      return etNone;
+    }
+    scripts[slot].len = 0;
+    scriptUnschedule(slot);
+    configSaveData(key, NULL, 0);
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Script %d deleted"), slot + 1);
+    return etNone;
+  }
+
+  uint32_t period = 0;
+  if (!strcasecmp(token[2].str, "every")) {
+    rest = splitToken(rest, end, count);
+    if (count < 4)
+      return etMissingParam;
+    errIndex = 3;
+    n = strtol(token[3].str, &stop, 10);
+    const char *units = "smhd";
+    static const uint32_t seconds[] = {1, 60, 3600, 24*3600};
+    const char *unit = (*stop) ? strchr(units, tolower((unsigned char) *stop)) : units;
+    if ((stop == token[3].str) || (!unit) || ((*stop) && (stop[1])) || (n < 1)
+        || (n > SCRIPT_MAX_PERIOD / seconds[unit - units]))
+      return etInvalidValue;
+    period = n * seconds[unit - units];
+  } else if (strcasecmp(token[2].str, "boot"))
+    return etUnknownParam;
+
+  while (isspace((unsigned char) *rest))
+    rest++;
+  if (!*rest)
+    return etMissingParam;
+  errIndex = count;
+  token[count].str = rest;
+  token[count].len = end - rest;
+  char line[COMMAND_SZ];
+  strlcpy(line, rest, sizeof(line));
+  scriptData_t data;
+  const char *error;
+  size_t len = scriptCompile(line, data.code, !period, error);
+  if (!len) {
+    addToLogPf(LOG_ERR, TAG_COMMAND, PSTR("Script not set: %s"), error);
+    resultAdd("reason", error);
+    return etInvalidValue;
+  }
+  data.period = period;
+  memcpy(&scripts[slot].data, &data, sizeof(data.period) + len);
+  scripts[slot].len = len;
+  if (period)
+    scriptSchedule(slot, millis() + 1000*period);
+  else
+    scriptUnschedule(slot);
+  configSaveData(key, &data, sizeof(data.period) + len);
+  scriptShow(slot);
+  return etNone;
 }
@@ -1,6 +1,65 @@
 #pragma once
 
-enum cmndSource_t {FROM_UART, FROM_WEBC, FROM_MQTT};
+enum cmndSource_t {FROM_UART, FROM_WEBC, FROM_MQTT, FROM_SCRIPT};
 
-void doCommand(cmndSource_t source, String cmnd);
-void doCommand(cmndSource_t source, const char *cmnd);
+#define COMMAND_SZ          256   // size of a command line in the queue, including the terminating 0
+#define COMMAND_QUEUE_LEN   4     // number of command lines in the queue
+#define COMMAND_ID_SZ       25    // size of the correlation id of a command line, including the terminating 0
+#define COMMAND_RESULT_SZ   1024  // size of the JSON result of a command line, including the terminating 0
+#define COMMAND_REPLY_COUNT 2     // number of web requests that can wait for the result of their command
+#define SCRIPT_COUNT        4     // number of script slots
+#define SCRIPT_SZ           256   // size of the pre-tokenized commands of a script
+
+  // Queues a copy of the line of commands, separated by ';' (see tokenizer.h), to be
+  // executed in loop() by commandLoop(). Can be called from any task. Returns false, and
+  // the line is ignored, if the queue is full or the line has COMMAND_SZ characters or more.
+  //
+  // Once executed, the JSON result of the line is sent back to its source: printed on the
+  // UART, published to the MQTT result topic or put in the reply box (see below). The
+  // result holds id, or the sequence number of the line if id is NULL, so that it can be
+  // matched with the line.
+bool doCommand(cmndSource_t source, const char *cmnd, const char *id = NULL, int reply = -1);
+bool doCommand(cmndSource_t source, const String &cmnd, const char *id = NULL, int reply = -1);
+
+  // Executes the queued command lines, at least one if there is any, until the queue is
+  // empty or the config.sendBudget time budget is exhausted. Call in loop().
+  // Returns the number of command lines executed.
+int commandLoop(void);
+
+  // Reports the number of queued, executed and dropped commands and their latency to the log
+void commandLogStatus(void);
+
+  // Reply boxes that hold the result of a command from the web server until the HTTP
+  // response sends it. A box is opened before the command is queued with the box as its
+  // reply, the result can be read once commandReplyReady() is true and the box must be
+  // closed when the request is done with it, even if the command could not be queued.
+  // These functions can be called from any task.
+
+  // Returns the reply box opened, -1 if they are all in use
+int commandReplyOpen(void);
+
+  // Returns true if the result of the command is in the reply box
+bool commandReplyReady(int reply);
+
+  // Copies at most size bytes of the result from index on to buf, returns the number of
+  // bytes copied, 0 at the end of the result
+size_t commandReplyRead(int reply, uint8_t *buf, size_t size, size_t index);
+
+void commandReplyClose(int reply);
+
+  // Queues a copy of the len characters of JSON settings (see configjson.h) to be imported
+  // in loop() by commandLoop(), the result of the import is put in the reply box unless
+  // reply is -1. Can be called from any task. Returns false, and the settings are ignored,
+  // if an import is already pending or len is more than CONFIG_JSON_MAX.
+bool doImport(const char *json, size_t len, int reply);
+
+  // Scripts are lines of commands set with the script command and saved in NVS. A boot
+  // script runs once at boot, the others every period. They are split into tokens when
+  // set, so that running them does not parse them again, and their result is published
+  // to the MQTT result topic.
+
+  // Loads the scripts from NVS and runs the boot scripts. Call in setup() after loadConfig().
+void loadScripts(void);
+
+  // Runs the first script of the timer list if it is due. Call in loop().
+void scriptLoop(void);
@@ -1,186 +1,938 @@
 #include <Arduino.h>
 #include <IPAddress.h>
 #include <Preferences.h>
+#include <errno.h>
+#include <stddef.h>     // offsetof
 #include "config.h"
 #include "user_config.h"
 #include "logging.h"
+#include "mqtt.hpp"
+#include "crc32.h"
 
-// BUG - it is possible that strlcpy could truncate !!!
-//   see: https://en.wikibooks.org/wiki/C_Programming/C_Reference/nonstandard/strlcpy#Criticism
+#ifndef SEND_BUDGET    // missing in user_config.h created from an older template
+#define SEND_BUDGET 2000
+#endif
+
+#ifndef SAVE_DELAY
+#define SAVE_DELAY  5000
+#endif
+
+#ifndef MQTT_RESULT_TOPIC
+#define MQTT_RESULT_TOPIC "%h%/result"
+#endif
+
+#ifndef LOG_REPEAT_WINDOW
+#define LOG_REPEAT_WINDOW 10000
+#define LOG_RATE          0
+#define LOG_BURST         10
+#endif
 
 config_t config;
 Preferences preferences;
 
-void defaultNames(void) {
-  strlcpy(config.hostname, HOSTNAME, HOSTNAME_SZ);
-  strlcpy(config.devname, DEVICENAME, HOST_SZ);
+// The configuration is stored in NVS in two slots, A and B, which hold the last two
+// saved versions of config. A slot is made of fixed size pages of config, each one in
+// its own key "cfgA0", "cfgA1", ... and of a header in key "cfgA" with a sequence
+// number and the checksum of the config in the pages. A save writes the pages of the
+// other slot than the one that holds the current config, then its header, so that a
+// power cut during the save leaves the previous config intact. At load, the valid
+// slot with the highest sequence number is used.
+//
+// Only the pages of a slot that differ from the config are written. slotConfig[] are
+// copies of the content of the slots in NVS, used to find the changed pages. The
+// namespace is never cleared.
+//
+// Previous versions stored the config in the pages "cfg0", "cfg1", ... without a header
+// and before that in a single "config" key. They are read and converted to a slot if
+// there is no valid slot.
+//
+// The config of an older version, which can be larger than config_t, is read into a
+// buffer of CONFIG_IMAGE_MAX bytes allocated while it is loaded and upgraded.
+
+#define CONFIG_PAGE_SZ    64
+#define CONFIG_PAGES      ((sizeof(config_t) + CONFIG_PAGE_SZ - 1) / CONFIG_PAGE_SZ)
+#define CONFIG_MAX_PAGES  ((CONFIG_IMAGE_MAX + CONFIG_PAGE_SZ - 1) / CONFIG_PAGE_SZ)
+#define CONFIG_SLOTS      2
+#define CONFIG_LEGACY_KEY "config"
+
+struct slotHeader_t {
+  uint32_t sequence;                    // incremented at each save
+  uint32_t checksum;                    // checksum of the config in the pages of the slot
+};
+
+static config_t slotConfig[CONFIG_SLOTS];
+static slotHeader_t slotHeader[CONFIG_SLOTS];
+static bool slotValid[CONFIG_SLOTS] = {false, false};   // false if slotConfig[] is not the content of the slot
+static int activeSlot = CONFIG_SLOTS - 1;                // slot of the last saved config
+static uint32_t nvsWrites = 0;                           // number of pages written since boot
+
+static bool savePending = false;        // config changed since the last save
+static uint32_t changeTime;             // time of the last change of config (ms)
+
+static bool isValidHostname(const char *name) {
+  // letters, digits and '-' which cannot start or end the name
+  if ((!*name) || (*name == '-') || (name[strlen(name)-1] == '-'))
+    return false;
+  for (const char *p = name; *p; p++) {
+    if ((!isalnum((unsigned char) *p)) && (*p != '-'))
+      return false;
+  }
+  return true;
 }
 
-void defaultWifiNetwork(void) {
-  strlcpy(config.wifiSsid, WIFI_SSID, HOST_SZ);
-  strlcpy(config.wifiPswd, WIFI_PSWD, PSWD_SZ);
+static bool isValidPassword(const char *pswd) {
+  return (!*pswd) || (strlen(pswd) >= 8);
 }
 
-void defaultStaticStaIp(void) {
-  IPAddress ip;
-  if (ip.fromString(STA_STATIC_IP))
-    config.staStaticIP = ip;
-  else
-    config.staStaticIP = 0;
-  if (ip.fromString(STA_GATEWAY))
-    config.staGateway = ip;
-  else
-    config.staGateway = 0;
-  if (ip.fromString(STA_NETMASK))
-    config.staNetmask = ip;
-  else
-    config.staNetmask = 0;
+// The first argument of the macros is the version of config_t that added the field.
+// The fields must be in the order of config_t and the strings in the order of
+// cfgString_t. Up to CONFIG_POOL_VERSION the strings were in config_t at the place of
+// their entry, as char arrays of their maximum size.
+
+#define STR_FIELD(since, group, name, id, size, flags, def, check) \
+  {name, group, ctString, flags, 1, id, size, def, 0, 0, 0, check, since}
+#define IP_FIELD(since, group, name, field, flags, def) \
+  {name, group, ctIP, flags, 1, offsetof(config_t, field), sizeof(config_t::field), def, 0, 0, 0, NULL, since}
+#define NUM_FIELD(since, group, name, type, field, flags, def, min, max) \
+  {name, group, type, flags, 1, offsetof(config_t, field), sizeof(config_t::field), NULL, def, min, max, NULL, since}
+#define ARRAY_FIELD(since, group, name, type, field, flags, def, min, max) \
+  {name, group, type, flags, sizeof(config_t::field)/sizeof(config_t::field[0]), offsetof(config_t, field), \
+   sizeof(config_t::field[0]), NULL, def, min, max, NULL, since}
+
+constexpr cfgField_t configFields[] = {
+  STR_FIELD(  1, cgName,   "host",    csHostname,     HOSTNAME_SZ,     0,                  HOSTNAME,          isValidHostname),
+  STR_FIELD(  1, cgName,   "device",  csDevname,      HOST_SZ,         CF_REST,            DEVICENAME,        NULL),
+  STR_FIELD(  1, cgWifi,   "ssid",    csWifiSsid,     HOST_SZ,         0,                  WIFI_SSID,         NULL),
+  STR_FIELD(  1, cgWifi,   "pswd",    csWifiPswd,     PSWD_SZ,         CF_SECRET,          WIFI_PSWD,         isValidPassword),
+  IP_FIELD(   1, cgStaip,  "ip",      staStaticIP,    CF_CLEAR,        STA_STATIC_IP),
+  IP_FIELD(   1, cgStaip,  "gateway", staGateway,     CF_CLEAR,        STA_GATEWAY),
+  IP_FIELD(   1, cgStaip,  "mask",    staNetmask,     CF_CLEAR,        STA_NETMASK),
+  STR_FIELD(  2, cgAp,     "suffix",  csApSuffix,     AP_SUFFIX_SZ,    CF_CLEAR,           AP_SUFFIX,         NULL),
+  STR_FIELD(  2, cgAp,     "pswd",    csApPswd,       PSWD_SZ,         CF_CLEAR|CF_SECRET, AP_PSWD,           NULL),
+  IP_FIELD(   2, cgApip,   "ip",      apIP,           CF_CLEAR,        AP_IP),
+  IP_FIELD(   2, cgApip,   "mask",    apMask,         CF_CLEAR,        AP_MASK),
+  IP_FIELD(   1, cgSyslog, "ip",      syslogIP,       0,               SYSLOG_HOST),
+  NUM_FIELD(  1, cgSyslog, "port",    ctUint16,       syslogPort,      0,                  SYSLOG_PORT,       1,   0xFFFF),
+  STR_FIELD(  1, cgDmtz,   "host",    csDmtzHost,     HOST_SZ,         0,                  DMTZ_HOST,         NULL),
+  NUM_FIELD(  1, cgDmtz,   "port",    ctUint16,       dmtzPort,        0,                  DMTZ_PORT,         1,   0xFFFF),
+  STR_FIELD(  1, cgDmtz,   "user",    csDmtzUser,     USER_SZ,         CF_CLEAR|CF_CRED,   DMTZ_USER,         NULL),
+  STR_FIELD(  1, cgDmtz,   "pswd",    csDmtzPswd,     PSWD_SZ,         CF_CLEAR|CF_SECRET, DMTZ_PSWD,         isValidPassword),
+  NUM_FIELD(  1, cgIdx,    "switch",  ctUint16,       dmtzSwitchIdx,   0,                  DMTZ_SWITCH_IDX,   0,   0xFFFF),
+  NUM_FIELD(  1, cgIdx,    "temp",    ctUint16,       dmtzTHSIdx,      0,                  DMTZ_THS_IDX,      0,   0xFFFF),
+  NUM_FIELD(  1, cgIdx,    "lux",     ctUint16,       dmtzLSIdx,       0,                  DMTZ_LS_IDX,       0,   0xFFFF),
+  NUM_FIELD(  1, cgTime,   "http",    ctUint32,       dmtzReqTimeout,  0,                  DMTZ_TIMEOUT,      1,   UINT32_MAX),
+  STR_FIELD(  3, cgTopic,  "pub",     csTopicDmtzPub, MQTT_TOPIC_SZ,   0,                  DMTZ_PUB_TOPIC,    NULL),
+  STR_FIELD(  3, cgTopic,  "sub",     csTopicDmtzSub, MQTT_TOPIC_SZ,   0,                  DMTZ_SUB_TOPIC,    NULL),
+  STR_FIELD(  3, cgTopic,  "log",     csTopicLog,     MQTT_TOPIC_SZ,   0,                  MQTT_LOG_TOPIC,    NULL),
+  STR_FIELD(  3, cgTopic,  "cmd",     csTopicCmd,     MQTT_TOPIC_SZ,   0,                  MQTT_CMD_TOPIC,    NULL),
+  STR_FIELD(  1, cgMqtt,   "host",    csMqttHost,     HOST_SZ,         0,                  MQTT_HOST,         NULL),
+  NUM_FIELD(  1, cgMqtt,   "port",    ctUint16,       mqttPort,        0,                  MQTT_PORT,         1,   0xFFFF),
+  STR_FIELD(  1, cgMqtt,   "user",    csMqttUser,     USER_SZ,         CF_CLEAR|CF_CRED,   MQTT_USER,         NULL),
+  STR_FIELD(  1, cgMqtt,   "pswd",    csMqttPswd,     PSWD_SZ,         CF_CLEAR|CF_SECRET, MQTT_PSWD,         NULL),
+  NUM_FIELD(  1, cgMqtt,   "buffer",  ctUint16,       mqttBufferSize,  CF_NOCMD,           MQTT_BUFFER_SIZE,  256, 0xFFFF),
+  NUM_FIELD(  1, cgTime,   "poll",    ctUint16,       hdwPollTime,     0,                  HDW_POLL_TIME,     1,   0xFFFF),
+  NUM_FIELD(  1, cgTime,   "update",  ctUint32,       sensorUpdtTime,  0,                  SENSOR_UPDT_TIME,  1,   UINT32_MAX),
+  NUM_FIELD(  2, cgTime,   "ap",      ctUint32,       apDelayTime,     0,                  AP_DELAY_TIME,     1,   UINT32_MAX),
+  NUM_FIELD(  4, cgTime,   "budget",  ctUint32,       sendBudget,      0,                  SEND_BUDGET,       1,   UINT32_MAX),
+  NUM_FIELD(  1, cgLog,    "uart",    ctLevel,        logLevelUart,    0,                  LOG_LEVEL_UART,    0,   LOG_LEVEL_COUNT-1),
+  NUM_FIELD(  1, cgLog,    "syslog",  ctLevel,        logLevelSyslog,  0,                  LOG_LEVEL_SYSLOG,  0,   LOG_LEVEL_COUNT-1),
+  NUM_FIELD(  1, cgLog,    "webc",    ctLevel,        logLevelWebc,    0,                  LOG_LEVEL_WEBC,    0,   LOG_LEVEL_COUNT-1),
+  NUM_FIELD(  1, cgLog,    "mqtt",    ctLevel,        logLevelMqtt,    0,                  LOG_LEVEL_MQTT,    0,   LOG_LEVEL_COUNT-1),
+  NUM_FIELD(  5, cgLog,    "repeat",  ctUint32,       logRepeatWindow, 0,                  LOG_REPEAT_WINDOW, 0,   UINT32_MAX),
+  ARRAY_FIELD(5, cgLog,    "rate",    ctUint16,       logRate,         CF_NOCMD,           LOG_RATE,          0,   0xFFFF),
+  ARRAY_FIELD(5, cgLog,    "burst",   ctUint8,        logBurst,        CF_NOCMD,           LOG_BURST,         1,   0xFF),
+  NUM_FIELD(  7, cgTime,   "save",    ctUint32,       saveDelay,       0,                  SAVE_DELAY,        0,   UINT32_MAX),
+  STR_FIELD(  9, cgTopic,  "result",  csTopicResult,  MQTT_TOPIC_SZ,   0,                  MQTT_RESULT_TOPIC, NULL)
+};
+
+constexpr int CONFIG_FIELD_COUNT = sizeof(configFields) / sizeof(cfgField_t);
+
+// Compile time checks of the table: the size of numeric fields must match their type,
+// the strings must be in the order of cfgString_t and all the default strings must
+// fit in the string pool.
+
+constexpr size_t typeSize(cfgType_t type) {
+  return (type == ctUint8 || type == ctLevel) ? 1 : (type == ctUint16) ? 2 : 4;
 }
 
-void defaultAp(void) {
-  strlcpy(config.apSuffix, AP_SUFFIX, AP_SUFFIX_SZ);
-  strlcpy(config.apPswd, AP_PSWD, PSWD_SZ);
+constexpr size_t cstrlen(const char *s) {
+  return (*s) ? 1 + cstrlen(s + 1) : 0;
 }
 
-void defaultApip(void) {
-  IPAddress ip;
-  if (ip.fromString(AP_IP))
-    config.apIP = ip;
-  else
-    config.apIP = 0;
-  if (ip.fromString(AP_MASK))
-    config.apMask = ip;
-  else
-    config.apMask = 0;
+  // number of strings before field i
+constexpr int stringCount(int i) {
+  return (i == 0) ? 0 : stringCount(i - 1) + (configFields[i-1].type == ctString);
+}
+
+  // size in the string pool of the default strings of the fields before field i
+constexpr size_t defaultPoolSize(int i) {
+  return (i == 0) ? 0 : defaultPoolSize(i - 1)
+    + ((configFields[i-1].type == ctString) ? cstrlen(configFields[i-1].defString) + 2 : 0);
 }
 
-void defaultDmtz(void) {
-  strlcpy(config.dmtzHost, DMTZ_HOST, HOST_SZ);
-  config.dmtzPort = DMTZ_PORT;
-  strlcpy(config.dmtzUser, DMTZ_USER, USER_SZ);
-  strlcpy(config.dmtzPswd, DMTZ_PSWD, PSWD_SZ);
+constexpr bool fieldsValid(int i = 0) {
+  return (i >= CONFIG_FIELD_COUNT)
+    ? (stringCount(i) == CONFIG_STRING_COUNT) && (defaultPoolSize(i) <= CONFIG_POOL_SZ)
+    : ((configFields[i].type == ctString)
+        ? (configFields[i].offset == stringCount(i)) && (cstrlen(configFields[i].defString) < configFields[i].size)
+        : configFields[i].size == typeSize(configFields[i].type))
+      && fieldsValid(i + 1);
 }
 
-void defaultIdx(void) {
-  config.dmtzSwitchIdx = DMTZ_SWITCH_IDX;
-  config.dmtzTHSIdx = DMTZ_THS_IDX;
-  config.dmtzLSIdx = DMTZ_LS_IDX;
+static_assert(fieldsValid(), "configFields[] does not match config_t");
+
+// Layout of the config_t of an older version
+//
+// The config_t of version v is made of the magic number and version, the fields of
+// the table added in version v or before with the natural alignment of their type,
+// the string pool from CONFIG_POOL_VERSION on, and the checksum. It is computed from
+// the table so that a config saved by an older firmware can be upgraded, and checked
+// at compile time against the current config_t.
+
+#define CONFIG_POOL_VERSION 8   // first version with the string pool
+
+constexpr size_t alignUp(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+constexpr size_t fieldAlign(int i) {
+  return (configFields[i].type == ctString) ? 1 : configFields[i].size;
+}
+
+  // true if field i is in the config_t of version, outside of the string pool
+constexpr bool fieldInLayout(int i, int version) {
+  return (configFields[i].since <= version)
+    && ((configFields[i].type != ctString) || (version < CONFIG_POOL_VERSION));
+}
+
+constexpr size_t layoutOffset(int i, int version);
+
+  // end of the fields before field i in the config_t of version
+constexpr size_t layoutEnd(int i, int version) {
+  return (i == 0) ? 2*sizeof(uint16_t)
+    : (!fieldInLayout(i - 1, version)) ? layoutEnd(i - 1, version)
+    : layoutOffset(i - 1, version) + configFields[i-1].size*configFields[i-1].count;
+}
+
+  // offset of field i in the config_t of version, meaningless if the field is not in it
+constexpr size_t layoutOffset(int i, int version) {
+  return alignUp(layoutEnd(i, version), fieldAlign(i));
 }
 
-void defaultLogLevels(void) {
-  config.logLevelUart   = LOG_LEVEL_UART;
-  config.logLevelSyslog = LOG_LEVEL_SYSLOG;
-  config.logLevelWebc = LOG_LEVEL_WEBC;
-  config.logLevelMqtt = LOG_LEVEL_MQTT;
+  // offset of the string pool in the config_t of version
+constexpr size_t layoutPool(int version) {
+  return layoutEnd(CONFIG_FIELD_COUNT, version);
 }
 
-void defaultMqtt(void) {
-  strlcpy(config.mqttHost, MQTT_HOST, HOST_SZ);
-  config.mqttPort = MQTT_PORT;
-  strlcpy(config.mqttUser, MQTT_USER, USER_SZ);
-  strlcpy(config.mqttPswd, MQTT_PSWD, PSWD_SZ);
-  config.mqttBufferSize = MQTT_BUFFER_SIZE;
+  // size of the config_t of version, including the checksum
+constexpr size_t layoutSize(int version) {
+  return alignUp(layoutPool(version) + ((version >= CONFIG_POOL_VERSION) ? CONFIG_POOL_SZ : 0), sizeof(uint32_t))
+    + sizeof(uint32_t);
 }
 
-void defaultSyslog(void) {
-  //strlcpy(config.syslogHost, SYSLOG_HOST, IP_SZ);
-  IPAddress ipa;
-  if (ipa.fromString(SYSLOG_HOST))
-    config.syslogIP = ipa;
+constexpr bool layoutValid(int i = 0) {
+  return (i >= CONFIG_FIELD_COUNT)
+    ? (layoutSize(CONFIG_VERSION) == sizeof(config_t)) && (layoutPool(CONFIG_VERSION) == offsetof(config_t, strings))
+    : (configFields[i].since >= 1) && (configFields[i].since <= CONFIG_VERSION)
+      && ((configFields[i].type == ctString) || (layoutOffset(i, CONFIG_VERSION) == configFields[i].offset))
+      && layoutValid(i + 1);
+}
+
+static_assert(layoutValid(), "configFields[] is not in the order of config_t");
+
+  // size of the largest config_t of the versions from version on
+constexpr size_t layoutMax(int version, size_t size = 0) {
+  return (version > CONFIG_VERSION) ? size
+    : layoutMax(version + 1, (layoutSize(version) > size) ? layoutSize(version) : size);
+}
+
+constexpr size_t CONFIG_IMAGE_MAX = layoutMax(1);
+
+static void reconnectNotice(void) {
+  addToLogP(LOG_INFO, TAG_CONFIG, PSTR("Any change will take effect on the next connection to the network"));
+}
+
+static bool checkStaip(const uint32_t *values) {
+  // ip, gateway, mask, the gateway is not checked if the IP is 0 (DHCP)
+  if ((values[0]) && ((values[0] & values[2]) != (values[1] & values[2]))) {
+    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("The station IP and gateway are not on the same subnet"));
+    return false;
+  }
+  return true;
+}
+
+const cfgGroupInfo_t configGroups[CONFIG_GROUP_COUNT] = {
+  /* cgName   */ {"name",   GF_NAMED, "hn", NULL,       reconnectNotice},
+  /* cgWifi   */ {"wifi",   GF_RESET, NULL, NULL,       reconnectNotice},
+  /* cgStaip  */ {"staip",  GF_ALL,   NULL, checkStaip, reconnectNotice},
+  /* cgAp     */ {"ap",     GF_RESET, NULL, NULL,       NULL},
+  /* cgApip   */ {"apip",   GF_ALL,   NULL, NULL,       NULL},
+  /* cgSyslog */ {"syslog", 0,        NULL, NULL,       NULL},
+  /* cgDmtz   */ {"dmtz",   0,        NULL, NULL,       NULL},
+  /* cgIdx    */ {"idx",    GF_NAMED, NULL, NULL,       NULL},
+  /* cgTime   */ {"time",   GF_NAMED, NULL, NULL,       NULL},
+  /* cgTopic  */ {"topic",  GF_NAMED, NULL, NULL,       mqttDisconnect},  // so that the new topics are used
+  /* cgMqtt   */ {"mqtt",   0,        NULL, NULL,       NULL},
+  /* cgLog    */ {"log",    GF_NAMED, NULL, NULL,       logLevelsChanged}
+};
+
+static uint8_t *fieldPtr(const cfgField_t &field, int index) {
+  return (uint8_t *) &config + field.offset + index*field.size;
+}
+
+static uint32_t getValue(const cfgField_t &field, int index) {
+  const uint8_t *p = fieldPtr(field, index);
+  switch (field.size) {
+    case 1:  return *p;
+    case 2:  return *(const uint16_t *) p;
+    default: return *(const uint32_t *) p;
+  }
+}
+
+static void setValue(const cfgField_t &field, int index, uint32_t value) {
+  uint8_t *p = fieldPtr(field, index);
+  switch (field.size) {
+    case 1:  *p = value; break;
+    case 2:  *(uint16_t *) p = value; break;
+    default: *(uint32_t *) p = value; break;
+  }
+}
+
+cfgGroup_t configFindGroup(const char *name) {
+  int group = 0;
+  while ((group < CONFIG_GROUP_COUNT) && (strcasecmp(name, configGroups[group].name)))
+    group++;
+  return (cfgGroup_t) group;
+}
+
+const cfgField_t *configFindField(cfgGroup_t group, const char *name) {
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if ((configFields[i].group == group) && (!strcasecmp(name, configFields[i].name)))
+      return &configFields[i];
+  }
+  return NULL;
+}
+
+// Called when config is changed by the functions below so that it is saved after
+// config.saveDelay ms without any other change, see configLoop()
+static void configChanged(void) {
+  savePending = true;
+  changeTime = millis();
+}
+
+// The string pool, the entry of a string is its length in a byte, its characters
+// and a terminating 0
+
+// The strings of the pool are only changed in loop(), which uses configString(). The
+// other tasks copy them with configCopyString(), which starts again if they were
+// changed during the copy: poolSeq is odd while the pool is being changed.
+static uint32_t poolSeq = 0;
+static int poolWriters = 0;     // nesting of poolWriteBegin()
+
+static void poolWriteBegin(void) {
+  if (!poolWriters++)
+    __atomic_store_n(&poolSeq, poolSeq + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void poolWriteEnd(void) {
+  if (!--poolWriters)
+    __atomic_store_n(&poolSeq, poolSeq + 1, __ATOMIC_RELEASE);
+}
+
+static char *poolEntry(cfgString_t id) {
+  char *entry = config.strings;
+  for (int k = 0; k < id; k++)
+    entry += (uint8_t) *entry + 2;
+  return entry;
+}
+
+  // number of bytes used by the strings
+static size_t poolUsed(void) {
+  return poolEntry(CONFIG_STRING_COUNT) - config.strings;
+}
+
+const char *configString(cfgString_t id) {
+  return poolEntry(id) + 1;
+}
+
+size_t configCopyString(cfgString_t id, char *buf, size_t size) {
+  const char *end = config.strings + CONFIG_POOL_SZ;
+  uint32_t seq;
+  size_t len;
+  do {
+    while ((seq = __atomic_load_n(&poolSeq, __ATOMIC_ACQUIRE)) & 1)
+      delay(1);     // let loop() finish the change
+    // the lengths can be torn by a change, stay in the pool
+    const char *entry = config.strings;
+    for (int k = 0; (k < id) && (entry < end); k++)
+      entry += (uint8_t) *entry + 2;
+    len = (entry < end) ? (uint8_t) *entry : 0;
+    if (entry + len + 1 >= end)
+      len = 0;
+    if (len >= size)
+      len = size - 1;
+    memcpy(buf, entry + 1, len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&poolSeq, __ATOMIC_RELAXED) != seq);
+  buf[len] = 0;
+  return len;
+}
+
+bool configSetString(cfgString_t id, const char *value) {
+  char copy[UINT8_MAX + 1];
+  size_t len = strlen(value);
+  if (len > UINT8_MAX)
+    return false;
+  memcpy(copy, value, len + 1);   // value can be in the pool
+  char *entry = poolEntry(id);
+  size_t old = (uint8_t) *entry;
+  size_t used = poolUsed();
+  if (used + len > CONFIG_POOL_SZ + old)
+    return false;
+  char *next = entry + old + 2;
+  poolWriteBegin();
+  memmove(entry + len + 2, next, config.strings + used - next);
+  if (len < old)
+    memset(config.strings + used - (old - len), 0, old - len);   // keep the unused end at 0
+  *entry = len;
+  memcpy(entry + 1, copy, len + 1);
+  poolWriteEnd();
+  configChanged();
+  return true;
+}
+
+int configPoolDelta(const cfgField_t &field, const char *text) {
+  return (field.type == ctString) ? (int) strlen(text) - (uint8_t) *poolEntry((cfgString_t) field.offset) : 0;
+}
+
+bool configPoolFits(int delta) {
+  size_t used = poolUsed();
+  if ((int) used + delta <= CONFIG_POOL_SZ)
+    return true;
+  addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("No room for %d more bytes in the config string pool (%u of %d bytes used)"),
+    delta, (unsigned) used, CONFIG_POOL_SZ);
+  return false;
+}
+
+  // true if the string pool holds CONFIG_STRING_COUNT strings followed by 0
+static bool poolValid(void) {
+  const char *entry = config.strings;
+  const char *end = config.strings + CONFIG_POOL_SZ;
+  for (int k = 0; k < CONFIG_STRING_COUNT; k++) {
+    size_t len = (uint8_t) *entry;
+    if ((entry + len + 2 > end) || (memchr(entry + 1, 0, len)) || (entry[len + 1]))
+      return false;
+    entry += len + 2;
+  }
+  while ((entry < end) && (!*entry))
+    entry++;
+  return entry == end;
+}
+
+static void defaultField(const cfgField_t &field) {
+  if (field.type == ctString) {
+    if (!configSetString((cfgString_t) field.offset, field.defString)) {
+      addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("No room for the default %s %s in the config string pool"), configGroups[field.group].name, field.name);
+      configSetString((cfgString_t) field.offset, "");
+    }
+  } else if (field.type == ctIP) {
+    IPAddress ip;
+    setValue(field, 0, (ip.fromString(field.defString)) ? (uint32_t) ip : 0);
+  } else {
+    for (int k = 0; k < field.count; k++)
+      setValue(field, k, field.defValue);
+  }
+}
+
+void configDefault(cfgGroup_t group) {
+  configChanged();
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if ((configFields[i].group == group) || (group == CONFIG_GROUP_COUNT))
+      defaultField(configFields[i]);
+  }
+}
+
+void configClear(const cfgField_t &field) {
+  configChanged();
+  if (field.type == ctString)
+    configSetString((cfgString_t) field.offset, "");
   else
-    config.syslogIP = 0;
-  config.syslogPort = SYSLOG_PORT;
+    memset(fieldPtr(field, 0), 0, field.size*field.count);
 }
 
-void defaultTimes(void) {
-  config.dmtzReqTimeout = DMTZ_TIMEOUT;
-  config.hdwPollTime = HDW_POLL_TIME;
-  config.sensorUpdtTime = SENSOR_UPDT_TIME;
-  config.apDelayTime = AP_DELAY_TIME;
+extern const char *logLevelString[];
+
+bool configParse(const cfgField_t &field, const char *text, uint32_t *value) {
+  uint32_t v = 0;
+  switch (field.type) {
+    case ctString:
+      return (strlen(text) < field.size) && ((!field.check) || (field.check(text)));
+    case ctIP: {
+      IPAddress ip;
+      if (!ip.fromString(text))
+        return false;
+      v = ip;
+      break;
+    }
+    case ctLevel: {
+      int level = 0;
+      while ((level < LOG_LEVEL_COUNT) && (strcasecmp(text, logLevelString[level])))
+        level++;
+      if ((level >= LOG_LEVEL_COUNT) && (text[0] >= '0') && (text[0] <= '9') && (!text[1]))
+        level = text[0] - '0';
+      v = level;
+      break;
+    }
+    default: {
+      char *end;
+      if ((*text < '0') || (*text > '9'))
+        return false;
+      errno = 0;
+      unsigned long n = strtoul(text, &end, 10);
+      if ((*end) || (errno == ERANGE) || (n > field.max))
+        return false;
+      v = n;
+      break;
+    }
+  }
+  if ((field.type != ctIP) && ((v < field.min) || (v > field.max)))
+    return false;
+  if (value)
+    *value = v;
+  return true;
 }
 
-void defaultTopics(void) {
-  strlcpy(config.topicDmtzPub, DMTZ_PUB_TOPIC, MQTT_TOPIC_SZ);
-  strlcpy(config.topicDmtzSub, DMTZ_SUB_TOPIC, MQTT_TOPIC_SZ);
-  strlcpy(config.topicLog, MQTT_LOG_TOPIC, MQTT_TOPIC_SZ);
-  strlcpy(config.topicCmd, MQTT_CMD_TOPIC, MQTT_TOPIC_SZ);
+bool configSet(const cfgField_t &field, const char *text, int index) {
+  uint32_t value;
+  if ((index < 0) || (index >= field.count) || (!configParse(field, text, &value)))
+    return false;
+  if (field.type == ctString) {
+    if ((!configPoolFits(configPoolDelta(field, text))) || (!configSetString((cfgString_t) field.offset, text)))
+      return false;
+  } else
+    setValue(field, index, value);
+  configChanged();
+  return true;
 }
 
-uint32_t getConfigHash() {
+size_t configGet(const cfgField_t &field, char *buf, size_t size, int index) {
+  if (!size)
+    return 0;
+  uint32_t value = (field.type == ctString) ? 0 : getValue(field, index);
+  int n;
+  switch (field.type) {
+    case ctString:
+      n = configCopyString((cfgString_t) field.offset, buf, size);
+      break;
+    case ctIP:
+      n = snprintf(buf, size, "%u.%u.%u.%u", value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24);
+      break;
+    case ctLevel:
+      n = snprintf(buf, size, "%s", (value < LOG_LEVEL_COUNT) ? logLevelString[value] : "unknown");
+      break;
+    default:
+      n = snprintf(buf, size, "%u", (unsigned) value);
+      break;
+  }
+  return ((size_t) n < size) ? n : size - 1;
+}
+
+// Replaces the fields of a config loaded from NVS that are not valid with their default
+static void configValidate(void) {
+  char buf[HOST_SZ];
+  if (!poolValid()) {
+    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Invalid string pool in config, using the default strings"));
+    memset(config.strings, 0, CONFIG_POOL_SZ);
+    for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+      if (configFields[i].type == ctString)
+        defaultField(configFields[i]);
+    }
+  }
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const cfgField_t &field = configFields[i];
+    bool valid = true;
+    for (int k = 0; valid && k < field.count; k++) {
+      if (field.type == ctString) {
+        const char *s = configString((cfgString_t) field.offset);
+        valid = (strlen(s) < field.size) && ((!field.check) || (field.check(s)));
+      } else if (field.type != ctIP) {
+        configGet(field, buf, sizeof(buf), k);
+        valid = configParse(field, buf);
+      }
+    }
+    if (!valid) {
+      addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Invalid %s %s in config, using its default"), configGroups[field.group].name, field.name);
+      defaultField(field);
+    }
+  }
+}
+
+#define CONFIG_CRC_VERSION 6   // first version checked with a CRC-32
+
+// Checksum of the config saved by the firmware of CONFIG_CRC_VERSION and later
+static uint32_t configCrc(void) {
+  return crc32Update(0, &config, offsetof(config_t, checksum));
+}
+
+// Checksum of the config saved by older firmware, a weighted sum of the bytes
+// before the checksum at the end of the len bytes of the image
+static uint32_t configLegacyHash(const uint8_t *image, size_t len) {
   uint32_t hash = 0;
-  uint8_t *bytes = (uint8_t*)&config;
 
-  for (uint16_t i = 0; i < sizeof(config_t) - sizeof(config.checksum); i++)
-    hash += bytes[i]*(i+1);
+  for (size_t i = 0; i < len - sizeof(uint32_t); i++)
+    hash += image[i]*(i+1);
   return hash;
 }
 
+// Upgrades the image of a config from version - 1 to version, prev is a copy of
+// the image of version - 1. The fields added in version are cleared and the
+// strings are gathered in the string pool at CONFIG_POOL_VERSION. A conversion of
+// the values of a version would be done here.
+static void upgradeStep(uint8_t *image, const uint8_t *prev, int version) {
+  uint16_t v = version;
+  memset(image + 2*sizeof(uint16_t), 0, CONFIG_IMAGE_MAX - 2*sizeof(uint16_t));
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if ((fieldInLayout(i, version)) && (configFields[i].since < version))
+      memcpy(image + layoutOffset(i, version), prev + layoutOffset(i, version - 1), configFields[i].size*configFields[i].count);
+  }
+  char *pool = (char *) image + layoutPool(version);
+  if (version > CONFIG_POOL_VERSION)
+    memcpy(pool, prev + layoutPool(version - 1), CONFIG_POOL_SZ);
+  else if (version == CONFIG_POOL_VERSION) {
+    size_t used = 0;
+    for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+      const cfgField_t &field = configFields[i];
+      if (field.type != ctString)
+        continue;
+      const char *s = (field.since < version) ? (const char *) prev + layoutOffset(i, version - 1) : "";
+      size_t len = strnlen(s, field.size - 1);
+      // keep room for the entries of the strings that follow
+      if (used + len + 2*(CONFIG_STRING_COUNT - field.offset) > CONFIG_POOL_SZ) {
+        addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("No room for %s %s in the config string pool, cleared"), configGroups[field.group].name, field.name);
+        len = 0;
+      }
+      pool[used] = len;
+      memcpy(pool + used + 1, s, len);
+      used += len + 2;
+    }
+  }
+  memcpy(image + offsetof(config_t, version), &v, sizeof(v));
+}
+
+// Upgrades the image of a config of an older version to CONFIG_VERSION and copies it
+// to config, the fields that did not exist in that version are set to their default.
+// Returns false if there is not enough memory.
+static bool upgradeConfig(uint8_t *image, int from) {
+  uint8_t *prev = (uint8_t *) malloc(CONFIG_IMAGE_MAX);
+  if (!prev) {
+    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Not enough memory to upgrade the config"));
+    return false;
+  }
+  for (int version = from + 1; version <= CONFIG_VERSION; version++) {
+    memcpy(prev, image, CONFIG_IMAGE_MAX);
+    upgradeStep(image, prev, version);
+  }
+  free(prev);
+  memcpy(&config, image, sizeof(config_t));
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (configFields[i].since > from)
+      defaultField(configFields[i]);
+  }
+  addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Upgraded config from version %d to version %d"), from, CONFIG_VERSION);
+  return true;
+}
+
 void useDefaultConfig(void) {
+  poolWriteBegin();
   memset(&config, 0x00, sizeof(config_t));
   config.magic = CONFIG_MAGIC;
   config.version = CONFIG_VERSION;
 
 // -- start of user settings
-  defaultNames();
-  defaultWifiNetwork();
-  defaultStaticStaIp();
-  defaultAp();
-  defaultApip();
-  defaultSyslog();
-  defaultDmtz();
-  defaultIdx();
-  defaultTopics();
-  defaultMqtt();
-  defaultTimes();
-  defaultLogLevels();
+  configDefault(CONFIG_GROUP_COUNT);
 // end of user settings --
+  poolWriteEnd();
 
-  config.checksum = getConfigHash();
+  config.checksum = configCrc();
+  logLevelsChanged();
   addToLogP(LOG_INFO, TAG_CONFIG, PSTR("Using default configuration"));
 }
 
+static void pageKey(char *key, int slot, size_t page) {
+  snprintf(key, 8, "cfg%c%u", 'A' + slot, (unsigned) page);
+}
+
+static void headerKey(char *key, int slot) {
+  snprintf(key, 8, "cfg%c", 'A' + slot);
+}
+
+static size_t pageSize(size_t page) {
+  return (page < CONFIG_PAGES - 1) ? CONFIG_PAGE_SZ : sizeof(config_t) - page*CONFIG_PAGE_SZ;
+}
+
+// Writes the pages of config that changed, or all of them if all is true, then the header
+// to the next slot, the one which does not hold the last saved config. After a full save
+// the stale pages of a larger config of an older version are removed from the slot.
+// Returns false if the config could not be saved.
+static bool savePages(bool all) {
+  char key[8];
+  int slot = (activeSlot + 1) % CONFIG_SLOTS;
+  size_t pages = 0;
+  size_t bytes = 0;
+  bool ok = true;
+  uint32_t start = micros();
+  preferences.begin("md", false); // open read/write
+  for (size_t page = 0; page < CONFIG_PAGES; page++) {
+    size_t offset = page*CONFIG_PAGE_SZ;
+    size_t size = pageSize(page);
+    const uint8_t *data = (const uint8_t *) &config + offset;
+    uint8_t *saved = (uint8_t *) &slotConfig[slot] + offset;
+    if ((!all) && (slotValid[slot]) && (!memcmp(data, saved, size)))
+      continue;
+    pageKey(key, slot, page);
+    if (preferences.putBytes(key, data, size) == size) {
+      memcpy(saved, data, size);
+      pages++;
+      bytes += size;
+    } else
+      ok = false;
+  }
+  slotHeader_t header = {slotHeader[activeSlot].sequence + 1, config.checksum};
+  headerKey(key, slot);
+  if ((ok) && (preferences.putBytes(key, &header, sizeof(header)) != sizeof(header)))
+    ok = false;
+  if ((ok) && ((all) || (!slotValid[slot]))) {
+    for (size_t page = CONFIG_PAGES; page < CONFIG_MAX_PAGES; page++) {
+      pageKey(key, slot, page);
+      preferences.remove(key);
+    }
+  }
+  preferences.end();
+  uint32_t elapsed = micros() - start;
+  nvsWrites += pages;
+  if (ok) {
+    slotValid[slot] = true;
+    slotHeader[slot] = header;
+    activeSlot = slot;
+    addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Saved %u of %u config pages (%u bytes) to NVS slot %c in %u us, %u pages written since boot"),
+      (unsigned) pages, (unsigned) CONFIG_PAGES, (unsigned) bytes, 'A' + slot, (unsigned) elapsed, (unsigned) nvsWrites);
+  } else {
+    slotValid[slot] = false;  // rewrite everything next time
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Could not save config to NVS slot %c, %u of %u pages written"), 'A' + slot, (unsigned) pages, (unsigned) CONFIG_PAGES);
+  }
+  return ok;
+}
+
 void saveConfig(bool force) {
-  uint32_t hash = getConfigHash();
-  if ((force) || (hash != config.checksum)) {
-    config.checksum = hash;
-    preferences.begin("md", false); // open read/write
-    preferences.clear();
-    size_t len = preferences.putBytes("config", (const void*) &config, sizeof(config_t));
-    preferences.end();
-    if (len == sizeof(config_t))
-      addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Saved config (%d bytes) to NVS"), len);
-    else
-      addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Saved %d bytes to NVS while config is %d bytes"), len, sizeof(config_t));
+  uint32_t crc = configCrc();
+  if ((force) || (crc != config.checksum)) {
+    uint32_t checksum = config.checksum;
+    config.checksum = crc;    // the checksum is saved with the last page
+    if (!savePages(force)) {
+      config.checksum = checksum;
+      configChanged();        // tried again after config.saveDelay
+      return;
+    }
   }
+  savePending = false;
 }
 
-bool loadConfigFromNVS(void) {
-  preferences.begin("md", true); // open read-only
-  //config.checksum = getConfigHash();
-  size_t len = preferences.getBytes("config", (void*) &config, sizeof(config_t));
-  preferences.end();
-  if (len == sizeof(config_t))
-    addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Loaded config (%d bytes) from NVS"), len);
-  else {
-    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Loaded %d bytes from NVS expected %d bytes"), len, sizeof(config_t));
+void configLoop(void) {
+  if ((savePending) && (config.saveDelay) && (millis() - changeTime >= config.saveDelay))
+    saveConfig();
+}
+
+// Reads the pages with the key format (one %u for the page number) into the image of
+// CONFIG_IMAGE_MAX bytes, up to the size of the config_t of the version in the first
+// page. Returns the number of bytes read.
+static size_t readPages(const char *format, uint8_t *image) {
+  char key[8];
+  size_t len = 0;
+  size_t end = CONFIG_IMAGE_MAX;
+  memset(image, 0, CONFIG_IMAGE_MAX);
+  for (size_t page = 0; len < end; page++) {
+    snprintf(key, sizeof(key), format, (unsigned) page);
+    size_t size = preferences.getBytesLength(key);
+    if ((!size) || (size > CONFIG_PAGE_SZ) || (len + size > end))
+      break;
+    len += preferences.getBytes(key, image + len, size);
+    if (page == 0) {
+      uint16_t version;
+      memcpy(&version, image + offsetof(config_t, version), sizeof(version));
+      if ((len >= 2*sizeof(uint16_t)) && (version >= 1) && (version <= CONFIG_VERSION))
+        end = layoutSize(version);
+    }
+    if (size < CONFIG_PAGE_SZ)
+      break;   // last page of the config
+  }
+  return len;
+}
+
+// Returns the checksum at the end of the len bytes of the image read from NVS
+static uint32_t storedChecksum(const uint8_t *image, size_t len) {
+  uint32_t checksum;
+  memcpy(&checksum, image + len - sizeof(uint32_t), sizeof(uint32_t));
+  return checksum;
+}
+
+// Checks the len bytes of the image read from NVS. The config can be of an older version.
+static bool checkConfig(const uint8_t *image, size_t len, bool quiet) {
+  uint16_t magic, version;
+  memcpy(&magic, image + offsetof(config_t, magic), sizeof(magic));
+  memcpy(&version, image + offsetof(config_t, version), sizeof(version));
+  if ((len < sizeof(magic) + sizeof(version)) || (magic != CONFIG_MAGIC)) {
+    if (!quiet)
+      addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("No valid config in NVS (%u bytes)"), (unsigned) len);
+    return false;
+  }
+  if ((version < 1) || (version > CONFIG_VERSION)) {
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Loaded config wrong version %d"), version);
     return false;
   }
-  if (config.version != CONFIG_VERSION) {
-    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Loaded config wrong version"));
+  if (len != layoutSize(version)) {
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Loaded %u bytes from NVS expected %u bytes for version %d"), (unsigned) len, (unsigned) layoutSize(version), version);
     return false;
   }
-  uint32_t check = getConfigHash();
-  if (check != config.checksum) {
+  uint32_t check = (version >= CONFIG_CRC_VERSION) ? crc32Update(0, image, len - sizeof(uint32_t)) : configLegacyHash(image, len);
+  if (storedChecksum(image, len) != check) {
     addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Wrong config checksum"));
     return false;
   }
   return true;
 }
 
+// Reads the slot into the image, returns its length if it is valid and 0 otherwise.
+// slotConfig[slot] is set if the slot holds a config of the current version.
+static size_t readSlot(int slot, uint8_t *image) {
+  char key[8];
+  char format[12];
+  slotValid[slot] = false;
+  headerKey(key, slot);
+  if (preferences.getBytes(key, &slotHeader[slot], sizeof(slotHeader_t)) != sizeof(slotHeader_t))
+    return 0;
+  snprintf(format, sizeof(format), "%s%%u", key);
+  size_t len = readPages(format, image);
+  if ((!checkConfig(image, len, true)) || (storedChecksum(image, len) != slotHeader[slot].checksum)) {
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Config in NVS slot %c is not valid"), 'A' + slot);
+    return 0;
+  }
+  if (len == sizeof(config_t)) {
+    memcpy(&slotConfig[slot], image, sizeof(config_t));
+    slotValid[slot] = true;
+  }
+  return len;
+}
+
+// Reads the most recent valid slot into the image, or the config saved by a previous
+// version of the firmware if there are no slots. Returns the length of the config,
+// 0 if none is found. *converted is set to true if the config was not read from a slot.
+static size_t readConfig(uint8_t *image, bool *converted) {
+  size_t len = 0;
+  *converted = false;
+  preferences.begin("md", true); // open read-only
+  int first = (readSlot(0, image)) ? 0 : -1;
+  if (readSlot(1, image)) {
+    if ((first < 0) || ((int32_t) (slotHeader[1].sequence - slotHeader[0].sequence) > 0))
+      first = 1;
+  }
+  if (first >= 0) {
+    activeSlot = first;
+    len = readSlot(first, image);  // again since the other slot was read last
+  } else {
+    activeSlot = CONFIG_SLOTS - 1;  // save to slot A
+    *converted = true;
+    len = readPages("cfg%u", image);
+    if (!len) {
+      size_t size = preferences.getBytesLength(CONFIG_LEGACY_KEY);
+      if ((size) && (size <= CONFIG_IMAGE_MAX))
+        len = preferences.getBytes(CONFIG_LEGACY_KEY, image, size);
+    }
+    if (!len)
+      *converted = false;
+  }
+  preferences.end();
+  return len;
+}
+
+// Removes the keys of the configs saved by previous versions of the firmware
+static void removeOldKeys(void) {
+  char key[8];
+  preferences.begin("md", false);
+  preferences.remove(CONFIG_LEGACY_KEY);
+  for (size_t page = 0; page < CONFIG_MAX_PAGES; page++) {
+    snprintf(key, sizeof(key), "cfg%u", (unsigned) page);
+    preferences.remove(key);
+  }
+  preferences.end();
+}
+
+bool loadConfigFromNVS(void) {
+  bool converted;
+  uint8_t *image = (uint8_t *) malloc(CONFIG_IMAGE_MAX);
+  if (!image) {
+    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Not enough memory to load the config"));
+    return false;
+  }
+  size_t len = readConfig(image, &converted);
+  bool ok = checkConfig(image, len, false);
+  uint16_t version = 0;
+  poolWriteBegin();
+  if (ok) {
+    memcpy(&version, image + offsetof(config_t, version), sizeof(version));
+    addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Loaded config version %d (%u bytes) from NVS"), version, (unsigned) len);
+    if (version < CONFIG_VERSION)
+      ok = upgradeConfig(image, version);
+    else
+      memcpy(&config, image, sizeof(config_t));
+  }
+  free(image);
+  if (ok)
+    configValidate();   // fields replaced by their default make the checksum wrong so that they are saved
+  poolWriteEnd();
+  if (!ok)
+    return false;
+  if ((converted) || (version < CONFIG_VERSION)) {
+    if (converted)
+      addToLogP(LOG_INFO, TAG_CONFIG, PSTR("Converting config in NVS to slots"));
+    saveConfig(true);
+    if ((converted) && (slotValid[activeSlot]))
+      removeOldKeys();
+  }
+  savePending = false;
+  return true;
+}
+
 void loadConfig(void) {
   if (!loadConfigFromNVS()) {
     useDefaultConfig();
     config.checksum = 0; // make sure it is saved to NVS when closing down
-    addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Loaded default configuration version %d, size %d"), config.version, sizeof(config_t));
+    addToLogPf(LOG_INFO, TAG_CONFIG, PSTR("Loaded default configuration version %d, size %u"), config.version, (unsigned) sizeof(config_t));
   }
+  logLevelsChanged();
+}
+
+//================ other data ================
+
+size_t configLoadData(const char *key, void *data, size_t size) {
+  preferences.begin("md", true); // open read-only
+  size_t len = preferences.getBytesLength(key);
+  if (len > size) {
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("%s in NVS larger than %u bytes ignored"), key, (unsigned) size);
+    len = 0;
+  } else if (len)
+    len = preferences.getBytes(key, data, len);
+  preferences.end();
+  return len;
+}
+
+bool configSaveData(const char *key, const void *data, size_t len) {
+  preferences.begin("md", false); // open read/write
+  bool ok = (len) ? preferences.putBytes(key, data, len) == len : (preferences.remove(key), true);
+  preferences.end();
+  if (ok)
+    nvsWrites++;
+  else
+    addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("Could not save %s to NVS"), key);
+  return ok;
 }
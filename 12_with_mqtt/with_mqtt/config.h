@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include "logging.h"     // for TAG_COUNT
 
 // Maximum number of characters in string including terminating 0
 
@@ -12,89 +13,222 @@
 #define AP_SUFFIX_SZ     12
 #define MQTT_TOPIC_SZ    65
 
+// Size of the pool that holds all the strings of the configuration
+#define CONFIG_POOL_SZ   512
+
 // Careful, changing any one of the above sizes will change
 // the configuration image size in non volatile memory
 
 #define CONFIG_MAGIC    0x4D45     // 'M'+'D'
-#define CONFIG_VERSION  3
-
+#define CONFIG_VERSION  9
+
+// Fields are only ever added to config_t, never removed or reordered, and each one
+// records the version that added it (see configFields[] in config.cpp) so that a
+// configuration saved by an older firmware can be upgraded. Up to version 7 the
+// strings were char arrays of the above sizes in config_t, at the place of their
+// entry in configFields[].
+//
+// History of CONFIG_VERSION
+//   1  first version saved in NVS (10_with_config)
+//   2  access point settings and apDelayTime (11_with_wm)
+//   3  MQTT topics
+//   4  sendBudget
+//   5  log filters: logRepeatWindow, logRate and logBurst
+//   6  checksum is a CRC-32 instead of a weighted sum of the bytes
+//   7  saveDelay, config saved in two alternating slots
+//   8  strings moved to the string pool
+//   9  MQTT topic of the command results
+
+// Strings of the configuration, in the order of the string pool
+enum cfgString_t {
+  csHostname,       // this device host name
+  csDevname,        // this device name in Web interface
+  csWifiSsid,       // WiFi network name
+  csWifiPswd,       // WiFi network password
+  csApSuffix,       // Access point SSID suffix
+  csApPswd,         // Access point password
+  csDmtzHost,       // IP or hostname of Domoticz server
+  csDmtzUser,       // Domoticz user name
+  csDmtzPswd,       // Domoticz password
+  csTopicDmtzPub,   // MQTT topic to publish messages to Domoticz
+  csTopicDmtzSub,   // MQTT topic to subscribe to messages from Domoticz
+  csTopicLog,       // MQTT topic of the log messages
+  csTopicCmd,       // MQTT topic of the commands
+  csMqttHost,       // IP/hostname of MQTT broker
+  csMqttUser,       // MQTT user name
+  csMqttPswd,       // MQTT password
+  csTopicResult,    // MQTT topic of the command results
+  CONFIG_STRING_COUNT
+};
 
 struct config_t {
   uint16_t magic;                     // check for valid config
   uint16_t version;                   // and version number
 
   // -- start of user settings
-  char hostname[HOSTNAME_SZ];         // this device host name
-  char devname[HOST_SZ];              // this device name in Web interface
-
-  char wifiSsid[HOST_SZ];             // WiFi network name
-  char wifiPswd[PSWD_SZ];             // WiFi network password
-
   uint32_t staStaticIP;               // Static IP, set to 0 for dhcp
   uint32_t staGateway;                //
   uint32_t staNetmask;                //
   //uint32_t staDnsIP1;               // not going beyond LAN yet
   //uint32_t staDnsIP2;               // ditto
 
-  char apSuffix[AP_SUFFIX_SZ];        // Access point SSID suffix
-  char apPswd[PSWD_SZ];               // Access point password
   uint32_t apIP;                      // Static IP of Access point
   uint32_t apMask;                    // Sub Net mask of AccessPoint
 
   uint32_t syslogIP;                  // Static IP of Syslog server (must be IPv4)
   uint16_t syslogPort;                // Syslog port
 
-  char dmtzHost[HOST_SZ];             // IP or hostname of Domoticz server
   uint16_t dmtzPort;                  // Domoticz server TCP port
-  char dmtzUser[USER_SZ];             // Domoticz user name
-  char dmtzPswd[PSWD_SZ];             // Domoticz password
 
   uint16_t dmtzSwitchIdx;             // ID of virtual Domoticz switch
   uint16_t dmtzTHSIdx;                // ID of virtual Domoticz temperature and humidity sensor
   uint16_t dmtzLSIdx;                 // ID of virtual Domoticz lux sensor
   uint32_t dmtzReqTimeout;            // HTTP request timeout
 
-  char topicDmtzPub[MQTT_TOPIC_SZ];   // MQTT topic to publish messages to Domoticz
-  char topicDmtzSub[MQTT_TOPIC_SZ];   // MQTT topic to subscribe to messages from Domoticz
-  char topicLog[MQTT_TOPIC_SZ];
-  char topicCmd[MQTT_TOPIC_SZ];
-
-  char mqttHost[HOST_SZ];             // IP/hostname of MQTT broker
   uint16_t mqttPort;                  // MQTT broker TCP port
-  char mqttUser[USER_SZ];             // MQTT user name
-  char mqttPswd[PSWD_SZ];             // MQTT password
   uint16_t mqttBufferSize;            // Size of MQTT buffer
 
-
   uint16_t hdwPollTime;               // Interval between hardware polling (ms)
   uint32_t sensorUpdtTime;            // Interval between updates of hardware values (ms)
   uint32_t apDelayTime;               // Time of disconnection before starting the Access point (ms)
+  uint32_t sendBudget;                // Time allowed to each sendLog(), sendRequest() and commandLoop() pass in loop() (us)
 
   uint8_t logLevelUart;
   uint8_t logLevelSyslog;
   uint8_t logLevelWebc;
   uint8_t logLevelMqtt;
+  uint32_t logRepeatWindow;           // Identical messages within this time are counted instead of logged (ms), 0 to disable
+  uint16_t logRate[TAG_COUNT];        // Messages per minute allowed for each log tag, 0 for no limit
+  uint8_t logBurst[TAG_COUNT];        // Messages that can be logged in a burst for each log tag
+  uint32_t saveDelay;                 // Time without change before the config is saved to NVS (ms), 0 to save only on restart
+
+  // The strings, see cfgString_t, one after the other each one as its length in a byte,
+  // its characters and a terminating 0. The unused end of the pool is filled with 0
+  // so that a pool of 0 holds empty strings. Use configString() and configSetString().
+  char strings[CONFIG_POOL_SZ];
   // end of user settings --
 
   uint32_t checksum;
 };
 
-void defaultNames(void);
-void defaultWifiNetwork(void);
-void defaultStaticStaIp(void);
-void defaultAp(void);
-void defaultApip(void);
-void defaultDmtz(void);
-void defaultIdx(void);
-void defaultTopics(void);
-void defaultMqtt(void);
-void defaultLogLevels(void);
-void defaultStatip(void);
-void defaultSyslog(void);
-void defaultTimes(void);
+// Schema of the user settings
+//
+// Each field of config_t between the version and the checksum, and each string of the
+// string pool, is described by an entry of configFields[] in config.cpp which gives its
+// default value and how it is checked. The table is walked to set the default
+// configuration, to check a configuration loaded from NVS and to show and change the
+// settings with commands, so adding a setting is a matter of adding the field to config_t,
+// or the string to cfgString_t, and its line to the table.
+//
+// Fields belong to groups, each group is shown and changed with the command of the
+// same name (see doGroup() in commands.cpp). The values of a positional group are
+// given in the order of the table (wifi <ssid> <pswd>), those of a named group are
+// given with the name of the field (time poll 25) or, if the group has options, with
+// the option of the field (name -h kitchenlight).
+
+enum cfgGroup_t {cgName, cgWifi, cgStaip, cgAp, cgApip, cgSyslog, cgDmtz, cgIdx, cgTime, cgTopic, cgMqtt, cgLog, CONFIG_GROUP_COUNT};
+
+enum cfgType_t {ctString, ctUint8, ctUint16, ctUint32, ctIP, ctLevel};
+
+#define CF_SECRET   0x01      // the value is never shown
+#define CF_CLEAR    0x02      // the value is cleared by the -x option of the group command
+#define CF_REST     0x04      // the value is the rest of the command line
+#define CF_CRED     0x08      // first value after the -c option of the group command
+#define CF_NOCMD    0x10      // the value is not set by the group command
+
+struct cfgField_t {
+  const char *name;                   // name of the field, unique in its group
+  cfgGroup_t group;                   //
+  cfgType_t type;                     //
+  uint8_t flags;                      // CF_xxx
+  uint8_t count;                      // number of elements, 1 if not an array
+  uint16_t offset;                    // offset in config_t, cfgString_t of strings
+  uint16_t size;                      // size of an element, maximum size including the terminating 0 of strings
+  const char *defString;              // default of ctString and ctIP fields
+  uint32_t defValue;                  // default of numeric fields
+  uint32_t min;                       // range of numeric fields
+  uint32_t max;                       //
+  bool (*check)(const char *value);   // additional check of a string value, can be NULL
+  uint8_t since;                      // CONFIG_VERSION that added the field
+};
+
+#define GF_NAMED    0x01      // values are given by name
+#define GF_ALL      0x02      // all the values must be given, they are checked together
+#define GF_RESET    0x04      // values that are not given are cleared
+
+struct cfgGroupInfo_t {
+  const char *name;                        // name of the group and of its command
+  uint8_t flags;                           // GF_xxx
+  const char *options;                     // option letters of the fields of a GF_NAMED group, in the order of the table, can be NULL
+  bool (*check)(const uint32_t *values);   // check of the values of a GF_ALL group, can be NULL
+  void (*changed)(void);                   // called after a value of the group is changed, can be NULL
+};
+
+extern const cfgField_t configFields[];
+extern const int CONFIG_FIELD_COUNT;
+extern const cfgGroupInfo_t configGroups[CONFIG_GROUP_COUNT];
+
+  // Returns the group with the given name or CONFIG_GROUP_COUNT if there is none
+cfgGroup_t configFindGroup(const char *name);
+
+  // Returns the field of group with the given name (case insensitive) or NULL
+const cfgField_t *configFindField(cfgGroup_t group, const char *name);
+
+  // Sets the fields of group to their default value
+void configDefault(cfgGroup_t group);
+
+  // Sets the field to 0 or to an empty string
+void configClear(const cfgField_t &field);
+
+  // Checks that text is a valid value of field. The value of numeric and IP fields is
+  // returned in value which can be NULL
+bool configParse(const cfgField_t &field, const char *text, uint32_t *value = NULL);
+
+  // Sets element index of field to the value in text. Returns false, without changing
+  // the field, if text is not a valid value.
+bool configSet(const cfgField_t &field, const char *text, int index = 0);
+
+  // Writes the value of element index of field into buf, secret values included.
+  // Returns the length of the value which is truncated if buf is too small. Can be
+  // called from any task.
+size_t configGet(const cfgField_t &field, char *buf, size_t size, int index = 0);
+
+  // Returns string id of the config. The pointer is only valid until a string
+  // of the config is changed. Only use in loop(), the other tasks use configCopyString().
+const char *configString(cfgString_t id);
+
+  // Copies string id of the config into the size bytes of buf, truncated if needed,
+  // and returns its length. Can be called from any task.
+size_t configCopyString(cfgString_t id, char *buf, size_t size);
+
+  // Sets string id of the config to value, which can be another string of the config.
+  // Returns false, without changing the string, if there is not enough room left in
+  // the string pool. Only use in loop().
+bool configSetString(cfgString_t id, const char *value);
+
+  // Returns the change of the size of the string pool if field is set to text,
+  // 0 if field is not a string
+int configPoolDelta(const cfgField_t &field, const char *text);
+
+  // Returns true if the strings of the pool can grow by delta bytes, logs an error otherwise
+bool configPoolFits(int delta);
 
 void useDefaultConfig(void);
 void loadConfig(void);
 void saveConfig(bool force = false);
 
+  // Saves the config when it has not changed for config.saveDelay ms, to be called in loop()
+void configLoop(void);
+
+  // Data other than the config kept in NVS under its own key, of at most 15 characters,
+  // which must not start with "cfg"
+
+  // Reads the data saved under key into data, returns its length, 0 if there is none
+  // or it is larger than size
+size_t configLoadData(const char *key, void *data, size_t size);
+
+  // Saves len bytes of data under key, removes the key if len is 0.
+  // Returns false on error.
+bool configSaveData(const char *key, const void *data, size_t len);
+
 extern config_t config;
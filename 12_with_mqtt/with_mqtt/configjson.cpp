@@ -0,0 +1,160 @@
+// configjson.cpp
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include "ArduinoJson.h"
+#include "logging.h"
+#include "config.h"
+#include "configjson.h"
+
+#define GROUP_VALUES 8    // most fields in a GF_ALL group
+
+// Document of the export, done in the async_tcp task. The import, done in loop(),
+// allocates its own.
+static StaticJsonDocument<CONFIG_JSON_DOC_SZ> doc;
+
+static bool isNumber(const cfgField_t &field) {
+  return (field.type == ctUint8) || (field.type == ctUint16) || (field.type == ctUint32);
+}
+
+bool configWriteJson(Print &out) {
+  char value[HOST_SZ];
+  doc.clear();
+  doc["version"] = config.version;
+  for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const cfgField_t &field = configFields[i];
+    if (field.flags & CF_SECRET)
+      continue;
+    const char *name = configGroups[field.group].name;
+    JsonObject group = doc[name];
+    if (group.isNull())
+      group = doc.createNestedObject(name);
+    JsonArray array;
+    if (field.count > 1)
+      array = group.createNestedArray(field.name);
+    for (int k = 0; k < field.count; k++) {
+      configGet(field, value, sizeof(value), k);
+      if ((isNumber(field)) && (field.count > 1))
+        array.add((uint32_t) strtoul(value, NULL, 10));
+      else if (isNumber(field))
+        group[field.name] = (uint32_t) strtoul(value, NULL, 10);
+      else
+        group[field.name] = (char *) value;   // copied into the document
+    }
+  }
+  if (doc.overflowed()) {
+    addToLogP(LOG_ERR, TAG_CONFIG, PSTR("Config does not fit in the JSON document"));
+    return false;
+  }
+  serializeJson(doc, out);
+  return true;
+}
+
+// Returns the text of a value which can be given as a JSON string or, for numeric
+// fields, as a JSON number. Returns NULL if the value is of another type.
+static const char *valueText(const cfgField_t &field, JsonVariantConst value, char *buf, size_t size) {
+  if (value.is<const char *>())
+    return value.as<const char *>();
+  if ((isNumber(field)) && (value.is<uint32_t>())) {
+    snprintf(buf, size, "%u", (unsigned) value.as<uint32_t>());
+    return buf;
+  }
+  return NULL;
+}
+
+// Checks the value of field, or of all its elements for an array, and sets it if set is true.
+// The change of the size of the string pool is added to delta.
+static bool readField(const cfgField_t &field, JsonVariantConst value, bool set, uint32_t *number, int &delta) {
+  char buf[12];
+  if (field.count > 1) {
+    JsonArrayConst array = value.as<JsonArrayConst>();
+    if ((array.isNull()) || (array.size() > field.count))
+      return false;
+    int k = 0;
+    for (JsonVariantConst element : array) {
+      const char *text = valueText(field, element, buf, sizeof(buf));
+      if ((!text) || (!configParse(field, text)))
+        return false;
+      if (set)
+        configSet(field, text, k);
+      k++;
+    }
+    return true;
+  }
+  const char *text = valueText(field, value, buf, sizeof(buf));
+  if ((!text) || (!configParse(field, text, number)))
+    return false;
+  delta += configPoolDelta(field, text);
+  if (set)
+    configSet(field, text);
+  return true;
+}
+
+static bool jsonError(char *error, size_t size, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error, size, format, args);
+  va_end(args);
+  addToLogPf(LOG_ERR, TAG_CONFIG, PSTR("JSON config: %s"), error);
+  return false;
+}
+
+// Checks all the groups of root if set is false, sets them if set is true. The change
+// of the size of the string pool is added to delta.
+static bool readGroups(JsonObjectConst root, bool set, int &delta, char *error, size_t size) {
+  for (JsonPairConst pair : root) {
+    if (!strcmp(pair.key().c_str(), "version"))
+      continue;
+    cfgGroup_t group = configFindGroup(pair.key().c_str());
+    JsonObjectConst values = pair.value().as<JsonObjectConst>();
+    if (group >= CONFIG_GROUP_COUNT)
+      return jsonError(error, size, "unknown group %s", pair.key().c_str());
+    if (values.isNull())
+      return jsonError(error, size, "%s is not an object", pair.key().c_str());
+    const cfgGroupInfo_t &info = configGroups[group];
+    uint32_t numbers[GROUP_VALUES];   // values of a GF_ALL group in the order of the table
+    int given = 0;
+    for (JsonPairConst value : values) {
+      const cfgField_t *field = configFindField(group, value.key().c_str());
+      if (!field)
+        return jsonError(error, size, "unknown setting %s %s", info.name, value.key().c_str());
+      int n = 0;   // index of the field in its group
+      for (const cfgField_t *f = configFields; f < field; f++)
+        n += (f->group == group);
+      if (!readField(*field, value.value(), set, (n < GROUP_VALUES) ? &numbers[n] : NULL, delta))
+        return jsonError(error, size, "invalid value of %s %s", info.name, field->name);
+      given++;
+    }
+    if ((!set) && (info.flags & GF_ALL)) {
+      for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if ((configFields[i].group == group) && (!values.containsKey(configFields[i].name)))
+          return jsonError(error, size, "missing %s %s", info.name, configFields[i].name);
+      }
+      if ((info.check) && (!info.check(numbers)))
+        return jsonError(error, size, "invalid %s values", info.name);
+    }
+    if ((set) && (given) && (info.changed))
+      info.changed();
+  }
+  return true;
+}
+
+bool configReadJson(char *json, size_t len, char *error, size_t size) {
+  DynamicJsonDocument doc(CONFIG_JSON_DOC_SZ);
+  if (!doc.capacity())
+    return jsonError(error, size, "out of memory");
+  DeserializationError err = deserializeJson(doc, json, len);   // strings are not copied
+  if (err)
+    return jsonError(error, size, "not valid JSON, %s", err.c_str());
+  JsonObjectConst root = doc.as<JsonObjectConst>();
+  if (root.isNull())
+    return jsonError(error, size, "not a JSON object");
+  int delta = 0;
+  if (!readGroups(root, false, delta, error, size))
+    return false;
+  if (!configPoolFits(delta))
+    return jsonError(error, size, "not enough room for the strings");
+  readGroups(root, true, delta, error, size);
+  addToLogP(LOG_INFO, TAG_CONFIG, PSTR("Settings imported from JSON"));
+  return true;
+}
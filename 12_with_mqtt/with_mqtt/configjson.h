@@ -0,0 +1,41 @@
+// configjson.h
+
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Export and import of the user settings as JSON (GET and POST /config.json).
+ *
+ * The settings are an object of groups, each one an object of the fields of the
+ * group with the names used by the group commands (see configFields[] in config.cpp):
+ *
+ *   {"version": 9, "name": {"host": "kitchenlight", "device": "Kitchen Light"},
+ *    "staip": {"ip": "192.168.1.22", "gateway": "192.168.1.1", "mask": "255.255.255.0"},
+ *    "time": {"poll": 25, ...}, "log": {"uart": "dbg", ..., "rate": [0, 0, ...]}, ...}
+ *
+ * Numbers are JSON numbers, IP addresses, log levels and strings are JSON strings and
+ * arrays (log rate and burst) are arrays with an element per log tag. Secret values
+ * (passwords) are never exported.
+ *
+ * An import only changes the settings that it contains, so an export, with the
+ * passwords added if needed, can be imported in another device. All the values are
+ * checked before any one is changed, all the fields of the groups whose values are
+ * checked together (staip, apip) must be given. The import is applied in loop() (see
+ * doImport() in commands.hpp) and, like a command, saved after config.saveDelay.
+ */
+
+  // Size of the JsonDocument used to export and import the settings
+#define CONFIG_JSON_DOC_SZ  3072
+
+  // Largest JSON text that can be imported
+#define CONFIG_JSON_MAX     2048
+
+  // Writes the user settings, except the secret ones, as JSON to out.
+  // Returns false if they did not fit in the JsonDocument.
+bool configWriteJson(Print &out);
+
+  // Checks all the settings in the JSON text of len characters, which is modified,
+  // and if they are valid, applies them. Returns false, without changing the config,
+  // if a setting is not valid in which case error contains the reason. Call in loop().
+bool configReadJson(char *json, size_t len, char *error, size_t size);
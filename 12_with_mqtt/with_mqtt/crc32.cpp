@@ -0,0 +1,53 @@
+// crc32.cpp
+
+#include "crc32.h"
+
+#ifdef ESP_PLATFORM
+
+#include "esp_rom_crc.h"
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len) {
+  return esp_rom_crc32_le(crc, (const uint8_t *) data, len);
+}
+
+#else
+
+#define CRC32_POLY 0xEDB88320   // reflected 0x04C11DB7
+
+static uint32_t crcTable[8][256];
+static bool crcTableReady = false;
+
+static void makeTables(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+    crcTable[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++)
+      crcTable[t][i] = (crcTable[t-1][i] >> 8) ^ crcTable[0][crcTable[t-1][i] & 0xFF];
+  }
+  crcTableReady = true;
+}
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *) data;
+  if (!crcTableReady)
+    makeTables();
+  crc = ~crc;
+  // byte at a time up to a 4 byte boundary, then 8 bytes at a time
+  for (; len && ((uintptr_t) p & 3); len--)
+    crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xFF];
+  for (; len >= 8; len -= 8, p += 8) {
+    uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+    uint32_t hi = (uint32_t) p[4] | (uint32_t) p[5] << 8 | (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+    crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^ crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24]
+        ^ crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF] ^ crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+  }
+  for (; len; len--)
+    crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xFF];
+  return ~crc;
+}
+
+#endif
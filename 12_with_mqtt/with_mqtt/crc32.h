@@ -0,0 +1,21 @@
+// crc32.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC-32 (IEEE 802.3, the one of zlib and Ethernet) used to check the configuration
+ * saved in NVS and the log retained across warm resets.
+ *
+ * On the ESP32 the CRC routine in ROM is used, elsewhere (host tools and tests)
+ * a slice-by-8 table implementation which gives the same results.
+ *
+ * This module does not depend on the Arduino framework.
+ */
+
+  // Returns the CRC-32 of len bytes at data. To compute the CRC of data in several
+  // parts, pass the CRC of the previous parts as crc, 0 for the first part.
+  // crc32Update(0, "123456789", 9) == 0xCBF43926
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len);
@@ -13,6 +13,8 @@ String urlRing[RING_SIZE];
 uint8_t urHead = 0;
 uint8_t urTail = 0;
 uint8_t urCount = 0;
+uint32_t urSent = 0;      // Number of requests sent
+uint32_t urDropped = 0;   // Number of requests removed from the buffer before being sent
 
 // Adds the given url to the URL circular buffer urlRing[]
 // This always succeeds, the oldest url in the queue will be
@@ -25,6 +27,7 @@ void addToRing(String url) {
   if (urCount > RING_SIZE) {         // If more requests to be sent out than the size of the buffer
     urTail = urHead;                 // then move the urTail to the oldest message in the buffer
     urCount = RING_SIZE;             // Can't send out more messanges than the total number in the buffer
+    urDropped++;
     addToLogP(LOG_INFO, TAG_DOMOTICZ, PSTR("Oldest queued request removed"));
   }
   //addToLogPf(LOG_DEBUG, TAG_DOMOTICZ, PSTR("urlRing count = %d"), urCount);  // let's see if ring buffer is used at all!
@@ -63,15 +66,27 @@ bool sendHttpRequest(String url) {
 }
 
 int sendRequest(void) {
-  if (urCount < 1)
-    return 0;
-  // Send the oldest request in the ring buffer
-  // Ignore the result, errors or success is logged
-  sendHttpRequest(urlRing[urTail]);
-  // remove the log message from the ring buffer
-  urTail = (urTail + 1) % RING_SIZE;  // move the urTail to the next message to send
-  urCount--;                          // reduce the count of messages yet to be sent
-  return 1;
+  unsigned long start = micros();
+  int count = 0;
+  while (urCount > 0) {
+    // Send the oldest request in the ring buffer
+    // Ignore the result, errors or success is logged
+    sendHttpRequest(urlRing[urTail]);
+    // remove the log message from the ring buffer
+    urTail = (urTail + 1) % RING_SIZE;  // move the urTail to the next message to send
+    urCount--;                          // reduce the count of messages yet to be sent
+    urSent++;
+    count++;
+    // send more requests only if time remains in the budget of this pass
+    if (micros() - start >= config.sendBudget)
+      break;
+  }
+  return count;
+}
+
+void domoticzLogStatus(void) {
+  addToLogPf(LOG_INFO, TAG_DOMOTICZ, PSTR("Domoticz HTTP requests: %u sent, %u dropped, %d pending"),
+    (unsigned) urSent, (unsigned) urDropped, urCount);
 }
 
 String startUrl(int idx) {
@@ -82,8 +97,10 @@ String startUrl(int idx) {
     return false;
   }
   */
+  char host[HOST_SZ];     // called from the Ticker task and async_tcp
+  configCopyString(csDmtzHost, host, sizeof(host));
   String url = "http://";
-  url += config.dmtzHost;
+  url += host;
   url += ":";
   url += config.dmtzPort;
   url += "/json.htm?type=command&param=udevice&idx=";   // only update the status, do not ask Domoticz to perform action
@@ -93,6 +110,8 @@ String startUrl(int idx) {
 }
 
 void updateDomoticzSwitch(int idx, int value) {
+  if (!idx)
+    return;     // device not in Domoticz
   if (!mqttUpdateDmtzSwitch(idx, value)) {
     // try with HTTP request instead
     String url = startUrl(idx);
@@ -102,6 +121,8 @@ void updateDomoticzSwitch(int idx, int value) {
 }
 
 void updateDomoticzBrightnessSensor(int idx, int value) {
+  if (!idx)
+    return;     // device not in Domoticz
   if (!mqttUpdateDomoticzBrightnessSensor(idx, value)) {
     String url = startUrl(idx);
     url += "0&svalue=";
@@ -111,6 +132,8 @@ void updateDomoticzBrightnessSensor(int idx, int value) {
 }
 
 void updateDomoticzTemperatureHumiditySensor(int idx, float value1, float value2, int state) {
+  if (!idx)
+    return;     // device not in Domoticz
   if (!mqttUpdateDomoticzTemperatureHumiditySensor(idx, value1, value2, state)) {
     String url = startUrl(idx);
     url += "0&svalue=";
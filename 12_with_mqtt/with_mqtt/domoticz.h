@@ -1,5 +1,7 @@
 #pragma once
 
+// A device with idx 0 is not in Domoticz, its updates are not sent.
+
 // Update the state of the virtual switch with given idx, value=0 for Off, value=1 for On.
 void updateDomoticzSwitch(int idx, int value);
 
@@ -15,7 +17,11 @@ void updateDomoticzBrightnessSensor(int idx, int value);
 //      value2 must be a percent (from 0 to 100) such as 48.9 and will be displayed as 48.9%
 void updateDomoticzTemperatureHumiditySensor(int idx, float value1, float value2, int state=0);
 
-// Send oldest HTTP request in the queue, returns the number of requests sent
-//  1 - one message sent
+// Send the oldest HTTP requests in the queue, returns the number of requests sent
 //  0 - no message sent, the queue was empty
+// At least one request is sent if the queue is not empty, more are sent as
+// long as the config.sendBudget time budget is not exhausted.
 int sendRequest(void);
+
+// Reports the number of HTTP requests sent and dropped to the log
+void domoticzLogStatus(void);
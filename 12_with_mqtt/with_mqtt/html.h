@@ -207,7 +207,7 @@ const char html_console[] PROGMEM = R"rawliteral(
 </head>
 <body>
   <h1>%DEVICENAME%</h1>
-  <textarea readonly id='log' cols='340' wrap='off'>%LOG%</textarea>
+  <textarea readonly id='log' cols='340' wrap='off'></textarea>
   <p>
   <input id="cmd" type="text" value="" placeholder='Enter commands separated with ;'  autofocus/>
   </p>
@@ -229,28 +229,39 @@ const char html_console[] PROGMEM = R"rawliteral(
       xhr.send();
       cmdinput.value = "";
 	  }
-    if (!Boolean(EventSource)) {
-      alert("Error: Server-Sent Events are not supported in your browser");
-    } else {
-      if (Boolean(source)) {
-        console.log("Closing source which is already defined");
-        source.close();
+    // get the log history then the new log messages as they are added
+    const hist = new XMLHttpRequest();
+    hist.open("GET", "/log.txt");
+    hist.onloadend = startEvents;
+    hist.onload = function() {
+      ta = document.getElementById("log")
+      ta.innerHTML = hist.responseText;
+      ta.scrollTop = ta.scrollHeight; };
+    hist.send();
+    function startEvents() {
+      if (!Boolean(EventSource)) {
+        alert("Error: Server-Sent Events are not supported in your browser");
+      } else {
+        if (Boolean(source)) {
+          console.log("Closing source which is already defined");
+          source.close();
+        }
+
+        var source = new EventSource('events');
+
+        source.addEventListener('open', function(e) {
+          console.log("Events Connected to source"); });
+
+        source.addEventListener('error', function(e) {
+          if (e.target.readyState != EventSource.OPEN) {
+            console.log("Events Disconnected from source");} });
+
+        source.addEventListener('logvalue', function(e) {
+          console.log("logvalue", e.data);
+          ta = document.getElementById("log")
+          ta.innerHTML += e.data + "\n";
+          ta.scrollTop = ta.scrollHeight; });
       }
-
-      var source = new EventSource('events');
-
-      source.addEventListener('open', function(e) {
-        console.log("Events Connected to source"); });
-
-      source.addEventListener('error', function(e) {
-        if (e.target.readyState != EventSource.OPEN) {
-          console.log("Events Disconnected from source");} });
-
-      source.addEventListener('logvalue', function(e) {
-        console.log("logvalue", e.data);
-        ta = document.getElementById("log")
-        ta.innerHTML += e.data + "\n";
-        ta.scrollTop = ta.scrollHeight; });
     }
  </script>
 </body>
@@ -0,0 +1,188 @@
+// logformat.cpp
+
+#include <stdio.h>
+#include <string.h>
+#include "logformat.h"
+
+#define SPEC_SZ 16   // longest supported conversion specification, including the terminating nul
+
+void logParseSpec(const char *p, logSpec_t &spec) {
+  const char *s = p + 1;
+  spec.stars = 0;
+  spec.precision = false;
+  spec.precValue = -1;
+  spec.type = atInvalid;
+
+  while (*s && strchr("-+ #0", *s)) s++;              // flags
+  if (*s == '*') { spec.stars++; s++; }                // width
+  else while (*s >= '0' && *s <= '9') s++;
+  if (*s == '.') {                                     // precision
+    spec.precision = true;
+    s++;
+    if (*s == '*') { spec.stars++; s++; }
+    else {
+      spec.precValue = 0;
+      while (*s >= '0' && *s <= '9') spec.precValue = 10*spec.precValue + (*s++ - '0');
+    }
+  }
+  int longs = 0;                                       // length modifier
+  bool size = false;
+  if (*s == 'h') { s++; if (*s == 'h') s++; }
+  else if (*s == 'l') { longs++; s++; if (*s == 'l') { longs++; s++; } }
+  else if (*s == 'z') { size = true; s++; }
+
+  switch (*s) {
+    case '%':
+      spec.type = (s == p + 1) ? atNone : atInvalid;
+      break;
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      spec.type = (size) ? atSize : (longs == 2) ? atLongLong : (longs == 1) ? atLong : atInt;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      spec.type = atDouble;
+      break;
+    case 's':
+      spec.type = (longs || size) ? atInvalid : atString;
+      break;
+    case 'p':
+      spec.type = atPointer;
+      break;
+    default:   // 'n', 'L', 'j', 't' and unknown conversions are not supported
+      break;
+  }
+  spec.conversion = *s;
+  spec.len = (*s) ? s - p + 1 : s - p;
+  if (spec.len >= SPEC_SZ)
+    spec.type = atInvalid;
+}
+
+static bool put(uint8_t *buf, size_t size, size_t &used, const void *value, size_t n) {
+  if (used + n > size)
+    return false;
+  memcpy(buf + used, value, n);
+  used += n;
+  return true;
+}
+
+#define PUT_ARG(T, VAT) { T v = (T) va_arg(ap, VAT); ok = put(buf, size, used, &v, sizeof(T)); }
+
+int logPackArgs(uint8_t *buf, size_t size, const char *format, va_list args) {
+  va_list ap;
+  va_copy(ap, args);   // the caller may still need args if the message cannot be deferred
+  size_t used = 0;
+  bool ok = true;
+  logSpec_t spec;
+
+  for (const char *p = format; ok && *p; p++) {
+    if (*p != '%')
+      continue;
+    logParseSpec(p, spec);
+    p += spec.len - 1;
+    if (spec.type == atNone)
+      continue;
+    if (spec.type == atInvalid) {
+      ok = false;
+      break;
+    }
+    int prec = spec.precValue;
+    for (int i = 0; ok && i < spec.stars; i++) {
+      int v = va_arg(ap, int);
+      ok = put(buf, size, used, &v, sizeof(int));
+      prec = v;   // the last '*' is the precision if there is one
+    }
+    if (!spec.precision)
+      prec = -1;
+    if (!ok)
+      break;
+    switch (spec.type) {
+      case atInt:      PUT_ARG(int, int); break;
+      case atLong:     PUT_ARG(long, long); break;
+      case atLongLong: PUT_ARG(long long, long long); break;
+      case atSize:     PUT_ARG(size_t, size_t); break;
+      case atDouble:   PUT_ARG(double, double); break;
+      case atPointer:  PUT_ARG(void *, void *); break;
+      case atString: {
+        const char *s = va_arg(ap, const char *);
+        if (!s) s = "(null)";
+        size_t n = (prec < 0) ? strlen(s) : strnlen(s, prec);
+        ok = put(buf, size, used, s, n);
+        if (ok) ok = put(buf, size, used, "", 1);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  va_end(ap);
+  return (ok) ? (int) used : -1;
+}
+
+#define GET_ARG(T) T v; if (used + sizeof(T) > argslen) break; memcpy(&v, args + used, sizeof(T)); used += sizeof(T);
+
+template <typename T>
+static int renderOne(char *out, size_t size, const char *spec, int stars, const int *star, T value) {
+  switch (stars) {
+    case 0:  return snprintf(out, size, spec, value);
+    case 1:  return snprintf(out, size, spec, star[0], value);
+    default: return snprintf(out, size, spec, star[0], star[1], value);
+  }
+}
+
+size_t logRenderArgs(char *out, size_t size, const char *format, const uint8_t *args, size_t argslen) {
+  if (!size)
+    return 0;
+  size_t n = 0;
+  size_t used = 0;
+  char specbuf[SPEC_SZ];
+  int star[2];
+  logSpec_t spec;
+  out[0] = '\0';
+
+  for (const char *p = format; *p && n < size - 1; p++) {
+    if (*p != '%') {
+      out[n++] = *p;
+      continue;
+    }
+    logParseSpec(p, spec);
+    if (spec.type == atNone) {
+      out[n++] = '%';
+      p++;
+      continue;
+    }
+    if (spec.type == atInvalid)
+      break;
+    memcpy(specbuf, p, spec.len);
+    specbuf[spec.len] = '\0';
+    p += spec.len - 1;
+    if (used + spec.stars*sizeof(int) > argslen)
+      break;
+    for (int i = 0; i < spec.stars; i++) {
+      memcpy(&star[i], args + used, sizeof(int));
+      used += sizeof(int);
+    }
+    int len = 0;
+    switch (spec.type) {
+      case atInt:      { GET_ARG(int);       len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atLong:     { GET_ARG(long);      len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atLongLong: { GET_ARG(long long); len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atSize:     { GET_ARG(size_t);    len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atDouble:   { GET_ARG(double);    len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atPointer:  { GET_ARG(void *);    len = renderOne(out + n, size - n, specbuf, spec.stars, star, v); break; }
+      case atString: {
+        const char *s = (const char *) args + used;
+        size_t slen = strnlen(s, argslen - used);
+        if (used + slen >= argslen)
+          break;   // missing terminating nul, corrupted arguments
+        used += slen + 1;
+        len = renderOne(out + n, size - n, specbuf, spec.stars, star, s);
+        break;
+      }
+      default:
+        break;
+    }
+    if (len > 0)
+      n += ((size_t) len < size - n) ? len : size - n - 1;
+  }
+  out[n] = '\0';
+  return n;
+}
@@ -0,0 +1,49 @@
+// logformat.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+/*
+ * Deferred formatting of log messages.
+ *
+ * Instead of running vsnprintf() when a message is added to the log, the
+ * arguments are packed in a byte buffer next to a pointer to the format string
+ * which must remain valid (a PSTR() or other string literal). The message is only
+ * rendered to text when it is sent to a log device or shown in the log history.
+ *
+ * The packed arguments are stored in the order they are consumed by the format
+ * string, each one in its native size:
+ *   - int, long and long long (signed or not), including '*' width and precision
+ *   - double for floating point conversions
+ *   - pointer for %p
+ *   - the characters of the string followed by a nul for %s
+ *
+ * This module does not depend on the Arduino framework.
+ */
+
+enum argType_t {atNone, atInt, atLong, atLongLong, atSize, atDouble, atPointer, atString, atInvalid};
+
+struct logSpec_t {
+  size_t len;        // length of the conversion specification starting with '%'
+  int stars;         // number of '*' width and precision arguments
+  bool precision;    // true if a precision is given
+  int precValue;     // precision if given as digits
+  char conversion;   // conversion character ('d', 's', ...)
+  argType_t type;    // type of the argument, atNone for "%%", atInvalid if not supported
+};
+
+  // Parses the conversion specification starting at p which points to a '%'
+void logParseSpec(const char *p, logSpec_t &spec);
+
+  // Packs the arguments consumed by format into buf.
+  // Returns the number of bytes used, or -1 if the arguments do not fit in size bytes
+  // or if format contains an unsupported conversion, in which case the message must
+  // be formatted immediately. args is not modified.
+int logPackArgs(uint8_t *buf, size_t size, const char *format, va_list args);
+
+  // Renders format with the arguments packed by logPackArgs() into out which is
+  // always nul terminated. Returns the length of the string in out.
+size_t logRenderArgs(char *out, size_t size, const char *format, const uint8_t *args, size_t argslen);
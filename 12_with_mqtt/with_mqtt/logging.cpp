@@ -1,5 +1,6 @@
 
 #include <Arduino.h>
+#include <sys/time.h>
 #include "ESPAsyncWebServer.h"  // for AsyncEventSource
 #include "IPAddress.h"
 #include "AsyncUDP.h"
@@ -7,19 +8,123 @@
 #include "mqtt.hpp"
 #include "config.h"
 #include "logging.h"
+#include "logformat.h"
+#include "crc32.h"
+#if defined(LOG_RETAIN) && defined(ESP_PLATFORM)
+#include <esp_attr.h>
+#include <esp_idf_version.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#endif
 
 
+// Timestamps "hh:mm:ss.mmm" are written with a table of two digit numbers instead of
+// snprintf(). The "hh:mm:ss." part can be kept in a timeCache_t between lines in the
+// same second.
+
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static char *putPair(char *p, unsigned value) {
+  memcpy(p, &digitPairs[2*value], 2);
+  return p + 2;
+}
+
+// Writes "hh:mm:ss." into buf (at least 13 bytes), hours can have more than 2 digits.
+// Returns the number of characters written.
+static size_t putHms(char *buf, unsigned hr, unsigned min, unsigned sec) {
+  char *p = buf;
+  if (hr < 100)
+    p = putPair(p, hr);
+  else {
+    char digits[10];
+    int n = 0;
+    for (; hr; hr /= 10)
+      digits[n++] = '0' + hr % 10;
+    while (n)
+      *p++ = digits[--n];
+  }
+  *p++ = ':';
+  p = putPair(p, min);
+  *p++ = ':';
+  p = putPair(p, sec);
+  *p++ = '.';
+  return p - buf;
+}
+
+// Writes ms, less than 1000, as 3 digits followed by a nul
+static void putMs(char *p, unsigned ms) {
+  *p++ = '0' + ms / 100;
+  p = putPair(p, ms % 100);
+  *p = 0;
+}
+
 void mstostr(unsigned long milli, char* sbuf, int sbufsize) {
-  int sec = milli / 1000;
-  int min = sec / 60;
-  int hr = min / 60;
-  min = min % 60;
-  sec = sec % 60;
-  int frac = (milli % 1000);   //    hr:min:second.millisecond
-  snprintf_P(sbuf, sbufsize-1, PSTR("%02d:%02d:%02d.%03d"), hr,min,sec,frac);
+  char buf[20];
+  uint32_t sec = milli / 1000;
+  size_t n = putHms(buf, sec / 3600, (sec / 60) % 60, sec % 60);
+  putMs(buf + n, milli % 1000);
+  strlcpy(sbuf, buf, sbufsize);
 }
 
-#define LOGSZ 520  // maximum length of a log message
+// Log lines are stamped with the time of day once the system clock has been set
+// (by NTP for example), before that with the time since boot.
+#define LOG_EPOCH_MIN 1600000000   // the clock is considered set after Sept. 2020
+
+struct timeCache_t {
+  uint32_t checked;                // millis() when the system clock was last checked
+  int64_t offset;                  // ms since the epoch at millis() == 0, 0 if the clock is not set
+  uint32_t sec;                    // second of the cached prefix, since boot or since the epoch
+  uint8_t len;                     // length of prefix, 0 if empty
+  char prefix[14];                 // "hh:mm:ss."
+};
+
+#define TIME_CACHE_INIT {0, 0, 0, 0, {0}}
+
+// Writes the timestamp of a message added at milli (millis()) into buf which must
+// be at least 18 bytes long. Returns the length of the timestamp.
+static size_t formatTime(uint32_t milli, char *buf, timeCache_t &cache) {
+  uint32_t now = millis();
+  if ((!cache.len) || (now - cache.checked >= 1000)) {
+    // the system clock is read at most once a second
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t offset = (tv.tv_sec > LOG_EPOCH_MIN) ? (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 - now : 0;
+    if (offset != cache.offset)
+      cache.len = 0;
+    cache.offset = offset;
+    cache.checked = now;
+  }
+  bool wall = (cache.offset != 0);
+  uint32_t sec;
+  unsigned ms;
+  if (wall) {
+    // milli is taken modulo 2^32 from now, so that wrapping of millis() does not matter
+    int64_t t = cache.offset + now - (uint32_t) (now - milli);
+    sec = t / 1000;
+    ms = t % 1000;
+  } else {
+    sec = milli / 1000;
+    ms = milli % 1000;
+  }
+  if ((!cache.len) || (sec != cache.sec)) {
+    if (wall) {
+      struct tm tm;
+      time_t tt = sec;
+      localtime_r(&tt, &tm);
+      cache.len = putHms(cache.prefix, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    } else
+      cache.len = putHms(cache.prefix, sec / 3600, (sec / 60) % 60, sec % 60);
+    cache.sec = sec;
+  }
+  memcpy(buf, cache.prefix, cache.len);
+  putMs(buf + cache.len, ms);
+  return cache.len + 3;
+}
 
 AsyncUDP udp;
 
@@ -44,61 +149,598 @@ const char *tagString[TAG_COUNT] = {
   "DMZ"
 };
 
-// The log is implemented as a circurlar queue (called ring below) with replacement of
-// the oldest entry when a message is added and the queue is full.
+// The log is implemented as a circular queue (called ring below) with replacement of
+// the oldest entries when a message is added and the queue is full.
+//
+// The ring is a single statically allocated byte arena that holds variable length
+// records. Each record is a logHeader_t followed by the text of the message (without
+// the terminating nul) and padding up to a 4 byte boundary. Records can wrap around
+// the end of the arena. Positions in the ring are free running byte counts which are
+// reduced modulo LOG_ARENA_SZ only when the arena is accessed, so that the difference
+// between two positions is always the number of bytes between them.
+//
+// Messages are added from the loop task, the Ticker task (checkHardware()) and the
+// async_tcp task (web server handlers), so the ring is a multiple producer single
+// consumer queue without a mutex:
+//   - A producer reserves room for its record by advancing logReserve, which holds
+//     the position of the next record and the sequence number of the next message,
+//     with a compare and swap. The oldest records are simply overwritten.
+//   - The producer then copies its record into the reserved room and stores the
+//     commit word of the header last. The commit word is the complement of the
+//     position of the record so that a record left over from a previous pass
+//     around the arena, or an empty arena, is never taken as complete.
+//   - A producer preempted while it writes its record could be lapped by the others
+//     and would then overwrite newer records with its stale data. Each producer
+//     therefore holds one of LOG_WRITERS slots with the position of its record while
+//     it writes, and a producer that would reserve room over a record still being
+//     written drops its message instead (counted as blocked in the log stats).
+//   - The readers (the log devices and the log history) never modify the ring.
+//     They stop at a record which is not yet committed and check, after copying
+//     a record, that it was not overwritten in the meantime. A reader that has
+//     fallen more than LOG_ARENA_SZ bytes behind resynchronizes on the oldest
+//     complete record and the gap in the sequence numbers is the number of
+//     messages it lost.
+//
+// There is no heap allocation when adding or sending messages.
 //
 // See
 //   https://www.pythoncentral.io/circular-queue/ for implementations without replacement
 
-
-#define LOG_SIZE 64                // Max number of lines in log
+#define LOG_ARENA_SZ 8192          // Size of the ring in bytes, must be a power of 2
 #define MSG_SIZE 250               // Maximum size of formatted message
 
-// Log ring
-String        Log[LOG_SIZE];       // for log messages
-uint8_t       LogLevel[LOG_SIZE];  // for log levels
-uint8_t       LogTag[LOG_SIZE];    // for log tags
-unsigned long LogTime[LOG_SIZE];   // for time each message is received by log
+// Formatting of messages added with addToLogP() and addToLogPf() is deferred until they are
+// sent out or shown in the log history. The payload of these records is not the text
+// of the message but a pointer to the PSTR() in flash memory which remains valid, followed
+// by the packed arguments of the format string in the case of addToLogPf(). See logformat.h
+#define LOG_TEXT       0           // payload is the text of the message
+#define LOG_POINTER    1           // payload is a pointer to the message
+#define LOG_DEFERRED   2           // payload is a pointer to the format followed by the packed arguments
+
+struct logHeader_t {
+  uint32_t commit;                 // ~position of the record, written last by the producer
+  uint32_t seq;                    // sequence number of the message
+  uint32_t time;                   // time each message is received by log
+  uint16_t len;                    // length of payload
+  uint8_t  level : 4;              // log level
+  uint8_t  kind  : 4;              // LOG_TEXT, LOG_POINTER or LOG_DEFERRED
+  uint8_t  tag;                    // log tag
+};
+
+#define LOG_ALIGN(n) (((n) + 3) & ~3u)
+#define LOG_RECORD_SZ(len) LOG_ALIGN(sizeof(logHeader_t) + (len))
+
+// With the LOG_RETAIN build flag, the arena is placed in memory that is not initialized
+// at boot so that the messages logged before a software reset, a panic or a watchdog
+// reset can be sent out after the restart. See logInit().
+#if defined(LOG_RETAIN) && defined(ESP_PLATFORM)
+  #define LOG_RETAIN_ATTR __NOINIT_ATTR
+#else
+  #define LOG_RETAIN_ATTR
+#endif
+
+static LOG_RETAIN_ATTR uint8_t logArena[LOG_ARENA_SZ] __attribute__((aligned(4)));
+
+  // Sequence number (high 32 bits) and position (low 32 bits) of the next record,
+  // updated atomically as a whole by the producers
+static uint64_t logReserve = 0;
+
+static uint64_t logNext(void) {
+  return __atomic_load_n(&logReserve, __ATOMIC_ACQUIRE);
+}
+
+  // Position where the next record will be inserted in the ring
+static uint32_t logHead(void) {
+  return (uint32_t) logNext();
+}
+
+// Each log device (sink) reads the ring with its own cursor so that a slow or
+// disconnected device does not hold back the others.
+enum logSink_t {SINK_SYSLOG, SINK_UART, SINK_WEBC, SINK_MQTT, SINK_COUNT};
+
+static const char *sinkString[SINK_COUNT] = {
+  "syslog",
+  "uart",
+  "webc",
+  "mqtt"
+};
+
+struct logCursor_t {
+  uint32_t pos;                    // Position of the next record to be sent out to the device
+  uint32_t seq;                    // Sequence number of the record expected at pos
+  uint32_t sent;                   // Number of messages sent to the device
+  uint32_t dropped;                // Number of messages overwritten in the ring before being read for the device
+};
+
+static logCursor_t cursor[SINK_COUNT];
+
+static uint8_t sinkLevel(int sink) {
+  switch (sink) {
+    case SINK_SYSLOG: return config.logLevelSyslog;
+    case SINK_UART:   return config.logLevelUart;
+    case SINK_WEBC:   return config.logLevelWebc;
+    default:          return config.logLevelMqtt;
+  }
+}
+
+// Statistics reported with the log stats command. The tag counters are updated by the
+// producers with relaxed atomic increments, the device counters only by sendLog().
+struct logTagStats_t {
+  uint32_t messages[LOG_LEVEL_COUNT];  // messages added to the ring
+  uint32_t bytes[LOG_LEVEL_COUNT];     // ring bytes used by these messages
+  uint32_t overruns[LOG_LEVEL_COUNT];  // messages overwritten before being sent to a device that wanted them
+};
+
+static logTagStats_t tagStats[TAG_COUNT];
+
+// Send latencies are counted in power of 2 buckets: < 8 us, < 16 us, ... < 8192 us, >= 8192 us
+#define LOG_LATENCY_BUCKETS 12
+
+struct logSinkStats_t {
+  uint32_t sends;                      // number of writes to the device
+  uint64_t time;                       // total time of these writes (us)
+  uint32_t latency[LOG_LATENCY_BUCKETS];
+};
+
+static logSinkStats_t sinkStats[SINK_COUNT];
+static uint32_t sendLogCalls = 0;
+static uint64_t sendLogTime = 0;     // total time spent in sendLog() (us)
+
+// Copies n bytes from src into the arena at position pos, wrapping around if needed
+static void arenaWrite(uint32_t pos, const void *src, size_t n) {
+  size_t ofs = pos & (LOG_ARENA_SZ - 1);
+  size_t first = (n < LOG_ARENA_SZ - ofs) ? n : LOG_ARENA_SZ - ofs;
+  memcpy(&logArena[ofs], src, first);
+  if (first < n)
+    memcpy(logArena, (const uint8_t *)src + first, n - first);
+}
+
+// Copies n bytes from the arena at position pos into dst, wrapping around if needed
+static void arenaRead(uint32_t pos, void *dst, size_t n) {
+  size_t ofs = pos & (LOG_ARENA_SZ - 1);
+  size_t first = (n < LOG_ARENA_SZ - ofs) ? n : LOG_ARENA_SZ - ofs;
+  memcpy(dst, &logArena[ofs], first);
+  if (first < n)
+    memcpy((uint8_t *)dst + first, logArena, n - first);
+}
+
+static uint32_t commitWord(uint32_t pos) {
+  return __atomic_load_n((uint32_t *) &logArena[pos & (LOG_ARENA_SZ - 1)], __ATOMIC_ACQUIRE);
+}
+
+static bool validHeader(const logHeader_t &hdr) {
+  return (hdr.len <= MSG_SIZE) && (hdr.level < LOG_LEVEL_COUNT) && (hdr.kind <= LOG_DEFERRED) && (hdr.tag < TAG_COUNT);
+}
+
+// Returns the position of the oldest complete record in the ring, or head if there is none
+static uint32_t logResync(uint32_t head) {
+  logHeader_t hdr;
+  for (uint32_t pos = head - LOG_ARENA_SZ; pos != head; pos += 4) {
+    if (commitWord(pos) == ~pos) {
+      arenaRead(pos, &hdr, sizeof(logHeader_t));
+      if ((validHeader(hdr)) && (LOG_RECORD_SZ(hdr.len) <= head - pos))
+        return pos;
+    }
+  }
+  return head;
+}
+
+// Reads the record at position pos. The header is copied into hdr and the payload
+// into buf which must be at least MSG_SIZE bytes long. If the record was overwritten,
+// pos is moved to the oldest complete record. Returns false if there is no complete
+// record at pos, either because all messages have been read or because the record
+// is still being written.
+static bool logRead(uint32_t &pos, logHeader_t &hdr, uint8_t *buf) {
+  for (;;) {
+    uint32_t head = logHead();
+    if (pos == head)
+      return false;
+    if (head - pos > LOG_ARENA_SZ) {
+      pos = logResync(head);    // overwritten before it was read
+      continue;
+    }
+    if (commitWord(pos) != ~pos)
+      return false;
+    arenaRead(pos, &hdr, sizeof(logHeader_t));
+    arenaRead(pos + sizeof(logHeader_t), buf, (hdr.len < MSG_SIZE) ? hdr.len : MSG_SIZE);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (logHead() - pos <= LOG_ARENA_SZ)
+      return true;
+    // overwritten while it was read, try again
+  }
+}
+
+// Renders the payload of a record read with logRead() as a nul terminated string
+// in text. This is where deferred messages are formatted.
+static void logText(const logHeader_t &hdr, const uint8_t *payload, char *text, size_t textsize) {
+  const char *str;
+  size_t n = (hdr.len < MSG_SIZE) ? hdr.len : MSG_SIZE;
+  switch (hdr.kind) {
+    case LOG_POINTER:
+      memcpy(&str, payload, sizeof(str));
+      strlcpy(text, str, textsize);
+      break;
+    case LOG_DEFERRED:
+      memcpy(&str, payload, sizeof(str));
+      logRenderArgs(text, textsize, str, payload + sizeof(str), n - sizeof(str));
+      break;
+    default:
+      if (n >= textsize) n = textsize - 1;
+      memcpy(text, payload, n);
+      text[n] = '\0';
+      break;
+  }
+}
+
+// Highest level of all log devices, messages with a greater level are not added to the log.
+// All levels are accepted until the configuration is loaded.
+uint8_t logMaxLevel = LOG_LEVEL_COUNT - 1;
+
+void logLevelsChanged(void) {
+  uint8_t level = config.logLevelUart;
+  if (config.logLevelSyslog > level) level = config.logLevelSyslog;
+  if (config.logLevelWebc > level) level = config.logLevelWebc;
+  if (config.logLevelMqtt > level) level = config.logLevelMqtt;
+  logMaxLevel = level;
+}
+
+// Position of the oldest record not yet checked by countOverruns() and the flag that
+// lets a single task check them
+static uint32_t logTail = 0;
+static uint8_t logTailBusy = 0;
+
+// Counts the records that start before position end, which are about to be overwritten,
+// as overruns if a device that wants them has not yet read them. The records are followed
+// from logTail by their length, the arena is only scanned word by word where there is no
+// complete record (empty arena, record overwritten by a concurrent producer). A task that
+// finds another one checking the records leaves those of its own record to it or to the
+// next producer.
+static void countOverruns(uint32_t end) {
+  if (__atomic_test_and_set(&logTailBusy, __ATOMIC_ACQUIRE))
+    return;
+  logHeader_t old;
+  uint32_t q = logTail;
+  while ((int32_t) (end - q) > 0) {
+    if (commitWord(q) != ~q) {
+      q += 4;
+      continue;
+    }
+    arenaRead(q, &old, sizeof(logHeader_t));
+    if (!validHeader(old)) {
+      q += 4;
+      continue;
+    }
+    for (int i = 0; i < SINK_COUNT; i++) {
+      if (((int32_t) (cursor[i].pos - q) <= 0) && (old.level <= sinkLevel(i))) {
+        __atomic_fetch_add(&tagStats[old.tag].overruns[old.level], 1, __ATOMIC_RELAXED);
+        break;
+      }
+    }
+    q += LOG_RECORD_SZ(old.len);
+  }
+  logTail = q;
+  __atomic_clear(&logTailBusy, __ATOMIC_RELEASE);
+}
+
+// Records being written: position of the record with the low bit set (records are
+// aligned on 4 bytes), or a lower bound of it before the room is reserved, 0 for a
+// free slot
+#define LOG_WRITERS 8
+static uint32_t logWriters[LOG_WRITERS];
+static uint32_t logBlocked = 0;       // messages dropped by writeRecord()
+
+// Returns true if the room before position end, which is about to be overwritten,
+// holds a record another producer is still writing
+static bool overwritesWriter(int slot, uint32_t end) {
+  for (int i = 0; i < LOG_WRITERS; i++) {
+    uint32_t w = __atomic_load_n(&logWriters[i], __ATOMIC_RELAXED);
+    if ((i != slot) && (w) && ((int32_t) (end - (w & ~1u)) > 0))
+      return true;
+  }
+  return false;
+}
+
+// Can be called from any task, see the description of the ring above.
+// Returns the position of the record.
+static uint32_t writeRecord(Log_level level, Log_tag tag, uint8_t kind, const void *payload, size_t len) {
+  logHeader_t hdr;
+  hdr.time = millis();
+  hdr.len = len;
+  hdr.level = level;
+  hdr.kind = kind;
+  hdr.tag = tag;
+  uint32_t size = LOG_RECORD_SZ(len);
+
+  // take a writer slot, the record will not be placed before the current head
+  int slot = 0;
+  uint32_t w = 0;
+  while (!__atomic_compare_exchange_n(&logWriters[slot], &w, logHead() | 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    w = 0;
+    if (++slot == LOG_WRITERS) {
+      __atomic_fetch_add(&logBlocked, 1, __ATOMIC_RELAXED);
+      return logHead();
+    }
+  }
+
+  // reserve room for the record, the oldest records are overwritten unless they are
+  // still being written
+  uint64_t next;
+  uint64_t reserve = __atomic_load_n(&logReserve, __ATOMIC_ACQUIRE);
+  do {
+    next = (((reserve >> 32) + 1) << 32) | (uint32_t) ((uint32_t) reserve + size);
+    if (overwritesWriter(slot, (uint32_t) next - LOG_ARENA_SZ)) {
+      __atomic_store_n(&logWriters[slot], 0, __ATOMIC_RELEASE);
+      __atomic_fetch_add(&logBlocked, 1, __ATOMIC_RELAXED);
+      return (uint32_t) reserve;
+    }
+  } while (!__atomic_compare_exchange_n(&logReserve, &reserve, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  uint32_t pos = (uint32_t) reserve;
+  hdr.seq = reserve >> 32;
+  __atomic_store_n(&logWriters[slot], pos | 1, __ATOMIC_RELAXED);
+
+  if (tag < TAG_COUNT) {
+    __atomic_fetch_add(&tagStats[tag].messages[level], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tagStats[tag].bytes[level], size, __ATOMIC_RELAXED);
+  }
+  countOverruns(pos + size - LOG_ARENA_SZ);
+
+  // write the record with an invalid commit word, so that an older record at the same
+  // place is not taken for a complete one, then commit the record
+  hdr.commit = pos;
+  arenaWrite(pos, &hdr, sizeof(logHeader_t));
+  arenaWrite(pos + sizeof(logHeader_t), payload, len);
+  __atomic_store_n((uint32_t *) &logArena[pos & (LOG_ARENA_SZ - 1)], ~pos, __ATOMIC_RELEASE);
+  __atomic_store_n(&logWriters[slot], 0, __ATOMIC_RELEASE);
+  return pos;
+}
+
+#ifdef LOG_RETAIN
+
+// Identifies the retained arena. The arena is kept only if the magic number is found,
+// the CRC is correct and the firmware is the same, since the records of messages added
+// with addToLogP() and addToLogPf() contain pointers into the firmware.
+struct logRetain_t {
+  uint32_t magic;
+  uint32_t firmware;               // first 4 bytes of the SHA256 of the firmware
+  uint32_t arenaSize;
+  uint32_t crc;                    // of the above fields
+};
+
+#define LOG_RETAIN_MAGIC 0x4C4F4752   // 'LOGR'
+
+static LOG_RETAIN_ATTR logRetain_t logRetain;
+
+static uint32_t retainCrc(const logRetain_t &r) {
+  return crc32Update(0, &r, offsetof(logRetain_t, crc));
+}
+
+static uint32_t firmwareId(void) {
+#ifdef ESP_PLATFORM
+  uint32_t id;
+  #if ESP_IDF_VERSION_MAJOR >= 5
+  memcpy(&id, esp_app_get_description()->app_elf_sha256, sizeof(id));
+  #else
+  memcpy(&id, esp_ota_get_app_description()->app_elf_sha256, sizeof(id));
+  #endif
+  return id;
+#else
+  return 0;
+#endif
+}
+
+// Finds the newest complete record in the retained arena and sets logReserve after
+// it. A record that was still being written at the reset, before the newest one,
+// would hold back the devices which wait for it to be committed, so the retained
+// records end there and the newer ones are cleared. Returns false if there is none.
+static bool logRecover(void) {
+  logHeader_t hdr;
+  bool found = false;
+  uint32_t head = 0;
+  uint32_t seq = 0;
+  for (uint32_t ofs = 0; ofs < LOG_ARENA_SZ; ofs += 4) {
+    uint32_t pos = ~commitWord(ofs);
+    if ((pos & (LOG_ARENA_SZ - 1)) != ofs)
+      continue;
+    arenaRead(pos, &hdr, sizeof(logHeader_t));
+    if (!validHeader(hdr))
+      continue;
+    if ((!found) || ((int32_t) (pos + LOG_RECORD_SZ(hdr.len) - head) > 0)) {
+      head = pos + LOG_RECORD_SZ(hdr.len);
+      seq = hdr.seq + 1;
+      found = true;
+    }
+  }
+  if (!found)
+    return false;
+
+  // follow the records from the oldest one, which is complete, and clear the room
+  // after the last one
+  uint32_t end = logResync(head);
+  while (end != head) {
+    arenaRead(end, &hdr, sizeof(logHeader_t));
+    if ((commitWord(end) != ~end) || (!validHeader(hdr)) || (LOG_RECORD_SZ(hdr.len) > head - end))
+      break;
+    seq = hdr.seq + 1;
+    end += LOG_RECORD_SZ(hdr.len);
+  }
+  for (uint32_t q = end; q != head; q += 4)
+    __atomic_store_n((uint32_t *) &logArena[q & (LOG_ARENA_SZ - 1)], 0, __ATOMIC_RELAXED);
+  logReserve = ((uint64_t) seq << 32) | end;
+  return true;
+}
+
+void logInit(void) {
+  logRetain_t r;
+  r.magic = LOG_RETAIN_MAGIC;
+  r.firmware = firmwareId();
+  r.arenaSize = LOG_ARENA_SZ;
+  r.crc = retainCrc(r);
+  if ((!memcmp(&r, &logRetain, sizeof(r))) && (logRecover())) {
+    // send the retained records to all devices
+    uint32_t head = logHead();
+    uint32_t pos = logResync(head);
+    logHeader_t hdr;
+    arenaRead(pos, &hdr, sizeof(logHeader_t));
+    for (int i = 0; i < SINK_COUNT; i++) {
+      cursor[i].pos = pos;
+      cursor[i].seq = (pos == head) ? logNext() >> 32 : hdr.seq;
+    }
+    logTail = pos;
+  #ifdef ESP_PLATFORM
+    int reason = esp_reset_reason();
+  #else
+    int reason = 0;
+  #endif
+    addToLogPf(LOG_ERR, TAG_SYSTEM, PSTR("---- Log retained from before the reset (reason %d) ends here ----"), reason);
+    return;
+  }
+  memset(logArena, 0, sizeof(logArena));
+  logReserve = 0;
+  logRetain = r;
+}
+
+#else
+
+void logInit(void) {
+}
+
+#endif
 
-uint8_t head = 0;                 // Index where next message will be inserted in ring buffer
-uint8_t tail = 0;                 // Index of the oldest message to next be send out
-uint8_t count = 0;                // Number of messages yet to be sent out
-uint8_t validcount = 0;           // Number of valid messages in the buffer, used for logHistory only
+// Each tag has a filter that removes repeated messages and limits the rate of messages.
+//
+// A message identical to the last one added with the same tag (same level, same format
+// and same arguments) within config.logRepeatWindow ms of it is only counted. Messages
+// are compared by their length and the CRC-32 of their payload, the filter does not keep
+// a copy of the last one but the position of its record in the ring. When the window
+// expires or another message with the tag is added, a single entry with the text of the
+// message, read back from the ring, followed by " (repeated N times)" is added to the log.
+//
+// Messages that are not repeats must then get a token from the tag's bucket which
+// holds at most config.logBurst[tag] tokens and is refilled at config.logRate[tag]
+// tokens per minute. Messages that find the bucket empty are counted and dropped.
+//
+// The filter of a tag is claimed with a test and set flag. A task that finds it
+// claimed by another task does not wait, the message bypasses the filter.
+
+struct logFilter_t {
+  uint8_t busy;                    // set while a task is using the filter
+  bool primed;                     // bucket has been filled
+  bool added;                      // a message has been added, the fields below are valid
+  uint8_t level;                   // level, kind, length and payload CRC of the last message added
+  uint8_t kind;
+  uint16_t len;
+  uint32_t crc;
+  uint32_t pos;                    // position of the record of the last message added
+  uint32_t since;                  // start of the current repeat window (ms)
+  uint32_t pending;                // repeats not yet reported in the log
+  uint32_t repeated;               // total number of repeated messages
+  uint32_t limited;                // total number of messages dropped by the rate limit
+  uint32_t tokens;                 // tokens in the bucket (1/1000 of a message)
+  uint32_t refilled;               // last time the bucket was refilled (ms)
+};
 
+static logFilter_t filter[TAG_COUNT];
 
-void addToLog(Log_level level, Log_tag  tag, const char *message) {
-  //Serial.printf("addToLog at head: %d, tail: %d, count (to send): %d, validcount: %d\n", head, tail, count, validcount);
-  // save the entry plus the current millisecond count
-  LogTime[head] = millis();
-  LogLevel[head] = level;
-  LogTag[head] = tag;
-  Log[head] = message;
+// Adds the entry reporting the pending repeats of the last message of the tag
+static void logRepeats(Log_tag tag, logFilter_t &f, uint32_t now) {
+  if (!f.pending)
+    return;
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  char text[MSG_SIZE];
+  uint32_t pos = f.pos;
+  if ((logRead(pos, hdr, payload)) && (pos == f.pos) && (hdr.len == f.len) && (crc32Update(0, payload, hdr.len) == f.crc))
+    logText(hdr, payload, text, sizeof(text));
+  else
+    strlcpy(text, "Last message", sizeof(text));   // its record was overwritten
+  size_t n = strlen(text);
+  snprintf_P(text + n, sizeof(text) - n, PSTR(" (repeated %u times)"), (unsigned) f.pending);
+  writeRecord((Log_level) f.level, tag, LOG_TEXT, text, strlen(text));
+  f.pending = 0;
+  f.since = now;
+}
 
-  head = (head + 1) % LOG_SIZE; // Advance head to the next slot in the ring buffer
-  count++;                      // Increment the count of messages yet to be sent out
-  if (count > LOG_SIZE) {       // If more messages to be sent out than the size of the buffer
-    tail = head;                // then move the tail to the oldest message in the buffer
-    count = LOG_SIZE;           // Can't send out more messanges than the total number in the buffer
+static bool takeToken(Log_tag tag, logFilter_t &f, uint32_t now) {
+  if (!config.logRate[tag])
+    return true;
+  uint32_t burst = 1000 * (uint32_t) config.logBurst[tag];
+  if (!f.primed) {
+    f.tokens = burst;
+    f.primed = true;
+  } else {
+    // rate messages per minute = rate/60 tokens per ms
+    uint64_t tokens = f.tokens + (uint64_t) (now - f.refilled) * config.logRate[tag] / 60;
+    f.tokens = (tokens < burst) ? tokens : burst;
   }
-  if (validcount < LOG_SIZE)    // Increment the number of valid messages up to the size of slots in the buffer
-    validcount++;               // Only used in the
+  f.refilled = now;
+  if (f.tokens < 1000)
+    return false;
+  f.tokens -= 1000;
+  return true;
+}
+
+// Adds the message to the log unless it is a repeat or exceeds the rate of its tag
+static void addRecord(Log_level level, Log_tag tag, uint8_t kind, const void *payload, size_t len) {
+  if (tag >= TAG_COUNT) {
+    writeRecord(level, tag, kind, payload, len);
+    return;
+  }
+  logFilter_t &f = filter[tag];
+  if (__atomic_test_and_set(&f.busy, __ATOMIC_ACQUIRE)) {
+    writeRecord(level, tag, kind, payload, len);
+    return;
+  }
+  uint32_t now = millis();
+  uint32_t crc = (config.logRepeatWindow) ? crc32Update(0, payload, len) : 0;
+  if ((config.logRepeatWindow) && (f.added) && (now - f.since < config.logRepeatWindow) && (level == f.level)
+    && (kind == f.kind) && (len == f.len) && (crc == f.crc)) {
+    f.pending++;
+    f.repeated++;
+  } else {
+    logRepeats(tag, f, now);
+    if (takeToken(tag, f, now)) {
+      f.added = true;
+      f.level = level;
+      f.kind = kind;
+      f.len = len;
+      f.crc = crc;
+      f.since = now;
+      f.pos = writeRecord(level, tag, kind, payload, len);
+    } else
+      f.limited++;
+  }
+  __atomic_clear(&f.busy, __ATOMIC_RELEASE);
+}
+
+// Reports the repeats of messages whose repeat window has expired
+static void logFlushRepeats(void) {
+  uint32_t now = millis();
+  for (int i = 0; i < TAG_COUNT; i++) {
+    logFilter_t &f = filter[i];
+    if ((!f.pending) || (now - f.since < config.logRepeatWindow))
+      continue;
+    if (__atomic_test_and_set(&f.busy, __ATOMIC_ACQUIRE))
+      continue;
+    logRepeats((Log_tag) i, f, now);
+    __atomic_clear(&f.busy, __ATOMIC_RELEASE);
+  }
+}
 
-  //Serial.printf("addToLog done with head: %d, tail: %d, count (to send): %d, validcount: %d, LOG_SIZE: %d\n", head, tail, count, validcount, LOG_SIZE);
+void logMessage(Log_level level, Log_tag tag, const char *message) {
+  addRecord(level, tag, LOG_TEXT, message, strnlen(message, MSG_SIZE-1));
 }
 
-void addToLogf(Log_level level, Log_tag tag, const char *format, ...) {
+void logMessagef(Log_level level, Log_tag tag, const char *format, ...) {
   va_list args;
   char msg[MSG_SIZE];
   va_start(args, format);
   vsnprintf(msg, MSG_SIZE, format, args);
   va_end(args);
-  addToLog(level, tag, msg);
+  logMessage(level, tag, msg);
 }
 
-void addToLogP(Log_level level, Log_tag tag, const char *message) {
-  char msg[MSG_SIZE];
-  strcpy_P(msg, message);
-  addToLog(level, tag, msg);
+void logMessageP(Log_level level, Log_tag tag, const char *message) {
+  addRecord(level, tag, LOG_POINTER, &message, sizeof(message));
 }
 
 /* not needed in this project
@@ -112,101 +754,592 @@ void addToLogP(Log_level level, Log_tag tag, const char *message1, const char *m
 }
 */
 
-void addToLogPf(Log_level level, Log_tag tag, const char *format, ...) {
+void logMessagePf(Log_level level, Log_tag tag, const char *format, ...) {
   va_list args;
-  char msg[MSG_SIZE];
-  char msg2[MSG_SIZE];
-  strcpy_P(msg, format);
+  uint8_t payload[MSG_SIZE];
+  memcpy(payload, &format, sizeof(format));
   va_start(args, format);
-  vsnprintf(msg2, sizeof(msg2), msg, args);
+  int n = logPackArgs(payload + sizeof(format), sizeof(payload) - sizeof(format), format, args);
+  if (n >= 0) {
+    addRecord(level, tag, LOG_DEFERRED, payload, sizeof(format) + n);
+  } else {
+    // arguments too long or not supported, format the message now
+    char msg[MSG_SIZE];
+    strcpy_P(msg, format);
+    vsnprintf((char *) payload, sizeof(payload), msg, args);
+    logMessage(level, tag, (char *) payload);
+  }
   va_end(args);
-  addToLog(level, tag, msg2);
 }
 
-// Takes care of sending the oldest message in the ring buffer to the various log devices
-// Returns the number of sent messages (0 - all messages had already been sent or 1 - one message sent)
-int sendLog(void) {
-  if (count < 1)
-    return 0;
+// Copies the tag or level name, without the nul, to p
+static size_t putName(char *p, const char *name) {
+  size_t n = strnlen(name, 7);
+  memcpy(p, name, n);
+  return n;
+}
+
+// Writes "hh:mm:ss.mmm TAG/lev: message" into buf, returns the length of the string
+static int formatLine(char *buf, size_t bufsize, const logHeader_t &hdr, const char *text, timeCache_t &cache) {
+  char head[40];
+  size_t n = formatTime(hdr.time, head, cache);
+  head[n++] = ' ';
+  n += putName(head + n, tagString[hdr.tag]);
+  head[n++] = '/';
+  n += putName(head + n, logLevelString[hdr.level]);
+  head[n++] = ':';
+  head[n++] = ' ';
+  n = std::min(n, std::min(sizeof(head), bufsize - 1));
+  memcpy(buf, head, n);
+  size_t m = strlcpy(buf + n, text, bufsize - n);
+  return (n + m < bufsize) ? n + m : bufsize - 1;
+}
 
-  // log time to string
-  char mxtime[15];
-  mstostr(LogTime[tail], mxtime, sizeof(mxtime));
-
-
-  uint8_t level = LogLevel[tail];
-  //[ ] TODO refactor following - see logHistory()
-  // message = "[tag/lev]: logmessage";
-  String message = " ";
-  message += tagString[LogTag[tail]];
-  message += "/";
-  message += logLevelString[level];
-  message += ": ";
-  message += Log[tail];
-
-  if ((level <= config.logLevelSyslog) && (wifiConnected))  {
-    String msg = config.hostname + message;
-    if (udp.connect(IPAddress(config.syslogIP), config.syslogPort))
-      udp.print(msg);
+#define SSE_MAX_WAITING 8   // Web console is busy if its clients have more messages waiting to be sent
+
+enum sinkState_t {ssDisabled, ssBusy, ssReady};
+
+static sinkState_t sinkState(int sink) {
+  switch (sink) {
+    case SINK_SYSLOG:
+      if (!config.syslogIP) return ssDisabled;
+      return (wifiConnected) ? ssReady : ssBusy;
+    case SINK_UART:
+      return (Serial.availableForWrite() > 0) ? ssReady : ssBusy;
+    case SINK_WEBC:
+      if (!events.count()) return ssDisabled;   // new clients get the log history
+      return (events.avgPacketsWaiting() < SSE_MAX_WAITING) ? ssReady : ssBusy;
+    default:
+      if (!strlen(configString(csMqttHost))) return ssDisabled;
+      return (mqttIsConnected()) ? ssReady : ssBusy;
+  }
+}
+
+// Text of the last rendered record, so that a message is formatted only once
+// when the devices are in step
+static uint32_t renderedPos = 1;   // never a record position which are multiples of 4
+static logHeader_t renderedHdr;
+static char renderedText[MSG_SIZE];
+
+// Finds the next record at or after the cursor that the device wants and renders it.
+// Records that are not wanted are skipped, messages that were overwritten before
+// being read are counted as dropped. Returns false if there is none.
+static bool nextRecord(int sink) {
+  logCursor_t &c = cursor[sink];
+  uint8_t level = sinkLevel(sink);
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  for (;;) {
+    if (c.pos == renderedPos) {
+      hdr = renderedHdr;
+    } else {
+      if (!logRead(c.pos, hdr, payload))
+        return false;
+      if (hdr.level <= level) {
+        renderedHdr = hdr;
+        logText(hdr, payload, renderedText, sizeof(renderedText));
+        renderedPos = c.pos;
+      }
+    }
+    c.dropped += hdr.seq - c.seq;   // 0 unless the cursor was resynchronized
+    c.seq = hdr.seq;
+    if (hdr.level <= level)
+      return true;
+    c.pos += LOG_RECORD_SZ(hdr.len);
+    c.seq++;
+  }
+}
+
+#define LOG_BATCH_SZ 1024   // Size of the buffer in which consecutive messages to a device are combined
+
+static char batch[LOG_BATCH_SZ];
+
+// Maximum length of a batch of messages sent to the device in one write. A batch
+// always contains at least one message. Room is kept for the terminating nul.
+static size_t batchSize(int sink) {
+  const size_t overhead = MQTT_TOPIC_SZ + HOSTNAME_SZ + 8;
+  switch (sink) {
+    case SINK_MQTT:    // the whole MQTT packet must fit in the PubSubClient buffer
+      if (config.mqttBufferSize <= overhead)
+        return 1;
+      if (config.mqttBufferSize - overhead < LOG_BATCH_SZ - 2)
+        return config.mqttBufferSize - overhead;
+      return LOG_BATCH_SZ - 2;
+    default:
+      return LOG_BATCH_SZ - 2;
+  }
+}
+
+// Syslog messages are sent in RFC 5424 format
+//   <PRI>1 - HOSTNAME APP-NAME - MSGID - MSG
+// with the user-level facility, no timestamp, no process id, the log tag as
+// message id and no structured data. Consecutive messages with the same level
+// and tag are combined in a single datagram, separated by line feeds in MSG.
+// The udp socket is connected once and reconnected only if config.syslogIP or
+// config.syslogPort is changed.
+
+#define SYSLOG_APP_NAME  "wifi_switch"
+#define SYSLOG_FACILITY  1           // user-level messages
+
+static const uint8_t syslogSeverity[LOG_LEVEL_COUNT] = {
+  3,  // LOG_ERR   - error conditions
+  6,  // LOG_INFO  - informational
+  7   // LOG_DEBUG - debug-level messages
+};
+
+static uint32_t syslogIP = 0;        // address and port to which udp is connected
+static uint16_t syslogPort = 0;
+static char syslogHost[HOSTNAME_SZ] = {0};
+static char syslogHeader[HOSTNAME_SZ + 24] = {0}; // " HOSTNAME APP-NAME - " rendered when the host name changes
+
+static bool syslogOpen(void) {
+  if ((syslogIP != config.syslogIP) || (syslogPort != config.syslogPort) || (!udp.connected())) {
     udp.close();
+    syslogIP = 0;
+    if (!udp.connect(IPAddress(config.syslogIP), config.syslogPort))
+      return false;
+    syslogIP = config.syslogIP;
+    syslogPort = config.syslogPort;
   }
+  if (strcmp(syslogHost, configString(csHostname))) {
+    strlcpy(syslogHost, configString(csHostname), sizeof(syslogHost));
+    snprintf_P(syslogHeader, sizeof(syslogHeader), PSTR(" %s %s - "), (syslogHost[0]) ? syslogHost : "-", SYSLOG_APP_NAME);
+  }
+  return true;
+}
+
+// Writes the syslog header "<PRI>1 - HOSTNAME APP-NAME - MSGID - " of the rendered record into buf
+static int syslogPrefix(char *buf, size_t bufsize) {
+  int n = snprintf_P(buf, bufsize, PSTR("<%d>1 -%s%s - "), SYSLOG_FACILITY*8 + syslogSeverity[renderedHdr.level],
+    syslogHeader, tagString[renderedHdr.tag]);
+  return (n < (int) bufsize) ? n : bufsize - 1;
+}
 
-  message = String(mxtime) + message;
+// Writes the rendered record as it is sent to the device into buf
+static int sinkLine(int sink, char *buf, size_t bufsize) {
+  if (sink == SINK_SYSLOG) {
+    // message = "logmessage", the tag and level are in the header
+    int n = strlcpy(buf, renderedText, bufsize);
+    return (n < (int) bufsize) ? n : bufsize - 1;
+  }
+  // message = "hh:mm:ss.mmm TAG/lev: logmessage";
+  static timeCache_t cache = TIME_CACHE_INIT;
+  return formatLine(buf, bufsize, renderedHdr, renderedText, cache);
+}
 
-  if (level <= config.logLevelUart) {
-    Serial.printf("%s\n", message.c_str());
-    //Serial.flush(); //don't do this - uart logging will be blocking, especially if Serial not opened
+// Writes a batch of len bytes to the device, returns false if it could not be sent
+static bool sendToSink(int sink, size_t len) {
+  switch (sink) {
+    case SINK_SYSLOG:
+      return (udp.write((uint8_t *) batch, len) == len);
+    case SINK_UART:
+      Serial.write(batch, len);
+      //Serial.flush(); //don't do this - uart logging will be blocking, especially if Serial not opened
+      return true;
+    case SINK_WEBC:
+      events.send(batch, "logvalue");
+      return true;
+    default:
+      return mqttLog(batch);
   }
+}
+
+// Updates the statistics of the device with a write that took t us
+static void countWrite(int sink, unsigned long t) {
+  logSinkStats_t &st = sinkStats[sink];
+  st.sends++;
+  st.time += t;
+  int bucket = 0;
+  for (t >>= 3; (t) && (bucket < LOG_LATENCY_BUCKETS - 1); t >>= 1)
+    bucket++;
+  st.latency[bucket]++;
+}
+
+// The UART is given no more than its transmit buffer can take so that writing to it
+// never blocks loop(). A line that does not fit is written in pieces, uartOffset bytes
+// of the line of the record at uartPos have already been written.
+static uint32_t uartPos = 1;   // never a record position
+static size_t uartOffset = 0;
 
-  if (level <= config.logLevelWebc) {
-    //dbg:: Serial.println("log sending to webc");
-    events.send(message.c_str(),"logvalue");
+// Writes lines, each followed by a line feed, to the UART while they fit in its transmit
+// buffer and the time budget of the pass that started at start (micros()) is not
+// exhausted. Returns the number of messages completely written.
+static int sendUart(unsigned long start) {
+  char line[MSG_SIZE + 24];
+  size_t room = Serial.availableForWrite();
+  if (room > LOG_BATCH_SZ)
+    room = LOG_BATCH_SZ;
+  size_t len = 0;
+  int count = 0;
+  while ((len < room) && (nextRecord(SINK_UART))) {
+    logCursor_t &c = cursor[SINK_UART];
+    if (c.pos != uartPos)
+      uartOffset = 0;    // a new line, or the rest of the previous one was overwritten
+    size_t n = sinkLine(SINK_UART, line, sizeof(line) - 1);
+    line[n++] = '\n';
+    size_t m = std::min(n - uartOffset, room - len);
+    memcpy(batch + len, line + uartOffset, m);
+    len += m;
+    uartOffset += m;
+    uartPos = c.pos;
+    if (uartOffset < n)
+      break;             // the rest of the line is written in a later pass
+    uartOffset = 0;
+    uartPos = 1;
+    c.pos += LOG_RECORD_SZ(renderedHdr.len);
+    c.seq++;
+    count++;
+    if (micros() - start >= config.sendBudget)
+      break;
   }
+  if (!len)
+    return 0;
+  unsigned long t = micros();
+  sendToSink(SINK_UART, len);
+  countWrite(SINK_UART, micros() - t);
+  cursor[SINK_UART].sent += count;
+  return count;
+}
 
-  if (level <= config.logLevelMqtt) {
-    //dbg:: Serial.println("log sending to webc");
-    mqttLog(message);
+// Combines consecutive messages for a device, separated by line feeds, into one write.
+// At least one message is sent, more are added while they fit in the batch and the
+// time budget of the pass that started at start (micros()) is not exhausted.
+// Returns the number of messages sent.
+static int sendBatch(int sink, unsigned long start) {
+  char line[HOSTNAME_SZ + MSG_SIZE + 24];
+  size_t maxlen = batchSize(sink);
+  size_t len = 0;
+  int count = 0;
+  logHeader_t first;
+  if (sink == SINK_UART)
+    return sendUart(start);
+  if ((sink == SINK_SYSLOG) && (!syslogOpen()))
+    return 0;
+  while (nextRecord(sink)) {
+    if (count == 0) {
+      first = renderedHdr;
+      if (sink == SINK_SYSLOG)
+        len = syslogPrefix(batch, maxlen);
+    } else if ((sink == SINK_SYSLOG) && ((renderedHdr.level != first.level) || (renderedHdr.tag != first.tag)))
+      break;  // a syslog message has a single severity and message id
+    int n = sinkLine(sink, line, sizeof(line));
+    if ((count > 0) && (len + 1 + n > maxlen))
+      break;
+    if (count > 0)
+      batch[len++] = '\n';
+    memcpy(batch + len, line, n);
+    len += n;
+    cursor[sink].pos += LOG_RECORD_SZ(renderedHdr.len);
+    cursor[sink].seq++;
+    count++;
+    if (micros() - start >= config.sendBudget)
+      break;
+  }
+  if (!count)
+    return 0;
+  batch[len] = '\0';
+  unsigned long t = micros();
+  bool ok = sendToSink(sink, len);
+  countWrite(sink, micros() - t);
+  if (!ok) {
+    cursor[sink].dropped += count;
+    return 0;
   }
+  cursor[sink].sent += count;
+  return count;
+}
 
-  // remove the log message from the ring buffer
-  tail = (tail + 1) % LOG_SIZE;   // move the tail to the next message to send
-  count--;                        // reduce the count of message to be sent
-  return 1;
+// Takes care of sending the oldest messages not yet sent to each log device.
+// A device that is disabled skips all pending messages, a device that is busy
+// or not connected keeps its messages until it is ready or they are removed
+// from the ring.
+// Devices are served in turn, each one sending a batch of messages, until all
+// messages are sent or the config.sendBudget time budget is exhausted.
+// Returns the number of messages sent, 0 if all messages had been sent to the ready devices.
+int sendLog(void) {
+  unsigned long start = micros();
+  int count = 0;
+  int sent;
+  logFlushRepeats();
+  do {
+    sent = 0;
+    uint64_t next = logNext();
+    for (int i = 0; i < SINK_COUNT; i++) {
+      if (cursor[i].pos == (uint32_t) next)
+        continue;
+      switch (sinkState(i)) {
+        case ssDisabled:
+          cursor[i].pos = (uint32_t) next;
+          cursor[i].seq = next >> 32;
+          break;
+        case ssReady:
+          sent += sendBatch(i, start);
+          break;
+        default:
+          break;
+      }
+    }
+    count += sent;
+  } while ((sent) && (micros() - start < config.sendBudget));
+  sendLogCalls++;
+  sendLogTime += micros() - start;
+  return count;
 }
 
 void flushLog(void) {
   // send out any queued messages;
-  while (count) {
-    sendLog();
+  while (sendLog()) {
     delay(50);  // needed ??
   }
 }
 
-String logHistory(void) {
-  //Serial.printf("logHistory, validcount: %d\n", validcount);
-  char mxtime[15];
-  String hist;
-  String msg;
-  if (validcount > 0) {
-    int j = (validcount < LOG_SIZE) ? 0 : head;
-    //Serial.printf("  - starting j: %d, head: %d\n", j, head);
-    //Serial.print("  j: ");
-    for (int i=0; i<validcount; i++) {
-      //Serial.printf("%d, ", j);
-      if (LogLevel[j] <= config.logLevelWebc) {
-        //[ ] TODO refactor following !
-        mstostr(LogTime[j], mxtime, sizeof(mxtime));
-        msg = String(mxtime);
-        msg += " ";
-        msg += tagString[LogTag[j]];
-        msg += "/";
-        msg += logLevelString[LogLevel[j]];
-        msg += ": " + Log[j] + "\n";
-        hist += msg;
-      }
-      j = (j+1) % LOG_SIZE;
+void logLogStatus(void) {
+  for (int i = 0; i < SINK_COUNT; i++) {
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log %s: %u sent, %u dropped, %u bytes pending"), sinkString[i],
+      (unsigned) cursor[i].sent, (unsigned) cursor[i].dropped, (unsigned) (logHead() - cursor[i].pos));
+  }
+}
+
+void logStatistics(bool reset) {
+  if (reset) {
+    memset(tagStats, 0, sizeof(tagStats));
+    memset(sinkStats, 0, sizeof(sinkStats));
+    sendLogCalls = 0;
+    sendLogTime = 0;
+    logBlocked = 0;
+    addToLogP(LOG_INFO, TAG_COMMAND, PSTR("Log statistics reset"));
+    return;
+  }
+  char buf[MSG_SIZE];
+  for (int i = 0; i < TAG_COUNT; i++) {
+    const logTagStats_t &st = tagStats[i];
+    int n = 0;
+    for (int k = 0; k < LOG_LEVEL_COUNT; k++) {
+      if ((st.messages[k]) && (n < (int) sizeof(buf)))
+        n += snprintf_P(buf + n, sizeof(buf) - n, PSTR("%s%s %u msg %u B %u lost"), (n) ? ", " : "", logLevelString[k],
+          (unsigned) st.messages[k], (unsigned) st.bytes[k], (unsigned) st.overruns[k]);
+    }
+    if (n)
+      addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log stats %s: %s"), tagString[i], buf);
+  }
+  for (int i = 0; i < SINK_COUNT; i++) {
+    const logSinkStats_t &st = sinkStats[i];
+    int n = 0;
+    for (int k = 0; k < LOG_LATENCY_BUCKETS; k++) {
+      if ((st.latency[k]) && (n < (int) sizeof(buf)))
+        n += snprintf_P(buf + n, sizeof(buf) - n, PSTR(" %s%u:%u"), (k < LOG_LATENCY_BUCKETS - 1) ? "<" : ">=",
+          (k < LOG_LATENCY_BUCKETS - 1) ? 8u << k : 8u << (k - 1), (unsigned) st.latency[k]);
+    }
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log stats %s: %u writes in %llu us, latency us%s"), sinkString[i],
+      (unsigned) st.sends, (unsigned long long) st.time, (n) ? buf : " -");
+  }
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log stats sendLog: %u calls in %llu us"), (unsigned) sendLogCalls,
+    (unsigned long long) sendLogTime);
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log stats ring: %u messages blocked by a preempted writer"), (unsigned) logBlocked);
+}
+
+void logFilterStatus(void) {
+  for (int i = 0; i < TAG_COUNT; i++) {
+    addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Log %s: rate %u/min, burst %u, %u repeated, %u limited"), tagString[i],
+      (unsigned) config.logRate[i], (unsigned) config.logBurst[i], (unsigned) filter[i].repeated, (unsigned) filter[i].limited);
+  }
+}
+
+void logHistoryBegin(logHistory_t &hist) {
+  hist.end = logHead();
+  hist.pos = logResync(hist.end);
+  hist.len = 0;
+  hist.offset = 0;
+}
+
+// Copies what fits of the entry of n bytes, from offset on, into the size bytes of buf
+// after len. Returns false if the entry does not fit, offset is then the part of the
+// entry copied.
+static bool copyEntry(uint8_t *buf, size_t size, size_t &len, const uint8_t *entry, size_t n, size_t &offset) {
+  size_t m = std::min(n - offset, size - len);
+  memcpy(buf + len, entry + offset, m);
+  len += m;
+  offset += m;
+  return (offset == n);
+}
+
+static_assert(LOG_LINE_SZ >= MSG_SIZE + 25, "LOG_LINE_SZ too small");
+
+size_t logHistoryRead(logHistory_t &hist, char *buf, size_t size) {
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  char text[MSG_SIZE];
+  size_t len = 0;
+  timeCache_t cache = TIME_CACHE_INIT;
+  for (;;) {
+    if (hist.len) {
+      if (!copyEntry((uint8_t *) buf, size, len, (uint8_t *) hist.line, hist.len, hist.offset))
+        break;             // the rest of the entry starts the next piece
+      hist.len = 0;
+      hist.offset = 0;
+    }
+    if (((int32_t) (hist.end - hist.pos) <= 0) || (len == size))
+      break;
+    uint32_t pos = hist.pos;
+    if (!logRead(pos, hdr, payload))
+      return (len) ? len : RESPONSE_TRY_AGAIN;   // still being written
+    if ((int32_t) (hist.end - pos) <= 0) {
+      hist.pos = hist.end;
+      break;
+    }
+    hist.pos = pos + LOG_RECORD_SZ(hdr.len);
+    if (hdr.level <= config.logLevelWebc) {
+      logText(hdr, payload, text, sizeof(text));
+      hist.len = formatLine(hist.line, sizeof(hist.line) - 1, hdr, text, cache);
+      hist.line[hist.len++] = '\n';
+    }
+  }
+  return len;
+}
+
+// Binary log export, see logging.h for the format
+
+#define LOG_BIN_VERSION  1
+#define LOG_BIN_DEF      1
+#define LOG_BIN_TEXT     2
+#define LOG_BIN_STRING   3
+#define LOG_BIN_FORMAT   4
+
+static size_t putVarint(uint8_t *buf, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    buf[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  buf[n++] = value;
+  return n;
+}
+
+static size_t putString(uint8_t *buf, const char *str, size_t size) {
+  size_t n = strnlen(str, size - 1);
+  memcpy(buf, str, n);
+  buf[n] = 0;
+  return n + 1;
+}
+
+static size_t binaryHeader(uint8_t *buf) {
+  size_t n = 0;
+  memcpy(buf, "LOGB", 4);
+  n += 4;
+  buf[n++] = LOG_BIN_VERSION;
+  buf[n++] = sizeof(int);
+  buf[n++] = sizeof(long);
+  buf[n++] = sizeof(long long);
+  buf[n++] = sizeof(size_t);
+  buf[n++] = sizeof(double);
+  buf[n++] = sizeof(void *);
+  buf[n++] = TAG_COUNT;
+  for (int i = 0; i < TAG_COUNT; i++)
+    n += putString(buf + n, tagString[i], 8);
+  buf[n++] = LOG_LEVEL_COUNT;
+  for (int i = 0; i < LOG_LEVEL_COUNT; i++)
+    n += putString(buf + n, logLevelString[i], 8);
+  return n;
+}
+
+// Returns the id of format in the interned strings of bin. A new format is added to bin
+// and its definition is written into buf. Returns -1 if there is no room for a new format.
+static int internFormat(logBinary_t &bin, const char *format, uint8_t *buf, size_t &n) {
+  for (int i = 0; i < bin.formats; i++) {
+    if (bin.format[i] == format)
+      return i;
+  }
+  if (bin.formats >= LOG_BIN_FORMATS)
+    return -1;
+  buf[n++] = LOG_BIN_DEF;
+  n += putVarint(buf + n, bin.formats);
+  n += putString(buf + n, format, MSG_SIZE);
+  bin.format[bin.formats] = format;
+  return bin.formats++;
+}
+
+static_assert(LOG_BIN_ENTRY_SZ >= 2*MSG_SIZE + 24, "LOG_BIN_ENTRY_SZ too small");
+static_assert(LOG_BIN_ENTRY_SZ >= 12 + (TAG_COUNT + LOG_LEVEL_COUNT)*8, "LOG_BIN_ENTRY_SZ too small");
+
+void logBinaryBegin(logBinary_t &bin) {
+  bin.end = logHead();
+  bin.pos = logResync(bin.end);
+  bin.time = 0;
+  bin.len = 0;
+  bin.offset = 0;
+  bin.started = false;
+  bin.formats = 0;
+}
+
+// Builds the entry of a record into bin.entry, returns its length.
+static size_t binaryEntry(logBinary_t &bin, const logHeader_t &hdr, uint8_t *payload) {
+  uint8_t *entry = bin.entry;
+  const char *str = NULL;
+  size_t n = 0;
+  int id = -1;
+  if (hdr.kind != LOG_TEXT) {
+    memcpy(&str, payload, sizeof(str));
+    id = internFormat(bin, str, entry, n);
+  }
+  uint8_t type = (id < 0) ? LOG_BIN_TEXT : (hdr.kind == LOG_POINTER) ? LOG_BIN_STRING : LOG_BIN_FORMAT;
+  int32_t delta = hdr.time - bin.time;
+  bin.time = hdr.time;
+  entry[n++] = type;
+  entry[n++] = hdr.tag | (hdr.level << 6);
+  n += putVarint(entry + n, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+  if (type == LOG_BIN_TEXT) {
+    char *text = (char *) payload;
+    if (hdr.kind != LOG_TEXT) {
+      // no more room for interned formats, send the message rendered
+      uint8_t args[MSG_SIZE];
+      memcpy(args, payload, sizeof(args));
+      logText(hdr, args, text, MSG_SIZE);
+    } else
+      text[(hdr.len < MSG_SIZE) ? hdr.len : MSG_SIZE - 1] = 0;
+    size_t tlen = strlen(text);
+    n += putVarint(entry + n, tlen);
+    memcpy(entry + n, text, tlen);
+    n += tlen;
+  } else {
+    n += putVarint(entry + n, id);
+    if (type == LOG_BIN_FORMAT) {
+      size_t alen = hdr.len - sizeof(str);
+      n += putVarint(entry + n, alen);
+      memcpy(entry + n, payload + sizeof(str), alen);
+      n += alen;
+    }
+  }
+  return n;
+}
+
+// An entry that does not fit in a piece is kept in bin and continued in the next piece,
+// so it is sent whole even if its record is overwritten in between.
+size_t logBinaryRead(logBinary_t &bin, uint8_t *buf, size_t size) {
+  logHeader_t hdr;
+  uint8_t payload[MSG_SIZE];
+  size_t len = 0;
+  if (!bin.started) {
+    bin.len = binaryHeader(bin.entry);
+    bin.started = true;
+  }
+  for (;;) {
+    if (bin.len) {
+      if (!copyEntry(buf, size, len, bin.entry, bin.len, bin.offset))
+        break;             // the rest of the entry starts the next piece
+      bin.len = 0;
+      bin.offset = 0;
+    }
+    if (((int32_t) (bin.end - bin.pos) <= 0) || (len == size))
+      break;
+    uint32_t pos = bin.pos;
+    if (!logRead(pos, hdr, payload))
+      return (len) ? len : RESPONSE_TRY_AGAIN;   // still being written
+    if ((int32_t) (bin.end - pos) <= 0) {
+      bin.pos = bin.end;
+      break;
     }
-    //Serial.printf("\n  - starts with %s\n", hist.substring(0, 64).c_str());
+    bin.pos = pos + LOG_RECORD_SZ(hdr.len);
+    bin.len = binaryEntry(bin, hdr, payload);
   }
-  return hist;
+  return len;
 }
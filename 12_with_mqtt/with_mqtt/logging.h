@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arduino_config.h"  // LOG_COMPILE_LEVEL may be defined there
 #include <Arduino.h>
 
 /*
@@ -39,14 +40,22 @@ enum Log_tag {
 
 /*
  * A string or strings sent to the log with any of the logging functions will be stored in a
- * circular queue.
+ * circular queue. The logging functions can be called from any task (loop, Ticker, async_tcp)
+ * without locking.
  *
- * When sendLog() is invoked the oldest entry in the queue, that has not already been sent, will
+ * Each log device keeps its own position in the queue. When sendLog() is invoked the oldest
+ * entry in the queue that has not already been sent to a device will be
  *  a) sent to the syslog server if level has a higher or equal priority to config.logLevelSyslog
  *  b) printed to the serial port if level has a higher or equal priority to config.logLevelUart
  *  c) sent to the web server if level has a higher or equal priority to config.logLevelWeb
  *  d) sent to the mqtt server if level has a higher or equal priority to config.logLevelMqtt
- *  // NOTE: (d) NOT YET IMPLEMENTED
+ * A device that is not ready (Wi-Fi or MQTT broker not connected, web clients or serial port
+ * not keeping up) does not hold back the others. Entries removed from the queue before being
+ * sent to a device are counted as dropped for that device.
+ *
+ * Identical messages repeated within config.logRepeatWindow ms are collapsed into a single
+ * entry ending with "(repeated N times)" and the number of messages per minute of each tag
+ * can be limited with config.logRate[] and config.logBurst[] (see addRecord() in logging.cpp).
  *
  * To see the syslog messages as they come in on the system log server thepi.local
  *    pi@thepi:~$ sudo tail -f /var/log/syslog
@@ -61,17 +70,66 @@ enum Log_tag {
  * Mar 30 23:04:26 test message
  */
 
-  // Typical use: sendToLog(LOG_INFO, TAG_SYSTEM, "Some information");
-void addToLog(Log_level level, Log_tag tag, const char *message);
+/*
+ * Level gating
+ *
+ * The addToLogxxx() functions are macros that skip the call, including the evaluation
+ * of its arguments, when the level of the message is not wanted.
+ *
+ *  a) Messages with a level greater than LOG_COMPILE_LEVEL are removed at compile time.
+ *     Set it in the build flags of platformio.ini (-DLOG_COMPILE_LEVEL=LOG_INFO) or in
+ *     arduino_config.h. By default all levels are compiled.
+ *  b) Messages with a level greater than the highest level of the four log devices
+ *     (config.logLevelUart, ...Syslog, ...Webc and ...Mqtt) are skipped at run time. That
+ *     level is cached in logMaxLevel which must be updated with logLevelsChanged() whenever
+ *     one of the config.logLevelxxx is modified.
+ */
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+extern uint8_t logMaxLevel;
 
-  // Typical use: sendToLogf(LOG_INFO, TAG_HARDWARE, "Count: %d, free: %d at %s", 32, 12498, "some_string");
-void addToLogf(Log_level level, Log_tag tag, const char *format, ...);
+  // Updates logMaxLevel, call after changing any of the config.logLevelxxx
+void logLevelsChanged(void);
 
-  // Typical use: sendToLogP(LOG_ERR, TAG_SYSTEM, PSTR("Fatal Error"));
-void addToLogP(Log_level level, Log_tag tag, const char *message);
+  // True if a message with the given level would be added to the log
+#define logLevelEnabled(level) (((level) <= LOG_COMPILE_LEVEL) && ((level) <= logMaxLevel))
 
-  // Typical use: sendToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("Count: %d, free: %d at %s"), 32, 12498, "some_string");
-void addToLogPf(Log_level level, Log_tag tag, const char *format, ...);
+  // Adds a copy of the message to the log.
+  // Typical use: addToLog(LOG_INFO, TAG_SYSTEM, "Some information");
+#define addToLog(level, tag, message) \
+  do { if (logLevelEnabled(level)) logMessage(level, tag, message); } while (0)
+
+  // Formats the message with vsnprintf() when it is added to the log.
+  // Typical use: addToLogf(LOG_INFO, TAG_HARDWARE, "Count: %d, free: %d at %s", 32, 12498, "some_string");
+#define addToLogf(level, tag, ...) \
+  do { if (logLevelEnabled(level)) logMessagef(level, tag, __VA_ARGS__); } while (0)
+
+  // The message must be a PSTR() or string literal, only a pointer to it is stored in the log.
+  // Typical use: addToLogP(LOG_ERR, TAG_SYSTEM, PSTR("Fatal Error"));
+#define addToLogP(level, tag, message) \
+  do { if (logLevelEnabled(level)) logMessageP(level, tag, message); } while (0)
+
+  // The format must be a PSTR() or string literal. Formatting is deferred until the message is
+  // sent to a log device that wants it or is shown in the log history, only the arguments
+  // are stored in the log (see logformat.h).
+  // Typical use: addToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("Count: %d, free: %d at %s"), 32, 12498, "some_string");
+#define addToLogPf(level, tag, ...) \
+  do { if (logLevelEnabled(level)) logMessagePf(level, tag, __VA_ARGS__); } while (0)
+
+  // Prepares the log, must be called at the start of setup() before adding to the log.
+  // With the LOG_RETAIN build flag, the messages logged before a warm reset are kept,
+  // followed by a marker message, and will be sent to the log devices.
+void logInit(void);
+
+  // The functions behind the addToLogxxx() macros, they add the message to the log
+  // without checking its level.
+void logMessage(Log_level level, Log_tag tag, const char *message);
+void logMessagef(Log_level level, Log_tag tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void logMessageP(Log_level level, Log_tag tag, const char *message);
+void logMessagePf(Log_level level, Log_tag tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
 
   // Transmits the oldest message in the log buffer not already sent.
   // Call in the loop() when it should be safe to access the Serial device, etc.
@@ -80,8 +138,79 @@ int sendLog(void);
   // Sends all queued log messages
 void flushLog(void);
 
+  // Reports the number of messages sent and dropped by each log device to the log
+void logLogStatus(void);
+
+  // Reports the number of messages, ring bytes and overruns of each tag and level, and the
+  // number, duration and latency histogram of the writes to each log device to the log.
+  // The statistics are cleared instead if reset is true.
+void logStatistics(bool reset = false);
+
+  // Reports the rate limit and the number of repeated and rate limited messages of each tag to the log
+void logFilterStatus(void);
+
 void mstostr(unsigned long milli, char* sbuf, int sbufsize);
 
-// Returns the content of the log from the oldest entry to the newest
-// in one string where each entry is terminated with a line feed.
-String logHistory(void);
+// Reading the log history, from the oldest entry to the newest, in pieces so that
+// it can be streamed in a chunked HTTP response without holding it in memory.
+// An entry that does not fit in a piece is kept and continued in the next one.
+
+#define LOG_LINE_SZ 276   // Size of the longest line of the log history
+
+struct logHistory_t {
+  uint32_t pos;    // position of the next entry to read
+  uint32_t end;    // position of the newest entry when reading started, excluded
+  size_t len;      // length of the entry being read, 0 if none
+  size_t offset;   // bytes of the entry already read
+  char line[LOG_LINE_SZ];
+};
+
+  // Starts reading the log history
+void logHistoryBegin(logHistory_t &hist);
+
+  // Copies the entries of the log history into buf while they fit, each one terminated
+  // with a line feed (not nul terminated), the last one possibly in part. Returns the
+  // number of bytes copied, 0 once the history has been read, or RESPONSE_TRY_AGAIN
+  // if the next entry is still being written by another task.
+size_t logHistoryRead(logHistory_t &hist, char *buf, size_t size);
+
+// Binary export of the log, roughly half the size of the log history.
+//
+// All multi-byte values are little-endian, varint is an unsigned LEB128 number.
+// The stream starts with a header
+//   "LOGB" version:u8
+//   sizeof int, long, long long, size_t, double, void *:u8 x 6
+//   tag count:u8, tag names as nul terminated strings
+//   level count:u8, level names as nul terminated strings
+// followed by entries starting with a type byte
+//   1 DEF     id:varint string (nul terminated)          defines an interned string
+//   2 TEXT    tl dt len:varint text (len bytes)          message text
+//   3 STRING  tl dt id:varint                            message is the interned string
+//   4 FORMAT  tl dt id:varint len:varint args (len bytes) interned format with packed arguments (see logformat.h)
+// where tl is the tag in the lower 6 bits and the level in the upper 2 bits, and dt the
+// difference in ms with the time of the previous message as a zigzag encoded varint.
+// Each format string is sent once per stream and referred to by id in later entries.
+// The tools/logdecode.cpp host program converts the stream back to the log history text.
+
+#define LOG_BIN_FORMATS 48   // Maximum number of interned strings in a stream
+#define LOG_BIN_ENTRY_SZ 528 // Size of the longest entry
+
+struct logBinary_t {
+  uint32_t pos;      // position of the next entry to read
+  uint32_t end;      // position of the newest entry when reading started, excluded
+  uint32_t time;     // time of the previous message
+  size_t len;        // length of the header or entry being read, 0 if none
+  size_t offset;     // bytes of the header or entry already read
+  bool started;      // true once the header is built
+  uint8_t formats;   // number of interned strings
+  const char *format[LOG_BIN_FORMATS];
+  uint8_t entry[LOG_BIN_ENTRY_SZ];
+};
+
+  // Starts the binary export of the log
+void logBinaryBegin(logBinary_t &bin);
+
+  // Copies the entries of the binary export into buf while they fit, the last one
+  // possibly in part. Returns the number of bytes copied, 0 once the log has been
+  // exported, or RESPONSE_TRY_AGAIN if the next entry is still being written.
+size_t logBinaryRead(logBinary_t &bin, uint8_t *buf, size_t size);
@@ -13,6 +13,7 @@
 #include "mqtt.hpp"
 #include "domoticz.h"
 #include "commands.hpp"
+#include "rules.h"
 
 /*
 0 = saveConfig() if changed
@@ -54,8 +55,8 @@ void espRestart(int level = 0) {
       config.staStaticIP = 0;
       config.staNetmask = 0;
       config.staGateway = 0;
-      config.wifiSsid[0] = '\0';
-      config.wifiPswd[0] = '\0';
+      configSetString(csWifiSsid, "");
+      configSetString(csWifiPswd, "");
       saveConfig(true);
       break;
   }
@@ -88,7 +89,18 @@ void inputModule() {
   }
 }
 
+// Loads the rules saved by the rule command
+void loadRules(void) {
+  uint8_t code[RULES_CODE_SZ];
+  size_t len = configLoadData(RULES_NVS_KEY, code, sizeof(code));
+  if (!rulesSetCode(code, len))
+    addToLogP(LOG_ERR, TAG_SYSTEM, PSTR("Invalid rules in NVS ignored"));
+  else if (len)
+    addToLogPf(LOG_INFO, TAG_SYSTEM, PSTR("Loaded %d rules"), rulesCount());
+}
+
 void setup() {
+  logInit();
   addToLogPf(LOG_INFO, TAG_SYSTEM, PSTR("Firmware version %s"), FirmwareVersion().c_str());
   addToLogP(LOG_DEBUG, TAG_SYSTEM, PSTR("Starting setup()"));
 
@@ -99,6 +111,8 @@ void setup() {
 #endif
   delay(2000); // should be sufficient for USB serial to be up if connected
   loadConfig();
+  loadRules();
+  loadScripts();
   wifiConnect();
   webserversetup();
   mqttClientSetup();
@@ -112,4 +126,7 @@ void loop() {
   wifiLoop();
   inputModule();
   mqttLoop();
+  commandLoop();
+  scriptLoop();
+  configLoop();
 }
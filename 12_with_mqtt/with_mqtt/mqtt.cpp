@@ -16,20 +16,32 @@ WiFiClient mqttClient;
 PubSubClient mqtt_client(mqttClient);
 
 void mqttLogStatus(void) {
-  if (!strlen(config.mqttHost))
+  if (!strlen(configString(csMqttHost)))
     addToLogP(LOG_INFO, TAG_MQTT, PSTR("No MQTT broker defined"));
   else {
     String connected;
     connected = (mqtt_client.connected()) ? "Connected" : "Not connected";
-    addToLogPf(LOG_INFO, TAG_MQTT, PSTR("%s to MQTT broker %s:%d"), connected.c_str(), config.mqttHost, config.mqttPort);
+    addToLogPf(LOG_INFO, TAG_MQTT, PSTR("%s to MQTT broker %s:%d"), connected.c_str(), configString(csMqttHost), config.mqttPort);
   }
 }
 
+// Copies topic into buf replacing the %h% placeholder with the host name
+static void expandTopic(char *buf, size_t bufsize, const char *topic) {
+  const char *ph = strstr(topic, "%h%");
+  if (!ph) {
+    strlcpy(buf, topic, bufsize);
+    return;
+  }
+  snprintf_P(buf, bufsize, PSTR("%.*s%s%s"), (int) (ph - topic), topic, configString(csHostname), ph + 3);
+}
+
 void mqttSubscribe(void) {
-  mqtt_client.subscribe(config.topicDmtzSub);
-  String topic(config.topicCmd);
-  topic.replace("%h%", config.hostname);
-  mqtt_client.subscribe(topic.c_str());
+  mqtt_client.subscribe(configString(csTopicDmtzSub));
+  char topic[MQTT_TOPIC_SZ + HOSTNAME_SZ + 2];
+  expandTopic(topic, sizeof(topic) - 2, configString(csTopicCmd));
+  mqtt_client.subscribe(topic);
+  strcat(topic, "/+");        // commands with a correlation id
+  mqtt_client.subscribe(topic);
 }
 
 
@@ -73,11 +85,17 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
   addToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("MQTT rx [%s] %s"), topic, payload_copy);
 
   String sTopic(topic);
-  if (sTopic.indexOf(config.topicDmtzSub) > -1)
+  if (sTopic.indexOf(configString(csTopicDmtzSub)) > -1)
     //receivingDomoticzMQTT((char *)payload_copy); // launch the function to treat received data
     receivingDomoticzMQTT(payload_copy); // launch the function to treat received data
-  else
-    doCommand(FROM_MQTT, payload_copy);
+  else {
+    // the correlation id of the command is the last level of <cmd topic>/<id>
+    char cmdTopic[MQTT_TOPIC_SZ + HOSTNAME_SZ];
+    expandTopic(cmdTopic, sizeof(cmdTopic), configString(csTopicCmd));
+    size_t len = strlen(cmdTopic);
+    const char *id = ((!strncmp(topic, cmdTopic, len)) && (topic[len] == '/')) ? topic + len + 1 : NULL;
+    doCommand(FROM_MQTT, payload_copy, id);
+  }
 
   // Free the memory
   free(payload_copy);
@@ -86,10 +104,10 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
 
 
 void mqttClientSetup(void) {
-  addToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("Setting up MQTT server: %s:%d"), config.mqttHost, config.mqttPort);
+  addToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("Setting up MQTT server: %s:%d"), configString(csMqttHost), config.mqttPort);
   if (!mqtt_client.setBufferSize(config.mqttBufferSize))
     addToLogPf(LOG_ERR, TAG_MQTT, PSTR("Could not allocated %d byte MQTT buffer"), config.mqttBufferSize);
-  mqtt_client.setServer(config.mqttHost, config.mqttPort);
+  mqtt_client.setServer(configString(csMqttHost), config.mqttPort);
   mqtt_client.setCallback(mqttCallback);
   //mqttReconnect();
 }
@@ -99,15 +117,23 @@ void mqttDisconnect(void) {
     mqtt_client.disconnect();
 }
 
+bool mqttIsConnected(void) {
+  return mqtt_client.connected();
+}
+
 unsigned long lastMqttConnectAttempt = 0;
 
-void mqttReconnect(void) {
+// Only called from mqttLoop(), in loop(): connect() takes the config strings, which
+// loop() can move
+static void mqttReconnect(void) {
   if ((mqtt_client.connected()) || (!wifiConnected) || (millis() - lastMqttConnectAttempt < 5000) )
     return;
-  if (!strlen(config.mqttUser) || !strlen(config.mqttPswd))
-    mqtt_client.connect(config.hostname);
+  // PubSubClient keeps a pointer to the host name which moves when a config string is changed
+  mqtt_client.setServer(configString(csMqttHost), config.mqttPort);
+  if (!strlen(configString(csMqttUser)) || !strlen(configString(csMqttPswd)))
+    mqtt_client.connect(configString(csHostname));
   else
-    mqtt_client.connect(config.hostname, config.mqttUser, config.mqttPswd);
+    mqtt_client.connect(configString(csHostname), configString(csMqttUser), configString(csMqttPswd));
   lastMqttConnectAttempt = millis();
 }
 
@@ -121,7 +147,7 @@ void mqttLoop(void) {
     //mqttConnectiontime = millis();
     mqttConnected = !mqttConnected;
     if (mqttConnected) {
-       addToLogPf(LOG_INFO, TAG_MQTT, PSTR("Reconnected to MQTT broker %s as %s"), config.mqttHost, config.hostname);
+       addToLogPf(LOG_INFO, TAG_MQTT, PSTR("Reconnected to MQTT broker %s as %s"), configString(csMqttHost), configString(csHostname));
        mqttSubscribe();
     } else
       addToLogP(LOG_INFO, TAG_MQTT, PSTR("Disconnected from MQTT broker"));
@@ -134,28 +160,43 @@ void mqttLoop(void) {
 }
 
 
+// Called from the Ticker task and async_tcp, so the topic is a copy and the connection
+// is left to mqttLoop(). When not connected, the caller falls back to an HTTP request.
 bool mqttPublish(String payload, char* topic = NULL) {
-  if (!mqtt_client.connected()) {
-    mqttReconnect();
-    delay(10);
-  }
   if (!mqtt_client.connected()) {
     return false;
   }
 
-  char* theTopic;
-  if (topic == NULL)
-    theTopic = config.topicDmtzPub;
-  else
+  char pubTopic[MQTT_TOPIC_SZ];
+  const char* theTopic;
+  if (topic == NULL) {
+    configCopyString(csTopicDmtzPub, pubTopic, sizeof(pubTopic));
+    theTopic = pubTopic;
+  } else
     theTopic = topic;
   addToLogPf(LOG_DEBUG, TAG_MQTT, PSTR("MQTT update message: %s"), payload.c_str());
   return mqtt_client.publish(theTopic, payload.c_str());
 }
 
-bool mqttLog(String message) {
-  String topic(config.topicLog);
-  topic.replace("%h%", config.hostname);
-  return mqttPublish(message, (char*) topic.c_str());
+// Does not go through mqttPublish() so that publishing a log message does
+// not add a debug message to the log and does not allocate a String.
+bool mqttLog(const char *message) {
+  if (!mqtt_client.connected())
+    return false;
+  char topic[MQTT_TOPIC_SZ + HOSTNAME_SZ];
+  expandTopic(topic, sizeof(topic), configString(csTopicLog));
+  return mqtt_client.publish(topic, message);
+}
+
+bool mqttPublishResult(const char *result) {
+  if (!mqtt_client.connected())
+    return false;
+  char topic[MQTT_TOPIC_SZ + HOSTNAME_SZ];
+  expandTopic(topic, sizeof(topic), configString(csTopicResult));
+  if (mqtt_client.publish(topic, result))
+    return true;
+  addToLogPf(LOG_ERR, TAG_MQTT, PSTR("Could not publish the %u byte command result to %s"), (unsigned) strlen(result), topic);
+  return false;
 }
 
 #define MQTT_JSON "{\"idx\":%idx%, \"nvalue\":%nval%, \"svalue\":\"%sval%\", \"parse\":false}"
@@ -11,6 +11,9 @@ void mqttClientSetup(void);
 // Disconnectes form the MQTT broker
 void mqttDisconnect(void);
 
+// Returns true if connected to the MQTT broker
+bool mqttIsConnected(void);
+
 // Calls the MQTT client loop function, so mqttLoop() must be in loop() function.
 // Checks if state of the connection to the MQTT broker has changed.
 //   Attempts to reconnect if 5 second interval from last attempt has expired and Wi-Fi is connected
@@ -23,4 +26,10 @@ bool mqttUpdateDmtzSwitch(int idx, int value);
 bool mqttUpdateDomoticzBrightnessSensor(int idx, int value);
 bool mqttUpdateDomoticzTemperatureHumiditySensor(int idx, float value1, float value2, int state);
 
-bool mqttLog(String message);
+// Publishes a log message to the log topic. Returns false if not connected to the MQTT broker
+bool mqttLog(const char *message);
+
+// Publishes the JSON result of a command received from MQTT to the result topic.
+// Returns false if not connected to the MQTT broker or the result does not fit in the
+// MQTT buffer
+bool mqttPublishResult(const char *result);
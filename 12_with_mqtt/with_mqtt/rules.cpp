@@ -0,0 +1,477 @@
+// rules.cpp
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "rules.h"
+
+// Code of a rule
+//
+//   OP_RULE <len>                     len: number of bytes of the rule, header included
+//   <comparison> [<comparison> (OP_AND|OP_OR)] ...
+//   OP_DO <seconds lo> <seconds hi>
+//   OP_RELAY <ruleAction_t>
+//
+// where a comparison is OP_VAR+<ruleVar_t> OP_CONST <value lo> <value hi> OP_LT..OP_NE,
+// the value in tenths. The condition is in postfix order for a stack machine, on brightness<20
+// and relay==0 do relay on is
+//
+//   0x70 18  0x00 0x20 200 0  0x30  0x03 0x20 0 0  0x34  0x40  0x50 0 0  0x60 1
+
+#define OP_VAR      0x00      // + ruleVar_t, push the value
+#define OP_CONST    0x20      // push the 16 bit value that follows
+#define OP_LT       0x30      // pop b and a, push a < b
+#define OP_LE       0x31
+#define OP_GT       0x32
+#define OP_GE       0x33
+#define OP_EQ       0x34
+#define OP_NE       0x35
+#define OP_AND      0x40      // pop b and a, push a && b
+#define OP_OR       0x41
+#define OP_DO       0x50      // end of the condition, followed by the 16 bit duration (s)
+#define OP_RELAY    0x60      // followed by the ruleAction_t, end of the rule
+#define OP_RULE     0x70      // followed by the length of the rule
+
+#define RULES_STACK 4         // a comparison joined to the result of the previous ones needs 3
+
+static const char *varNames[RULE_VAR_COUNT] = {"brightness", "temp", "humidity", "relay"};
+static const char *opNames[] = {"<", "<=", ">", ">=", "==", "!="};   // in the order of OP_LT..OP_NE
+static const char *actionNames[] = {"off", "on", "toggle"};           // ruleAction_t
+
+struct ruleState_t {
+  bool active;                // the condition is true
+  bool fired;                 // the action was executed since the condition became true
+  uint32_t since;             // time when the condition became true (ms)
+};
+
+static uint8_t code[RULES_CODE_SZ];
+static size_t codeLen = 0;
+static uint8_t ruleStart[RULES_MAX];        // offset of each rule in code
+static int ruleCount = 0;
+static ruleState_t ruleState[RULES_MAX];
+
+static int32_t values[RULE_VAR_COUNT];
+static uint8_t known = 0;                   // bit per ruleVar_t, set once the value is updated
+
+static uint8_t busy = 0;                    // the rules are being evaluated or changed
+static uint8_t pending = 0;                 // a value was updated while busy
+#define RULES_PASSES 4                      // passes of a rulesUpdate() to catch up with the updates made by the actions
+
+static ruleActionFn_t actionFn = NULL;
+
+void rulesSetAction(ruleActionFn_t fn) {
+  actionFn = fn;
+}
+
+//================ compiler ================
+
+static inline bool isSpace(char c) {
+  return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+static inline bool isAlpha(char c) {
+  return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+static inline bool isDigit(char c) {
+  return (c >= '0') && (c <= '9');
+}
+
+struct compiler_t {
+  const char *p;              // next character of the text
+  uint8_t *out;
+  size_t len;                 // bytes written to out
+  size_t size;                // size of out
+  const char *error;
+};
+
+static void skipSpace(compiler_t &c) {
+  while (isSpace(*c.p))
+    c.p++;
+}
+
+// Accepts the word if it is next in the text
+static bool word(compiler_t &c, const char *w) {
+  skipSpace(c);
+  size_t n = strlen(w);
+  if ((strncasecmp(c.p, w, n)) || (isAlpha(c.p[n])))
+    return false;
+  c.p += n;
+  return true;
+}
+
+// Returns the index in names of the word next in the text, -1 if it is none of them
+static int oneOf(compiler_t &c, const char **names, int count) {
+  for (int i = 0; i < count; i++) {
+    if (word(c, names[i]))
+      return i;
+  }
+  return -1;
+}
+
+// Parses a number with at most one decimal into tenths
+static bool number(compiler_t &c, int32_t &value) {
+  skipSpace(c);
+  bool minus = (*c.p == '-');
+  if (minus)
+    c.p++;
+  if (!isDigit(*c.p))
+    return false;
+  int32_t v = 0;
+  while ((isDigit(*c.p)) && (v <= 100000))
+    v = 10*v + (*c.p++ - '0');
+  v *= 10;
+  if ((*c.p == '.') && (isDigit(c.p[1]))) {
+    v += c.p[1] - '0';
+    c.p += 2;
+  }
+  if ((isDigit(*c.p)) || (isAlpha(*c.p)) || (*c.p == '.'))
+    return false;
+  value = (minus) ? -v : v;
+  return (value >= INT16_MIN) && (value <= INT16_MAX);
+}
+
+// Parses a number of seconds
+static bool seconds(compiler_t &c, int32_t &value) {
+  skipSpace(c);
+  if (!isDigit(*c.p))
+    return false;
+  value = 0;
+  while ((isDigit(*c.p)) && (value <= UINT16_MAX))
+    value = 10*value + (*c.p++ - '0');
+  return (value <= UINT16_MAX) && (!isAlpha(*c.p)) && (*c.p != '.');
+}
+
+static bool emit(compiler_t &c, uint8_t byte) {
+  if (c.len >= c.size) {
+    c.error = "no room for the rule";
+    return false;
+  }
+  c.out[c.len++] = byte;
+  return true;
+}
+
+static bool emit16(compiler_t &c, uint8_t op, int32_t value) {
+  return (emit(c, op)) && (emit(c, value & 0xFF)) && (emit(c, (value >> 8) & 0xFF));
+}
+
+static bool comparison(compiler_t &c) {
+  int var = oneOf(c, varNames, RULE_VAR_COUNT);
+  if (var < 0) {
+    c.error = "value expected (brightness, temp, humidity or relay)";
+    return false;
+  }
+  skipSpace(c);
+  int op = -1;
+  if (*c.p == '<')
+    op = (c.p[1] == '=') ? OP_LE : OP_LT;
+  else if (*c.p == '>')
+    op = (c.p[1] == '=') ? OP_GE : OP_GT;
+  else if (*c.p == '=')
+    op = OP_EQ;
+  else if ((*c.p == '!') && (c.p[1] == '='))
+    op = OP_NE;
+  if (op < 0) {
+    c.error = "operator expected";
+    return false;
+  }
+  c.p += ((op == OP_LT) || (op == OP_GT) || ((op == OP_EQ) && (c.p[1] != '='))) ? 1 : 2;
+  int32_t value;
+  if (!number(c, value)) {
+    c.error = "invalid number";
+    return false;
+  }
+  return (emit(c, OP_VAR + var)) && (emit16(c, OP_CONST, value)) && (emit(c, op));
+}
+
+// Compiles text into out, returns the length of the code, 0 on error
+static size_t compile(const char *text, uint8_t *out, size_t size, const char **error) {
+  compiler_t c = {text, out, 0, size, NULL};
+  int32_t duration = 0;
+  int action;
+  if (!word(c, "on")) {
+    c.error = "\"on\" expected";
+    goto fail;
+  }
+  if ((!emit(c, OP_RULE)) || (!emit(c, 0)) || (!comparison(c)))
+    goto fail;
+  for (;;) {
+    uint8_t logic = (word(c, "and")) ? OP_AND : (word(c, "or")) ? OP_OR : 0;
+    if (!logic)
+      break;
+    if ((!comparison(c)) || (!emit(c, logic)))
+      goto fail;
+  }
+  if ((word(c, "for")) && (!seconds(c, duration))) {
+    c.error = "duration in seconds expected";
+    goto fail;
+  }
+  if ((!word(c, "do")) || (!word(c, "relay"))) {
+    c.error = "\"do relay\" expected";
+    goto fail;
+  }
+  action = oneOf(c, actionNames, sizeof(actionNames)/sizeof(actionNames[0]));
+  if (action < 0)
+    action = (word(c, "0")) ? raRelayOff : (word(c, "1")) ? raRelayOn : -1;
+  skipSpace(c);
+  if ((action < 0) || (*c.p)) {
+    c.error = "relay on, off or toggle expected";
+    goto fail;
+  }
+  if ((!emit16(c, OP_DO, duration)) || (!emit(c, OP_RELAY)) || (!emit(c, action)))
+    goto fail;
+  if (c.len > UINT8_MAX) {
+    c.error = "rule too long";
+    goto fail;
+  }
+  out[1] = c.len;
+  return c.len;
+fail:
+  *error = c.error;
+  return 0;
+}
+
+//================ checks ================
+
+static inline int32_t get16(const uint8_t *p) {
+  return (int16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint16_t getU16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+// Returns the length of the rule at p, 0 if its code is not valid. The comparisons must
+// be joined as compile() does, which bounds the depth of the stack.
+static size_t checkRule(const uint8_t *p, size_t avail) {
+  if ((avail < 2) || (p[0] != OP_RULE) || (p[1] > avail))
+    return 0;
+  const uint8_t *end = p + p[1];
+  const uint8_t *q = p + 2;
+  bool first = true;
+  for (;;) {
+    if ((end - q < 5) || (q[0] >= OP_VAR + RULE_VAR_COUNT) || (q[1] != OP_CONST) || (q[4] < OP_LT) || (q[4] > OP_NE))
+      return 0;
+    q += 5;
+    if (!first) {
+      if ((q >= end) || ((*q != OP_AND) && (*q != OP_OR)))
+        return 0;
+      q++;
+    }
+    first = false;
+    if ((q < end) && (*q == OP_DO))
+      break;
+  }
+  if ((end - q != 5) || (q[3] != OP_RELAY) || (q[4] > raRelayToggle))
+    return 0;
+  return p[1];
+}
+
+// Checks the code and sets ruleStart, returns false if it is not valid
+static bool indexRules(const uint8_t *p, size_t len) {
+  size_t offset = 0;
+  int n = 0;
+  while (offset < len) {
+    size_t size = checkRule(p + offset, len - offset);
+    if ((!size) || (n >= RULES_MAX))
+      return false;
+    ruleStart[n++] = offset;
+    offset += size;
+  }
+  ruleCount = n;
+  return true;
+}
+
+//================ interpreter ================
+
+// Evaluates the condition of the rule at p, sets seconds and action
+static bool evalRule(const uint8_t *p, uint16_t &seconds, ruleAction_t &action) {
+  int32_t stack[RULES_STACK];
+  int sp = 0;
+  bool unknown = false;
+  for (p += 2;; ) {
+    uint8_t op = *p++;
+    if (op < OP_VAR + RULE_VAR_COUNT) {
+      unknown |= !(known & (1 << op));
+      stack[sp++] = __atomic_load_n(&values[op], __ATOMIC_RELAXED);
+    } else if (op == OP_CONST) {
+      stack[sp++] = get16(p);
+      p += 2;
+    } else if (op == OP_DO) {
+      seconds = getU16(p);
+      action = (ruleAction_t) p[3];
+      return (!unknown) && (stack[0]);
+    } else {
+      int32_t b = stack[--sp];
+      int32_t &a = stack[sp-1];
+      switch (op) {
+        case OP_LT:  a = a < b; break;
+        case OP_LE:  a = a <= b; break;
+        case OP_GT:  a = a > b; break;
+        case OP_GE:  a = a >= b; break;
+        case OP_EQ:  a = a == b; break;
+        case OP_NE:  a = a != b; break;
+        case OP_AND: a = a && b; break;
+        default:     a = a || b; break;   // OP_OR
+      }
+    }
+  }
+}
+
+// Evaluates all the rules and executes the actions of the ones that fire
+static void runRules(uint32_t now) {
+  for (int i = 0; i < ruleCount; i++) {
+    uint16_t seconds;
+    ruleAction_t action;
+    ruleState_t &state = ruleState[i];
+    if (!evalRule(code + ruleStart[i], seconds, action)) {
+      state.active = false;
+      continue;
+    }
+    if (!state.active) {
+      state.active = true;
+      state.fired = false;
+      state.since = now;
+    }
+    if ((!state.fired) && (now - state.since >= 1000UL*seconds)) {
+      state.fired = true;
+      if (actionFn)
+        actionFn(i, action);
+    }
+  }
+}
+
+// Evaluates the rules unless they are being evaluated by another task or by the
+// caller of the action that updated a value, which then evaluates them again
+static void evaluate(uint32_t now) {
+  if (__atomic_exchange_n(&busy, 1, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&pending, 1, __ATOMIC_RELEASE);
+    return;
+  }
+  int passes = 0;
+  do {
+    __atomic_store_n(&pending, 0, __ATOMIC_RELAXED);
+    runRules(now);
+  } while ((__atomic_load_n(&pending, __ATOMIC_ACQUIRE)) && (++passes < RULES_PASSES));
+  __atomic_store_n(&busy, 0, __ATOMIC_RELEASE);
+}
+
+void rulesUpdate(ruleVar_t var, int32_t value, uint32_t now) {
+  __atomic_store_n(&values[var], value, __ATOMIC_RELAXED);
+  __atomic_fetch_or(&known, 1 << var, __ATOMIC_RELEASE);
+  evaluate(now);
+}
+
+void rulesTick(uint32_t now) {
+  evaluate(now);
+}
+
+//================ rules ================
+
+// The rules are only changed while holding busy, the tasks that evaluate them do not
+// wait for it. An added rule starts inactive, the other rules keep their state so that
+// the ones whose condition is true do not fire again. Replacing or clearing all the
+// rules resets every state.
+
+static void lock(void) {
+  while (__atomic_exchange_n(&busy, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock(void) {
+  __atomic_store_n(&busy, 0, __ATOMIC_RELEASE);
+}
+
+bool rulesAdd(const char *text, const char **error) {
+  uint8_t rule[UINT8_MAX];
+  size_t len = compile(text, rule, sizeof(rule), error);
+  if (!len)
+    return false;
+  lock();
+  bool ok = (ruleCount < RULES_MAX) && (codeLen + len <= RULES_CODE_SZ);
+  if (ok) {
+    memcpy(code + codeLen, rule, len);
+    memset(&ruleState[ruleCount], 0, sizeof(ruleState[0]));
+    ruleStart[ruleCount++] = codeLen;
+    codeLen += len;
+  } else
+    *error = (ruleCount < RULES_MAX) ? "no room for the rule" : "too many rules";
+  unlock();
+  return ok;
+}
+
+bool rulesRemove(int rule) {
+  if ((rule < 0) || (rule >= ruleCount))
+    return false;
+  lock();
+  size_t start = ruleStart[rule];
+  size_t len = code[start + 1];
+  memmove(code + start, code + start + len, codeLen - start - len);
+  codeLen -= len;
+  memmove(ruleState + rule, ruleState + rule + 1, (ruleCount - rule - 1)*sizeof(ruleState[0]));
+  indexRules(code, codeLen);
+  unlock();
+  return true;
+}
+
+void rulesClear(void) {
+  lock();
+  codeLen = 0;
+  ruleCount = 0;
+  memset(ruleState, 0, sizeof(ruleState));
+  unlock();
+}
+
+int rulesCount(void) {
+  return ruleCount;
+}
+
+const uint8_t *rulesCode(size_t &len) {
+  len = codeLen;
+  return code;
+}
+
+bool rulesSetCode(const uint8_t *p, size_t len) {
+  lock();
+  bool ok = (len <= RULES_CODE_SZ) && (indexRules(p, len));
+  if (ok) {
+    memcpy(code, p, len);
+    codeLen = len;
+  } else {
+    codeLen = 0;
+    ruleCount = 0;
+  }
+  memset(ruleState, 0, sizeof(ruleState));
+  unlock();
+  return ok;
+}
+
+static void printValue(char *buf, size_t size, int32_t value) {
+  int32_t v = (value < 0) ? -value : value;
+  if (v % 10)
+    snprintf(buf, size, "%s%d.%d", (value < 0) ? "-" : "", (int) (v / 10), (int) (v % 10));
+  else
+    snprintf(buf, size, "%d", (int) (value / 10));
+}
+
+bool rulePrint(int rule, char *buf, size_t size) {
+  if ((rule < 0) || (rule >= ruleCount) || (!size))
+    return false;
+  const uint8_t *p = code + ruleStart[rule] + 2;
+  char value[8];
+  size_t n = snprintf(buf, size, "on");
+  while (*p != OP_DO) {
+    // a comparison, followed by the logic operator that joins it to the previous ones
+    const char *logic = (p != code + ruleStart[rule] + 2) ? ((p[5] == OP_AND) ? " and" : " or") : "";
+    printValue(value, sizeof(value), get16(p + 2));
+    if (n < size)
+      n += snprintf(buf + n, size - n, "%s %s%s%s", logic, varNames[*p], opNames[p[4] - OP_LT], value);
+    p += (*logic) ? 6 : 5;
+  }
+  uint16_t seconds = getU16(p + 1);
+  if ((seconds) && (n < size))
+    n += snprintf(buf + n, size - n, " for %u", (unsigned) seconds);
+  if (n < size)
+    snprintf(buf + n, size - n, " do relay %s", actionNames[p[4]]);
+  return true;
+}
@@ -0,0 +1,79 @@
+// rules.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-device rules that switch the relay when sensor values cross thresholds.
+ *
+ * A rule is written as
+ *
+ *   on <condition> [for <seconds>] do relay (on|off|toggle|1|0)
+ *
+ * where the condition is one or more comparisons of a value with a number joined
+ * by "and" or "or", evaluated from left to right without precedence:
+ *
+ *   on brightness<20 and relay==0 do relay on
+ *   on brightness>40 for 60 do relay off
+ *
+ * The values are brightness, temp, humidity and relay, the operators <, <=, >, >=,
+ * == (or =) and != and the numbers can have one decimal. A rule fires when its
+ * condition becomes true, or when it has been true for the given number of seconds,
+ * and not again until the condition has been false. Hysteresis is obtained with two
+ * rules with different thresholds as above.
+ *
+ * Each rule is compiled once, when it is added, to a few bytes of code that are
+ * kept in NVS under RULES_NVS_KEY (see configSaveData() in config.h). The code of
+ * all the rules is checked when it is set so the interpreter does not check it
+ * again. Rules are evaluated when a value is updated and at each tick, without
+ * allocating memory.
+ *
+ * This module does not depend on the Arduino framework.
+ */
+
+#define RULES_CODE_SZ   256     // size of the code of all the rules
+#define RULES_MAX       16      // maximum number of rules
+#define RULE_TEXT_SZ    128     // size of the text of a rule as written by rulePrint()
+#define RULES_NVS_KEY   "rules"
+
+enum ruleVar_t {rvBrightness, rvTemp, rvHumidity, rvRelay, RULE_VAR_COUNT};
+
+enum ruleAction_t {raRelayOff, raRelayOn, raRelayToggle};
+
+  // Called when rule (0 based) fires
+typedef void (*ruleActionFn_t)(int rule, ruleAction_t action);
+
+  // Sets the function that executes the actions of the rules
+void rulesSetAction(ruleActionFn_t fn);
+
+  // Compiles text and adds the rule at the end. Returns false, without changing the
+  // rules, if text is not valid or there is no room for the rule, in which case
+  // error is the reason.
+bool rulesAdd(const char *text, const char **error);
+
+  // Removes rule (0 based), returns false if there is no such rule
+bool rulesRemove(int rule);
+
+void rulesClear(void);
+
+  // Returns the number of rules
+int rulesCount(void);
+
+  // Writes the text of rule (0 based) into buf, returns false if there is no such rule
+bool rulePrint(int rule, char *buf, size_t size);
+
+  // Returns the code of all the rules and its length in len
+const uint8_t *rulesCode(size_t &len);
+
+  // Replaces the rules with the code of len bytes from rulesCode(). Returns false,
+  // and leaves no rules, if the code is not valid.
+bool rulesSetCode(const uint8_t *code, size_t len);
+
+  // Sets value, in tenths (a temperature of 21.5 is 215, relay on is 10), and evaluates
+  // the rules. now is the time in ms. Can be called from any task and from an action.
+void rulesUpdate(ruleVar_t var, int32_t value, uint32_t now);
+
+  // Evaluates the rules so that the ones with a duration fire in time, call often
+void rulesTick(uint32_t now);
@@ -0,0 +1,67 @@
+// tokenizer.cpp
+
+#include <string.h>
+#include "tokenizer.h"
+
+// Same as isspace() in the C locale without its table lookup through the locale
+static inline bool isSpace(char c) {
+  return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+char *commandEnd(char *line) {
+  char *p = line;
+  bool start = true;      // p is at the start of a token
+  while ((*p) && (*p != ';')) {
+    if ((start) && (*p == '"')) {
+      char *quote = strchr(p + 1, '"');
+      if (!quote)
+        return p + strlen(p);   // reported by tokenize()
+      p = quote + 1;
+      continue;
+    }
+    start = isSpace(*p);
+    p++;
+  }
+  return p;
+}
+
+int tokenize(char *command, token_t *tokens, int max) {
+  char *p = command;
+  int n = 0;
+  while (n < max) {
+    while (isSpace(*p))
+      p++;
+    if (!*p)
+      break;
+    char *start = p;
+    if (*p == '"') {
+      start = ++p;
+      p = strchr(p, '"');
+      if (!p)
+        return -1;
+    } else {
+      while ((*p) && (!isSpace(*p)))
+        p++;
+    }
+    tokens[n].str = start;
+    tokens[n].len = p - start;
+    n++;
+    if (*p)
+      *p++ = 0;
+  }
+  return n;
+}
+
+char *tokenJoin(token_t *tokens, int first, int count) {
+  // each token is followed by at least one separator or quote so the characters
+  // are only moved toward the start of the line
+  char *end = tokens[first].str + tokens[first].len;
+  for (int i = first + 1; i < count; i++) {
+    *end++ = ' ';
+    memmove(end, tokens[i].str, tokens[i].len);
+    end += tokens[i].len;
+  }
+  *end = 0;
+  tokens[first].len = end - tokens[first].str;
+  return tokens[first].str;
+}
@@ -0,0 +1,39 @@
+// tokenizer.h
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Splitting of command lines in place, without copying or allocating memory.
+ *
+ * A line holds commands separated by ';', each one made of tokens separated by
+ * white space. A token that starts with a double quote extends to the next double
+ * quote so that it can contain spaces and ';', the quotes are not part of the token:
+ *
+ *   name device "Kitchen light"; name     ->  [name] [device] [Kitchen light]  and  [name]
+ *   topic log ""                         ->  [topic] [log] []
+ *
+ * A double quote inside a token is an ordinary character. The separators that end
+ * the commands and the tokens are replaced by 0 in the line so that each token is a
+ * nul terminated string.
+ *
+ * This module does not depend on the Arduino framework.
+ */
+
+struct token_t {
+  char *str;      // nul terminated, in the line
+  size_t len;     // length of str
+};
+
+  // Returns the end of the first command of line, the first ';' that is not in a quoted
+  // token or the terminating 0 of line
+char *commandEnd(char *line);
+
+  // Splits the command in place into at most max tokens. Tokens after the first max are
+  // ignored. Returns the number of tokens or -1 if the closing quote of a token is missing.
+int tokenize(char *command, token_t *tokens, int max);
+
+  // Joins tokens first to count - 1 into tokens[first], separated by one space. Returns
+  // tokens[first].str.
+char *tokenJoin(token_t *tokens, int first, int count);
@@ -8,6 +8,8 @@
 #include "html.h"
 #include "hardware.h"
 #include "commands.hpp"
+#include "configjson.h"
+#include "ArduinoJson.h"
 #include "webserver.h"
 
 // Values to be displayed in Web page with initial values
@@ -21,27 +23,34 @@ extern bool wifiConnected;
 extern bool accessPointUp;
 
 
+// Body of the POST /config.json request being received
+static char jsonBody[CONFIG_JSON_MAX];
+static size_t jsonLen = 0;
+static AsyncWebServerRequest *jsonOwner = NULL;
+
 // Webserver instance using default HTTP port 80
 AsyncWebServer server(80);
 
 // Create an Event Source on /events
 AsyncEventSource events("/events");
 
+// Returns a copy of string id of the config, the web server runs in the async_tcp
+// task while loop() can change the strings
+static String configText(cfgString_t id) {
+  char buf[HOST_SZ];
+  configCopyString(id, buf, sizeof(buf));
+  return String(buf);
+}
+
 // Web server template substitution function
 String processor(const String& var){
   addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("Processing %s"), var.c_str());
   if (var == "TITLE") return String("XIAO ESP32C3 WEB SERVER");
-  if (var == "DEVICENAME") return String(config.devname);
+  if (var == "DEVICENAME") return configText(csDevname);
   if (var == "TEMPERATURE") return Temperature;
   if (var == "HUMIDITY") return Humidity;
   if (var == "BRIGHTNESS") return Brightness;
   if (var == "RELAYSTATE") return RelayState;
-  if (var == "LOG") return logHistory();
-  /*  // NOTE:   for debugging size of log {
-    String test = logHistory();
-    Serial.printf("logHistory.length: %d, starts with: %s\n", test.length(), test.substring(0, 64).c_str());
-    return test;
-  } */
   if (var == "INFO") return String("Using AsyncWebServer, AJAX and Server-Sent Events (SSE)");
   return String(); // empty string
 }
@@ -51,13 +60,13 @@ String processor2(const String& var){
   addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("Processing %s"), var.c_str());
   if (var == "TITLE") return String("XIAO ESP32C3 WEB SERVER");
   if (var == "DEVICENAME") {
-    String devstring(config.devname);
+    String devstring(configText(csDevname));
     devstring += "<br/>";
     devstring += "Access Point";
     return devstring;
   }
-  if (var == "SSID") return String(config.wifiSsid);
-  if ((var == "PASS") && strlen(config.wifiPswd)) return String("***********");
+  if (var == "SSID") return configText(csWifiSsid);
+  if ((var == "PASS") && configText(csWifiPswd).length()) return String("***********");
   if (var == "STAIP") return IPAddress(config.staStaticIP).toString();
   if (var == "GATE") return IPAddress(config.staGateway).toString();
   if (var == "MASK") return IPAddress(config.staNetmask).toString();
@@ -65,6 +74,59 @@ String processor2(const String& var){
 }
 
 
+// Sends the result put in the reply box by loop() as the response to the request
+static void sendReply(AsyncWebServerRequest *request, int reply) {
+  // the web server polls the response until the result is in the reply box
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+    [reply](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      if (!commandReplyReady(reply))
+        return RESPONSE_TRY_AGAIN;
+      return commandReplyRead(reply, buffer, maxLen, index);
+    });
+  request->onDisconnect([reply]() { commandReplyClose(reply); });
+  request->send(response);
+}
+
+// Queues the command of GET /cmd?cmd=<commands>[&id=<id>] and answers with the JSON
+// result of the commands once they are executed in loop(), see doCommand()
+static void handleCommand(AsyncWebServerRequest *request) {
+  AsyncWebParameter *cmd = request->getParam("cmd");
+  if ((!cmd) || (cmd->value().length() == 0)) {
+    request->send(400, "text/plain", "Missing cmd parameter");
+    return;
+  }
+  AsyncWebParameter *id = request->getParam("id");
+  int reply = commandReplyOpen();
+  if ((reply < 0) || (!doCommand(FROM_WEBC, cmd->value(), (id) ? id->value().c_str() : NULL, reply))) {
+    if (reply >= 0)
+      commandReplyClose(reply);
+    request->send(503, "text/plain", "Command queue full or command too long");
+    return;
+  }
+  sendReply(request, reply);
+}
+
+// Imports the settings in the body of POST /config.json, collected in jsonBody, in loop()
+// and sends back the JSON result of the import
+static void handleImport(AsyncWebServerRequest *request) {
+  if ((jsonOwner != request) || (jsonLen == 0)) {
+    request->send(400, "text/plain", "Missing JSON body");
+    return;
+  }
+  if (jsonLen > CONFIG_JSON_MAX) {
+    request->send(413, "text/plain", "JSON body too large");
+    return;
+  }
+  int reply = commandReplyOpen();
+  if ((reply < 0) || (!doImport(jsonBody, jsonLen, reply))) {
+    if (reply >= 0)
+      commandReplyClose(reply);
+    request->send(503, "text/plain", "Import already pending");
+    return;
+  }
+  sendReply(request, reply);
+}
+
 void webserversetup(void) {
   addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("Adding HTTP request handlers"));
 
@@ -87,7 +149,7 @@ void webserversetup(void) {
 /****
   server.on("/", HTTP_POST, [](AsyncWebServerRequest *request){
     //addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("POST / params=%d"), request->params());
-    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("POST / request with %d params"), request->params());
+    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("POST / request with %u params"), (unsigned) request->params());
     if (request->params() == 1) {
       //addToLogP(LOG_DEBUG, TAG_WEBSERVER, PSTR("getting param"));
       AsyncWebParameter* aParam = request->getParam(0, true, false);
@@ -102,7 +164,7 @@ void webserversetup(void) {
   });
 
   server.on("/", HTTP_POST, [](AsyncWebServerRequest *request){
-    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("POST / with %d params"), request->params());
+    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("POST / with %u params"), (unsigned) request->params());
     delay(5);
     if (request->params() > 0) {
       addToLogP(LOG_DEBUG, TAG_WEBSERVER, PSTR("Getting aParam"));
@@ -127,14 +189,8 @@ void webserversetup(void) {
 ****/
 
   server.on("/cmd", HTTP_GET, [](AsyncWebServerRequest *request){
-    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("GET /cmd with %d params"), request->params());
-    if (request->params() == 1) {
-      AsyncWebParameter* aParam = request->getParam(0);
-      if ((aParam) && (aParam->name().equals("cmd")) && (aParam->value().length() > 0)) {
-        doCommand(FROM_WEBC, aParam->value());
-      }
-    }
-    request->send(200, "text/plain", "OK");
+    addToLogPf(LOG_DEBUG, TAG_WEBSERVER, PSTR("GET /cmd with %u params"), (unsigned) request->params());
+    handleCommand(request);
   });
 
   server.on("/toggle", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -160,6 +216,56 @@ void webserversetup(void) {
     request->send_P(200, "text/html", html_console, processor);
   });
 
+  // The log history is streamed from the log ring, one TCP chunk at a time
+  server.on("/log.txt", HTTP_GET, [](AsyncWebServerRequest *request){
+    addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("GET /log.txt"));
+    logHistory_t hist;
+    logHistoryBegin(hist);
+    request->sendChunked("text/plain", [hist](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return logHistoryRead(hist, (char *) buffer, maxLen);
+    });
+  });
+
+  // Compact binary export of the log ring, decoded with tools/logdecode.cpp
+  server.on("/log.bin", HTTP_GET, [](AsyncWebServerRequest *request){
+    addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("GET /log.bin"));
+    logBinary_t bin;
+    logBinaryBegin(bin);
+    request->sendChunked("application/octet-stream", [bin](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return logBinaryRead(bin, buffer, maxLen);
+    });
+  });
+
+  // Export of the settings, without the passwords
+  server.on("/config.json", HTTP_GET, [](AsyncWebServerRequest *request){
+    addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("GET /config.json"));
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    if (configWriteJson(*response))
+      request->send(response);
+    else {
+      delete response;
+      request->send(500, "text/plain", "Config too large");
+    }
+  });
+
+  // Import of settings, the body is collected in jsonBody and imported when complete
+  server.on("/config.json", HTTP_POST, [](AsyncWebServerRequest *request){
+    addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("POST /config.json"));
+    handleImport(request);
+    if (jsonOwner == request)
+      jsonOwner = NULL;
+  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+    if (!index) {
+      jsonOwner = request;
+      jsonLen = 0;
+    }
+    if (jsonOwner != request)
+      return;
+    if (index + len <= CONFIG_JSON_MAX)
+      memcpy(jsonBody + index, data, len);
+    jsonLen = index + len;
+  });
+
   server.on("/rst", HTTP_GET, [](AsyncWebServerRequest *request){
     addToLogP(LOG_INFO, TAG_WEBSERVER, PSTR("GET /rst"));
     request->send(200, "text/plain", "Restart device");
@@ -199,6 +305,8 @@ void webserversetup(void) {
       addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Empty SSID"));
     else if ((wifi_pass.length() > 0) && (wifi_pass.length() < 8))
       addToLogP(LOG_ERR, TAG_COMMAND, PSTR("Password too short"));
+    else if ((wifi_ssid.length() >= HOST_SZ) || (wifi_pass.length() >= PSWD_SZ))
+      addToLogP(LOG_ERR, TAG_COMMAND, PSTR("SSID or password too long"));
     else if (ipa && ((ipa & mask) != (gateway & mask)))
       addToLogP(LOG_ERR, TAG_COMMAND, PSTR("The station IP and gateway are not on the same subnet"));
     else
@@ -208,17 +316,22 @@ void webserversetup(void) {
       return;
     }
 
-    request->send_P(200, "text/html", html_wm_connect, processor);
-
-    strlcpy(config.wifiSsid, wifi_ssid.c_str(), HOST_SZ);
-    strlcpy(config.wifiPswd, wifi_pass.c_str(), PSWD_SZ);
-
+    // the credentials are imported, saved and the device restarted in loop()
+    StaticJsonDocument<512> doc;
+    char json[512];
+    doc["wifi"]["ssid"] = wifi_ssid;
+    doc["wifi"]["pswd"] = wifi_pass;
     if (ipa) {
-      config.staStaticIP = ipa;
-      config.staGateway = gateway;
-      config.staNetmask = mask;
+      doc["staip"]["ip"] = ipa.toString();
+      doc["staip"]["gateway"] = gateway.toString();
+      doc["staip"]["mask"] = mask.toString();
     }
-    espRestart();
+    size_t len = serializeJson(doc, json, sizeof(json));
+    if ((!doImport(json, len, -1)) || (!doCommand(FROM_WEBC, "restart 0"))) {
+      request->send_P(200, "text/html", html_wm_bad_creds, processor);
+      return;
+    }
+    request->send_P(200, "text/html", html_wm_connect, processor);
 
   });
 
@@ -8,14 +8,14 @@
 
 void startAp(void) {
   WiFi.enableAP(true);
-  String apName(config.hostname);
-  if (strlen(config.apSuffix)) {
+  String apName(configString(csHostname));
+  if (strlen(configString(csApSuffix))) {
     apName += "-";
-    apName += config.apSuffix;
+    apName += configString(csApSuffix);
   }
   apName.toUpperCase();
   WiFi.softAPsetHostname(apName.c_str());
-  if (!WiFi.softAP(apName.c_str(), config.apPswd)) {
+  if (!WiFi.softAP(apName.c_str(), configString(csApPswd))) {
     addToLogP(LOG_ERR, TAG_WIFI, PSTR("Could not create Wi-Fi network access point"));
     return;
   }
@@ -88,12 +88,12 @@ void wifiLogStatus(void) {
 
 void wifiConnect() {
   WiFi.mode(WIFI_STA);
-  WiFi.setHostname(config.hostname);
+  WiFi.setHostname(configString(csHostname));
   WiFi.setAutoReconnect(true);
   // Above must be done no matter if there is a valid ssid or not.
   // Starting with the followin test and exiting before setting mode etc
   //  causes "invalid mbox" panick reset when ssid == "".
-  if (!strlen(config.wifiSsid)) {
+  if (!strlen(configString(csWifiSsid))) {
     addToLogP(LOG_ERR, TAG_WIFI, PSTR("Wi-Fi network name must be specified"));
     return;
   }
@@ -115,7 +115,7 @@ void wifiConnect() {
      WiFi.config(IPAddress((uint32_t) 0), IPAddress((uint32_t) 0), IPAddress((uint32_t) 0));
      addToLogP(LOG_INFO, TAG_WIFI, PSTR("Using dynamic IP address"));
   }
-  WiFi.begin(config.wifiSsid, config.wifiPswd);
-  //addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("Attempting to connect to %s: (password: %s)"), config.wifiSsid, config.wifiPswd);
-  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Attempting to connect to %s"), config.wifiSsid);
+  WiFi.begin(configString(csWifiSsid), configString(csWifiPswd));
+  //addToLogPf(LOG_DEBUG, TAG_COMMAND, PSTR("Attempting to connect to %s: (password: %s)"), configString(csWifiSsid), configString(csWifiPswd));
+  addToLogPf(LOG_INFO, TAG_COMMAND, PSTR("Attempting to connect to %s"), configString(csWifiSsid));
 }
@@ -6,7 +6,7 @@
 void wifiLogStatus(void);
 
 // Attempt to connect to the specified Wi-Fi network.
-//   If config.wifiSsid == "" then will do nothing
+//   If configString(csWifiSsid) == "" then will do nothing
 //   Will set a static ip address if config.staStaticIP != 0.0.0.0
 void wifiConnect();
 